@@ -0,0 +1,341 @@
+/*-
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2011-2026 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "types.h"
+#include "utils.h"
+#include "arena.h"
+
+/* malloc(3), free(3) */
+#include <stdlib.h>
+
+/* fprintf(3) */
+#include <stdio.h>
+
+/* strlen(3), memcpy(3), strerror(3) */
+#include <string.h>
+
+/* uintmax_t */
+#include <stdint.h>
+
+/* errno */
+#include <errno.h>
+
+/* mmap(2), munmap(2), madvise(2) */
+#include <sys/mman.h>
+
+/* ftruncate(2), close(2), sysconf(3) */
+#include <unistd.h>
+
+/* posix_fallocate(2) */
+#include <fcntl.h>
+
+/* assert(3) */
+#include <assert.h>
+
+/*
+ * Objects living until the end of the program (e.g. file entries in non-live
+ * mode, along with their paths) are carved out of large blocks instead of
+ * being allocated one by one: this avoids allocator's per-object overhead and
+ * allows freeing them all at once, one block at a time. Objects cannot be
+ * freed individually. An arena is not thread-safe.
+ *
+ * An arena may also be backed by a spool file (option -B): blocks are then
+ * shared mappings of consecutive parts of that file and, once full, are
+ * released from memory (they are read back from the file when accessed
+ * again). Objects keep the same address while their block is mapped, so a
+ * spooled arena can be used as a regular one.
+ */
+
+/* Alignment of objects returned by arena_alloc() */
+union arena_align {
+    uintmax_t i;
+    void *p;
+    double d;
+};
+#define ARENA_ALIGN (sizeof(union arena_align))
+
+/* An arena block, followed by its data */
+struct arena_block {
+    struct arena_block *prevp;      /* previous block */
+    size_t size;                    /* size of block, including header */
+    union arena_align data[];
+};
+
+struct arena {
+    struct arena_block *blockp;     /* current (last) block */
+    char *next;                     /* next free byte in current block */
+    char *end;                      /* end of current block */
+    size_t block_size;              /* size of blocks' data */
+    size_t size;                    /* memory used by (non-spooled) blocks */
+    int fd;                         /* spool file, or -1 */
+    off_t offset;                   /* spool file size */
+};
+
+/* Initialize an arena using blocks of block_size bytes
+   - returns NULL if error */
+struct arena *
+arena_init(size_t block_size)
+{
+    assert(block_size > 0);
+
+    struct arena *arenap = NULL;
+
+    if_not_malloc(arenap, sizeof(struct arena),
+        return (NULL);
+    )
+    arenap->blockp = NULL;
+    arenap->next = NULL;
+    arenap->end = NULL;
+    arenap->block_size = block_size;
+    arenap->size = 0;
+    arenap->fd = -1;
+    arenap->offset = 0;
+    return (arenap);
+}
+
+/* Initialize an arena using blocks of block_size bytes, backed by spool
+   file fd (which must be empty)
+   - fd is owned by the arena afterwards, even if an error occurs
+   - returns NULL if error */
+struct arena *
+arena_init_spool(size_t block_size, int fd)
+{
+    assert(fd >= 0);
+
+    struct arena *arenap = NULL;
+
+    if((arenap = arena_init(block_size)) == NULL) {
+        close(fd);
+        return (NULL);
+    }
+    arenap->fd = fd;
+    return (arenap);
+}
+
+/* Allocate a block of (at least) block_size bytes of data, either from
+   memory or from spool file
+   - returns NULL if error */
+static struct arena_block *
+arena_block_alloc(struct arena *arenap, size_t block_size)
+{
+    assert(arenap != NULL);
+
+    struct arena_block *blockp = NULL;
+    size_t size = sizeof(struct arena_block) + block_size;
+
+    if(arenap->fd < 0) {
+        if_not_malloc(blockp, size,
+            return (NULL);
+        )
+        arenap->size += size;
+    }
+    else {
+        /* map whole pages (keeps file offsets aligned) */
+        size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+        void *addr = MAP_FAILED;
+
+        size = ((size + page_size - 1) / page_size) * page_size;
+        /* reserve disk space: writing to an unbacked page of a sparse file
+           would raise SIGBUS if the file system gets full */
+        int error = EOPNOTSUPP;
+#if defined(HAVE_POSIX_FALLOCATE)
+        error = posix_fallocate(arenap->fd, arenap->offset, (off_t)size);
+#endif
+        if((error == EOPNOTSUPP) || (error == EINVAL))
+            error = (ftruncate(arenap->fd, arenap->offset + (off_t)size) != 0) ?
+                errno : 0;
+        if(error != 0) {
+            fprintf(stderr, "%s(): %s\n", __func__, strerror(error));
+            return (NULL);
+        }
+        if((addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            arenap->fd, arenap->offset)) == MAP_FAILED) {
+            fprintf(stderr, "%s(): %s\n", __func__, strerror(errno));
+            return (NULL);
+        }
+        arenap->offset += (off_t)size;
+
+        /* current block is full, release it from memory */
+#if defined(MADV_DONTNEED)
+        if(arenap->blockp != NULL)
+            madvise((void *)arenap->blockp, arenap->blockp->size,
+                MADV_DONTNEED);
+#endif
+        blockp = (struct arena_block *)addr;
+    }
+    blockp->size = size;
+    return (blockp);
+}
+
+/* Free a block */
+static void
+arena_block_free(struct arena *arenap, struct arena_block *blockp)
+{
+    assert(arenap != NULL);
+    assert(blockp != NULL);
+
+    if(arenap->fd < 0)
+        free(blockp);
+    else
+        munmap((void *)blockp, blockp->size);
+    return;
+}
+
+/* Reserve size bytes in arena, without alignment
+   - allocates a new block if needed, a larger one for big objects
+   - returns NULL if error */
+static char *
+arena_reserve(struct arena *arenap, size_t size)
+{
+    assert(arenap != NULL);
+
+    struct arena_block *blockp = NULL;
+    size_t block_size = arenap->block_size;
+    char *ptr = NULL;
+
+    if((arenap->blockp == NULL) ||
+        ((size_t)(arenap->end - arenap->next) < size)) {
+        if(size > block_size)
+            block_size = size;
+        if((blockp = arena_block_alloc(arenap, block_size)) == NULL)
+            return (NULL);
+        blockp->prevp = arenap->blockp;
+        arenap->blockp = blockp;
+        arenap->next = (char *)blockp->data;
+        arenap->end = (char *)blockp + blockp->size;
+    }
+
+    ptr = arenap->next;
+    arenap->next += size;
+    return (ptr);
+}
+
+/* Allocate size bytes from arena, suitably aligned for any object
+   - returns NULL if error */
+void *
+arena_alloc(struct arena *arenap, size_t size)
+{
+    assert(arenap != NULL);
+
+    /* skip padding (blocks' data start aligned) */
+    if(arenap->blockp != NULL) {
+        size_t used = arenap->next - (char *)arenap->blockp->data;
+        size_t pad = (ARENA_ALIGN - (used % ARENA_ALIGN)) % ARENA_ALIGN;
+
+        if((size_t)(arenap->end - arenap->next) < pad)
+            pad = arenap->end - arenap->next;
+        arenap->next += pad;
+    }
+    return (arena_reserve(arenap, size));
+}
+
+/* Copy len bytes of a string to arena, adding a terminating null byte
+   - returns NULL if error */
+char *
+arena_strndup(struct arena *arenap, const char *str, size_t len)
+{
+    assert(arenap != NULL);
+    assert(str != NULL);
+
+    char *ptr = NULL;
+
+    if((ptr = arena_reserve(arenap, len + 1)) == NULL)
+        return (NULL);
+    memcpy(ptr, str, len);
+    ptr[len] = '\0';
+    return (ptr);
+}
+
+/* Copy a string to arena
+   - returns NULL if error */
+char *
+arena_strdup(struct arena *arenap, const char *str)
+{
+    assert(arenap != NULL);
+    assert(str != NULL);
+
+    return (arena_strndup(arenap, str, strlen(str)));
+}
+
+/* Get memory used by an arena (spooled blocks excluded) */
+size_t
+arena_size(const struct arena *arenap)
+{
+    assert(arenap != NULL);
+
+    return (arenap->size);
+}
+
+/* Free all objects allocated from an arena, keeping it (and its spool file,
+   truncated) for further allocations
+   - returns < 0 if error */
+int
+arena_reset(struct arena *arenap)
+{
+    assert(arenap != NULL);
+
+    struct arena_block *blockp = NULL;
+
+    while(arenap->blockp != NULL) {
+        blockp = arenap->blockp->prevp;
+        arena_block_free(arenap, arenap->blockp);
+        arenap->blockp = blockp;
+    }
+    arenap->next = NULL;
+    arenap->end = NULL;
+    arenap->size = 0;
+    if(arenap->fd >= 0) {
+        arenap->offset = 0;
+        if(ftruncate(arenap->fd, 0) != 0) {
+            fprintf(stderr, "%s(): %s\n", __func__, strerror(errno));
+            return (-1);
+        }
+    }
+    return (0);
+}
+
+/* Free an arena, along with all objects allocated from it */
+void
+arena_uninit(struct arena *arenap)
+{
+    struct arena_block *blockp = NULL;
+
+    if(arenap == NULL)
+        return;
+
+    while(arenap->blockp != NULL) {
+        blockp = arenap->blockp->prevp;
+        arena_block_free(arenap, arenap->blockp);
+        arenap->blockp = blockp;
+    }
+    if(arenap->fd >= 0)
+        close(arenap->fd);
+    free(arenap);
+    return;
+}
@@ -0,0 +1,62 @@
+/*-
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2011-2026 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+/* size_t */
+#include <stddef.h>
+
+#if !defined(ARENA_BLOCK_SIZE)
+#define ARENA_BLOCK_SIZE (64 * 1024)    /* default arena block size (bytes),
+                                           below usual malloc(3) mmap
+                                           threshold for blocks to re-use
+                                           memory freed by fts(3) */
+#endif
+
+#if !defined(ARENA_SPOOL_BLOCK_SIZE)
+#define ARENA_SPOOL_BLOCK_SIZE (4 * 1024 * 1024)    /* spooled arena block
+                                                       size (bytes), large
+                                                       enough to limit the
+                                                       number of mappings */
+#endif
+
+/* A bump allocator (see arena.c) */
+struct arena;
+
+struct arena *arena_init(size_t block_size);
+struct arena *arena_init_spool(size_t block_size, int fd);
+void *arena_alloc(struct arena *arenap, size_t size);
+char *arena_strndup(struct arena *arenap, const char *str, size_t len);
+char *arena_strdup(struct arena *arenap, const char *str);
+size_t arena_size(const struct arena *arenap);
+int arena_reset(struct arena *arenap);
+void arena_uninit(struct arena *arenap);
+
+#endif /* _ARENA_H */
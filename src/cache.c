@@ -0,0 +1,536 @@
+/*-
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2011-2026 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "types.h"
+#include "utils.h"
+#include "options.h"
+#include "cache.h"
+
+/* malloc(3), free(3), mkstemp(3), qsort(3) */
+#include <stdlib.h>
+
+/* fprintf(3), fdopen(3), fwrite(3), rename(2) */
+#include <stdio.h>
+
+/* strlen(3), memcpy(3), memset(3), memcmp(3), strerror(3) */
+#include <string.h>
+
+/* errno */
+#include <errno.h>
+
+/* open(2) */
+#include <fcntl.h>
+
+/* close(2), fsync(2), unlink(2) */
+#include <unistd.h>
+
+/* mmap(2) */
+#include <sys/mman.h>
+
+/* time(3) */
+#include <time.h>
+
+/* pthread(3) */
+#include <pthread.h>
+
+/* assert(3) */
+#include <assert.h>
+
+/*
+ * A crawl cache records the listing of each directory read during a crawl,
+ * keyed by the directory's device, inode number and modification and change
+ * times. On next run, directories whose keys still match are not read again:
+ * their cached listing is used instead. Adding, removing or renaming an entry
+ * updates its directory's times, so the listing of a modified directory is
+ * always read again. Sub-directories are still stat()ed (their own listing
+ * is checked that way), but other entries get their cached attributes: a
+ * file modified in place keeps its previous size until its directory
+ * changes.
+ *
+ * The cache file is written from scratch by each run (entries of directories
+ * that disappeared are then dropped) and mapped into memory when read. It
+ * contains, using host's byte order:
+ * - a header (struct cache_header)
+ * - directory listings, each made of 8-byte aligned entries (struct
+ *   cache_entry, followed by their NUL-terminated name)
+ * - a table of directories (struct cache_dir), sorted by device and inode
+ */
+
+#define CACHE_MAGIC     "FPARTCC"
+#define CACHE_VERSION   1
+#define CACHE_ENDIAN    0x01020304
+
+/* Options a cache depends on (see cache_flags()) */
+#define CACHE_FOLLOWSYMLINKS    0x01
+#define CACHE_TRUSTDTYPE        0x02
+
+#define CACHE_ALIGN(x)  (((x) + 7) & ~((uint64_t)7))
+
+struct cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;                /* CACHE_ENDIAN, in host's order */
+    uint32_t flags;                 /* CACHE_* options */
+    uint32_t entry_size;            /* sizeof(struct cache_entry) */
+    uint64_t num_dirs;
+    uint64_t dirs_offset;           /* table of directories */
+    uint64_t file_size;
+};
+
+struct cache_dir {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t ctime_sec;
+    uint32_t mtime_nsec;
+    uint32_t ctime_nsec;
+    uint64_t entries_offset;        /* first entry */
+    uint64_t num_entries;
+};
+
+struct cache_entry {
+    uint64_t size;
+    uint64_t ino;
+    uint32_t mode;                  /* 0 if unknown (to be stat()ed) */
+    uint32_t namelen;               /* without ending NUL */
+};
+
+struct cache {
+    struct program_options *options;
+    uint32_t flags;
+    time_t start;                   /* when the crawl started */
+
+    /* previous run's cache, read-only */
+    char *map;
+    size_t map_size;
+    const struct cache_dir *dirs;
+    uint64_t num_dirs;
+
+    /* new cache, written to a temporary file renamed by cache_close() */
+    pthread_mutex_t lock;           /* protects everything below */
+    char *path;
+    char *tmp_path;
+    FILE *fp;
+    uint64_t offset;                /* current offset in fp */
+    struct cache_dir *new_dirs;
+    uint64_t num_new_dirs;
+    uint64_t new_dirs_size;         /* allocated slots */
+    int error;                      /* new cache will be discarded */
+    fnum_t reused;                  /* directories not read */
+    fnum_t read;                    /* directories read */
+};
+
+/* Get the options a cache depends on */
+static uint32_t
+cache_flags(struct program_options *options)
+{
+    assert(options != NULL);
+
+    uint32_t flags = 0;
+
+    if(options->follow_symbolic_links == OPT_FOLLOWSYMLINKS)
+        flags |= CACHE_FOLLOWSYMLINKS;
+    if(options->trust_dtype == OPT_TRUSTDTYPE)
+        flags |= CACHE_TRUSTDTYPE;
+    return (flags);
+}
+
+/* Compare directories by device and inode
+   - compar() function used by qsort(3) and cache_lookup() */
+static int
+cache_dircmp(const void *a, const void *b)
+{
+    const struct cache_dir *da = a;
+    const struct cache_dir *db = b;
+
+    if(da->dev != db->dev)
+        return ((da->dev < db->dev) ? -1 : 1);
+    if(da->ino != db->ino)
+        return ((da->ino < db->ino) ? -1 : 1);
+    return (0);
+}
+
+/* Map previous run's cache, if any and usable
+   - a missing or unusable cache is not an error, it is just ignored */
+static void
+cache_map(struct cache *cachep, const char *path)
+{
+    assert(cachep != NULL);
+    assert(path != NULL);
+
+    const struct cache_header *header = NULL;
+    struct stat st;
+    void *map = NULL;
+    int fd = -1;
+
+    if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        if(errno != ENOENT)
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return;
+    }
+    if((fstat(fd, &st) != 0) || (st.st_size < (off_t)sizeof(*header)) ||
+        ((map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd,
+        0)) == MAP_FAILED)) {
+        close(fd);
+        goto ignore;
+    }
+    close(fd);
+
+    header = map;
+    if((memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0) ||
+        (header->version != CACHE_VERSION) ||
+        (header->endian != CACHE_ENDIAN) ||
+        (header->entry_size != sizeof(struct cache_entry)) ||
+        (header->file_size != (uint64_t)st.st_size) ||
+        (header->dirs_offset < sizeof(*header)) ||
+        (header->dirs_offset != CACHE_ALIGN(header->dirs_offset)) ||
+        (header->dirs_offset > header->file_size) ||
+        (header->num_dirs > (header->file_size - header->dirs_offset) /
+            sizeof(struct cache_dir))) {
+        munmap(map, (size_t)st.st_size);
+        goto ignore;
+    }
+    if(header->flags != cachep->flags) {
+        /* built using different options */
+        munmap(map, (size_t)st.st_size);
+        return;
+    }
+
+    cachep->map = map;
+    cachep->map_size = (size_t)st.st_size;
+    cachep->dirs = (const struct cache_dir *)(cachep->map + header->dirs_offset);
+    cachep->num_dirs = header->num_dirs;
+    return;
+
+ignore:
+    fprintf(stderr, "%s: invalid crawl cache, ignoring it\n", path);
+}
+
+/* Open a crawl cache: map previous run's one and prepare the new one
+   - returns NULL if error */
+struct cache *
+cache_open(const char *path, struct program_options *options)
+{
+    assert(path != NULL);
+    assert(options != NULL);
+
+    struct cache *cachep = NULL;
+    struct cache_header header;
+    size_t path_len = strlen(path);
+    int fd = -1;
+
+    if((cachep = calloc(1, sizeof(struct cache))) == NULL) {
+        fprintf(stderr, "%s(): cannot allocate memory\n", __func__);
+        return (NULL);
+    }
+    cachep->options = options;
+    cachep->flags = cache_flags(options);
+    cachep->start = time(NULL);
+
+    cache_map(cachep, path);
+
+    /* new cache, renamed over previous one when complete */
+    if_not_malloc(cachep->path, path_len + 1,
+        goto err;
+    )
+    memcpy(cachep->path, path, path_len + 1);
+    if_not_malloc(cachep->tmp_path, path_len + sizeof(".XXXXXX"),
+        goto err;
+    )
+    snprintf(cachep->tmp_path, path_len + sizeof(".XXXXXX"), "%s.XXXXXX",
+        path);
+    if((fd = mkstemp(cachep->tmp_path)) < 0) {
+        fprintf(stderr, "%s: %s\n", cachep->tmp_path, strerror(errno));
+        goto err;
+    }
+    if((cachep->fp = fdopen(fd, "w")) == NULL) {
+        fprintf(stderr, "%s: %s\n", cachep->tmp_path, strerror(errno));
+        close(fd);
+        unlink(cachep->tmp_path);
+        goto err;
+    }
+
+    /* header is written last, by cache_close() */
+    memset(&header, 0, sizeof(header));
+    if(fwrite(&header, sizeof(header), 1, cachep->fp) != 1)
+        cachep->error = errno;
+    cachep->offset = sizeof(header);
+
+    pthread_mutex_init(&cachep->lock, NULL);
+    return (cachep);
+
+err:
+    if(cachep->map != NULL)
+        munmap(cachep->map, cachep->map_size);
+    free(cachep->tmp_path);
+    free(cachep->path);
+    free(cachep);
+    return (NULL);
+}
+
+/* Look for the listing of an unchanged directory
+   - the whole listing is checked, so that cache_next() cannot fail
+   - returns 1 and initializes listing if found, else 0 */
+int
+cache_lookup(struct cache *cachep, dev_t dev, ino_t ino,
+    const struct timespec *mtime, const struct timespec *ctime,
+    struct cache_listing *listing)
+{
+    assert(cachep != NULL);
+    assert(mtime != NULL);
+    assert(ctime != NULL);
+    assert(listing != NULL);
+
+    const struct cache_dir *dir = NULL;
+    const struct cache_entry *entry = NULL;
+    struct cache_dir key;
+    uint64_t offset = 0;
+    uint64_t end = 0;
+    uint64_t i = 0;
+
+    if(cachep->map == NULL)
+        return (0);
+
+    key.dev = (uint64_t)dev;
+    key.ino = (uint64_t)ino;
+    if(((dir = bsearch(&key, cachep->dirs, cachep->num_dirs,
+        sizeof(struct cache_dir), &cache_dircmp)) == NULL) ||
+        (dir->mtime_sec != (int64_t)mtime->tv_sec) ||
+        (dir->mtime_nsec != (uint32_t)mtime->tv_nsec) ||
+        (dir->ctime_sec != (int64_t)ctime->tv_sec) ||
+        (dir->ctime_nsec != (uint32_t)ctime->tv_nsec))
+        return (0);
+
+    /* entries must lie between header and table of directories */
+    offset = dir->entries_offset;
+    end = (uint64_t)((const char *)cachep->dirs - cachep->map);
+    if((offset < sizeof(struct cache_header)) || (offset > end) ||
+        (offset != CACHE_ALIGN(offset)))
+        return (0);
+    for(i = 0; i < dir->num_entries; i++) {
+        if(end - offset < sizeof(struct cache_entry))
+            return (0);
+        entry = (const struct cache_entry *)(cachep->map + offset);
+        if((entry->namelen == 0) ||
+            (entry->namelen >= end - offset - sizeof(struct cache_entry)) ||
+            (cachep->map[offset + sizeof(struct cache_entry) +
+                entry->namelen] != '\0'))
+            return (0);
+        offset += CACHE_ALIGN(sizeof(struct cache_entry) + entry->namelen + 1);
+        if(offset > end)
+            return (0);
+    }
+
+    listing->next = cachep->map + dir->entries_offset;
+    listing->remaining = dir->num_entries;
+    return (1);
+}
+
+/* Get next entry of a cached listing
+   - only st_mode (0 if unknown), st_size and st_ino are set in sbp
+   - returns 1 if an entry has been returned, 0 at end of listing */
+int
+cache_next(struct cache_listing *listing, const char **name,
+    size_t *namelen, struct stat *sbp)
+{
+    assert(listing != NULL);
+    assert(name != NULL);
+    assert(namelen != NULL);
+    assert(sbp != NULL);
+
+    const struct cache_entry *entry = NULL;
+
+    if(listing->remaining == 0)
+        return (0);
+
+    entry = (const struct cache_entry *)listing->next;
+    *name = listing->next + sizeof(struct cache_entry);
+    *namelen = entry->namelen;
+    memset(sbp, 0, sizeof(struct stat));
+    sbp->st_mode = (mode_t)entry->mode;
+    sbp->st_size = (off_t)entry->size;
+    sbp->st_ino = (ino_t)entry->ino;
+
+    listing->next +=
+        CACHE_ALIGN(sizeof(struct cache_entry) + entry->namelen + 1);
+    listing->remaining--;
+    return (1);
+}
+
+/* Record the listing of a directory (a list of entries linked through
+   fts_link) into the new cache
+   - directories modified since the crawl started are not recorded, as they
+     may be modified again without their times changing
+   - reused tells if listing has been read from the cache (statistics) */
+void
+cache_add(struct cache *cachep, dev_t dev, ino_t ino,
+    const struct timespec *mtime, const struct timespec *ctime,
+    const FTSENT *head, int reused)
+{
+    assert(cachep != NULL);
+    assert(mtime != NULL);
+    assert(ctime != NULL);
+
+    static const char padding[8] = { 0 };
+    struct cache_dir dir;
+    struct cache_entry entry;
+    const FTSENT *p = NULL;
+    uint64_t len = 0;
+
+    pthread_mutex_lock(&cachep->lock);
+
+    if(reused)
+        cachep->reused++;
+    else
+        cachep->read++;
+
+    if((cachep->error != 0) ||
+        (mtime->tv_sec >= cachep->start - 1) ||
+        (ctime->tv_sec >= cachep->start - 1))
+        goto end;
+
+    if(cachep->num_new_dirs == cachep->new_dirs_size) {
+        uint64_t new_size =
+            (cachep->new_dirs_size > 0) ? cachep->new_dirs_size * 2 : 1024;
+        {
+            if_not_realloc(cachep->new_dirs,
+                new_size * sizeof(struct cache_dir),
+                cachep->error = ENOMEM;
+                goto end;
+            )
+        }
+        cachep->new_dirs_size = new_size;
+    }
+
+    memset(&dir, 0, sizeof(dir));
+    dir.dev = (uint64_t)dev;
+    dir.ino = (uint64_t)ino;
+    dir.mtime_sec = (int64_t)mtime->tv_sec;
+    dir.mtime_nsec = (uint32_t)mtime->tv_nsec;
+    dir.ctime_sec = (int64_t)ctime->tv_sec;
+    dir.ctime_nsec = (uint32_t)ctime->tv_nsec;
+    dir.entries_offset = cachep->offset;
+
+    for(p = head; p != NULL; p = p->fts_link) {
+        memset(&entry, 0, sizeof(entry));
+        if((p->fts_info != FTS_NS) && (p->fts_info != FTS_NSOK)) {
+            entry.size = (uint64_t)p->fts_statp->st_size;
+            entry.ino = (uint64_t)p->fts_statp->st_ino;
+            entry.mode = (uint32_t)p->fts_statp->st_mode;
+        }
+        entry.namelen = (uint32_t)p->fts_namelen;
+        len = sizeof(entry) + p->fts_namelen + 1;
+        if((fwrite(&entry, sizeof(entry), 1, cachep->fp) != 1) ||
+            (fwrite(p->fts_name, p->fts_namelen + 1, 1, cachep->fp) != 1) ||
+            ((CACHE_ALIGN(len) > len) && (fwrite(padding,
+            CACHE_ALIGN(len) - len, 1, cachep->fp) != 1))) {
+            cachep->error = errno;
+            goto end;
+        }
+        cachep->offset += CACHE_ALIGN(len);
+        dir.num_entries++;
+    }
+    cachep->new_dirs[cachep->num_new_dirs++] = dir;
+
+end:
+    pthread_mutex_unlock(&cachep->lock);
+}
+
+/* Close a crawl cache
+   - if commit is set, the new cache replaces previous one, else it is
+     discarded
+   - returns 0 if cache has been committed (or discarded as requested) */
+int
+cache_close(struct cache *cachep, int commit)
+{
+    assert(cachep != NULL);
+
+    struct cache_header header;
+    uint64_t i = 0;
+    uint64_t num_dirs = 0;
+    int retval = 0;
+
+    if(commit && (cachep->error == 0)) {
+        /* table of directories, without duplicates (overlapping crawls) */
+        if(cachep->num_new_dirs > 1)
+            qsort(cachep->new_dirs, cachep->num_new_dirs,
+                sizeof(struct cache_dir), &cache_dircmp);
+        for(i = 0; i < cachep->num_new_dirs; i++) {
+            if((num_dirs > 0) && (cache_dircmp(&cachep->new_dirs[i],
+                &cachep->new_dirs[num_dirs - 1]) == 0))
+                continue;
+            cachep->new_dirs[num_dirs++] = cachep->new_dirs[i];
+        }
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+        header.version = CACHE_VERSION;
+        header.endian = CACHE_ENDIAN;
+        header.flags = cachep->flags;
+        header.entry_size = sizeof(struct cache_entry);
+        header.num_dirs = num_dirs;
+        header.dirs_offset = cachep->offset;
+        header.file_size =
+            cachep->offset + (num_dirs * sizeof(struct cache_dir));
+
+        if(((num_dirs > 0) && (fwrite(cachep->new_dirs,
+            sizeof(struct cache_dir), num_dirs, cachep->fp) != num_dirs)) ||
+            (fseeko(cachep->fp, 0, SEEK_SET) != 0) ||
+            (fwrite(&header, sizeof(header), 1, cachep->fp) != 1) ||
+            (fflush(cachep->fp) != 0) ||
+            (fsync(fileno(cachep->fp)) != 0))
+            cachep->error = errno;
+    }
+
+    if((fclose(cachep->fp) != 0) && (cachep->error == 0))
+        cachep->error = errno;
+    if(commit && (cachep->error == 0) &&
+        (rename(cachep->tmp_path, cachep->path) != 0))
+        cachep->error = errno;
+    if(!commit || (cachep->error != 0)) {
+        unlink(cachep->tmp_path);
+        if(commit) {
+            fprintf(stderr, "%s: cannot write crawl cache: %s\n",
+                cachep->path, strerror(cachep->error));
+            retval = 1;
+        }
+    }
+    else if(cachep->options->verbose >= OPT_VERBOSE)
+        fprintf(stderr, "Crawl cache: %ju directories reused, %ju read\n",
+            cachep->reused, cachep->read);
+
+    if(cachep->map != NULL)
+        munmap(cachep->map, cachep->map_size);
+    pthread_mutex_destroy(&cachep->lock);
+    free(cachep->new_dirs);
+    free(cachep->tmp_path);
+    free(cachep->path);
+    free(cachep);
+    return (retval);
+}
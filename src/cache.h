@@ -0,0 +1,80 @@
+/*-
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2011-2026 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include "types.h"
+#include "options.h"
+
+/* uint64_t */
+#include <stdint.h>
+
+/* struct timespec */
+#include <time.h>
+
+/* fts(3) */
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(EMBED_FTS)
+#include "fts.h"
+#else
+#include <fts.h>
+#endif
+
+/* stat(2) timestamps */
+#if defined(__APPLE__)
+#define CACHE_MTIME(sbp) (&(sbp)->st_mtimespec)
+#define CACHE_CTIME(sbp) (&(sbp)->st_ctimespec)
+#else
+#define CACHE_MTIME(sbp) (&(sbp)->st_mtim)
+#define CACHE_CTIME(sbp) (&(sbp)->st_ctim)
+#endif
+
+/* A crawl cache (see cache.c) */
+struct cache;
+
+/* A cached directory listing, read through cache_next() */
+struct cache_listing {
+    const char *next;               /* next entry */
+    uint64_t remaining;             /* number of entries left */
+};
+
+struct cache *cache_open(const char *path, struct program_options *options);
+int cache_lookup(struct cache *cachep, dev_t dev, ino_t ino,
+    const struct timespec *mtime, const struct timespec *ctime,
+    struct cache_listing *listing);
+int cache_next(struct cache_listing *listing, const char **name,
+    size_t *namelen, struct stat *sbp);
+void cache_add(struct cache *cachep, dev_t dev, ino_t ino,
+    const struct timespec *mtime, const struct timespec *ctime,
+    const FTSENT *head, int reused);
+int cache_close(struct cache *cachep, int commit);
+
+#endif /* _CACHE_H */
@@ -0,0 +1,1866 @@
+/*-
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2011-2026 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "types.h"
+#include "utils.h"
+#include "options.h"
+#include "crawl.h"
+#include "cache.h"
+#include "throttle.h"
+
+/* malloc(3), calloc(3) */
+#include <stdlib.h>
+
+/* fprintf(3) */
+#include <stdio.h>
+
+/* strlen(3), strrchr(3), memcpy(3), memset(3) */
+#include <string.h>
+
+/* errno */
+#include <errno.h>
+
+/* fts(3) */
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(EMBED_FTS)
+#include "fts.h"
+#else
+#include <fts.h>
+#endif
+
+/* fdopendir(3), readdir(3) */
+#include <dirent.h>
+
+/* openat(2), fstatat(2) */
+#include <fcntl.h>
+
+/* close(2) */
+#include <unistd.h>
+
+/* MAXPATHLEN */
+#include <sys/param.h>
+
+/* offsetof */
+#include <stddef.h>
+
+/* alignof */
+#include <stdalign.h>
+
+/* pthread(3) */
+#include <pthread.h>
+
+/* clock_gettime(2) */
+#include <time.h>
+
+/* assert(3) */
+#include <assert.h>
+
+#if !defined(O_CLOEXEC)
+#define O_CLOEXEC 0
+#endif
+#if !defined(O_DIRECTORY)
+#define O_DIRECTORY 0
+#endif
+
+#define ISDOT(a)    (a[0] == '.' && (!a[1] || (a[1] == '.' && !a[2])))
+
+/* Length of p's path, without its ending slash (if any) */
+#define NAPPEND(p) \
+    (((p)->fts_pathlen > 0) && ((p)->fts_path[(p)->fts_pathlen - 1] == '/') ? \
+        (p)->fts_pathlen - 1 : (p)->fts_pathlen)
+
+/*************************************************************
+ Crawl layer: fts(3) or multi-threaded work-stealing crawler
+
+ When a single thread is requested, crawl_*() functions are simple wrappers
+ around fts(3). Else, a pool of threads reads directories in parallel:
+
+ - each directory to be read is a crawl_dir, queued into a deque
+ - a thread pops directories from its own deque (newest first, to stay
+   close to a depth-first traversal) and, when empty, steals directories from
+   other deques (oldest first, i.e. larger sub-trees)
+ - reading a directory produces a list of children FTSENTs, fully stat()ed,
+   and queues their sub-directories into the reading thread's deque
+ - crawl_read() (main thread) replays the tree in fts(3) order, waiting for
+   (or reading by itself) the directories it needs to descend into
+
+ That way, the consumer sees exactly what fts_read() would have returned, but
+ with readdir(3)/stat(2) latencies hidden by parallel crawling.
+
+ Each filesystem (device) crossed gets its own limit of directories read at
+ the same time (crawl_device), adapted to observed latencies (AIMD: +1 per
+ round while reads do not slow down, halved when they do) and capped by
+ option -G. A thread taking a directory whose device is saturated parks it
+ and looks for other work: a slow mount cannot hold all threads.
+
+ A single-threaded crawl may also use prefetching threads (option -A): when
+ fts_read() returns the first entries of a directory, its sub-directories are
+ queued (next ones first) and prefetching threads read and stat(2) their
+ entries. fts(3) still does the actual crawl, but mostly hits the kernel's
+ (or network filesystem client's) caches. When fts(3) cannot handle the
+ crawl (e.g. CRAWL_TRUSTDTYPE), prefetching threads are crawling threads.
+ *************************************************************/
+
+/* A directory to be read */
+struct crawl_dir {
+    char *path;                 /* path used to open the directory */
+    FTSENT *ent;                /* directory entry (children's parent) */
+    dev_t dev;                  /* device and inode, kept apart from ent */
+    ino_t ino;                  /*   for cycle detection */
+    struct timespec mtime;      /* modification and change times, */
+    struct timespec ctime;      /*   crawl cache keys */
+    long level;                 /* children level */
+    struct crawl_dir *parent;   /* parent directory (referenced) */
+
+#define CD_QUEUED       0       /* waiting to be read */
+#define CD_READING      1       /* being read */
+#define CD_DONE         2       /* read, children available */
+#define CD_CANCELLED    3       /* abandoned before having been read */
+    int state;
+    unsigned char abandoned;    /* skipped by consumer, discard children */
+    unsigned int refs;          /* owner, deque and children references */
+
+    FTSENT *children;           /* children, linked through fts_link */
+    fnum_t nitems;              /* number of children not yet consumed */
+    int info;                   /* FTS_D, FTS_ERR or FTS_DNR */
+    int read_errno;             /* opendir(3) or readdir(3) error */
+};
+
+/* A deque of directories (ring buffer) */
+struct crawl_deque {
+    struct crawl_dir **dirs;
+    size_t size;                /* allocated slots */
+    size_t top;                 /* oldest element (stealing side) */
+    size_t count;               /* number of elements */
+};
+
+/* A filesystem being crawled */
+struct crawl_device {
+    dev_t dev;
+    unsigned int active;        /* directories being read */
+    unsigned int cap;           /* maximum limit (threads or option -G) */
+    double limit;               /* current limit, >= 1 */
+    unsigned char slow_start;   /* no slow down observed yet */
+    unsigned int since_decrease; /* reads since limit was last decreased */
+    double short_lat;           /* per-entry read latency (seconds), */
+    double long_lat;            /*   short and long-term averages */
+    struct crawl_deque parked;  /* directories waiting for a slot */
+};
+
+/* Prefetching threads and their queue of directories (ring buffer, next
+   directory to prefetch on top) */
+struct crawl_prefetch {
+    pthread_mutex_t lock;       /* protects everything below */
+    pthread_cond_t work_cv;     /* directory queued or stop requested */
+    char *paths[CRAWL_PREFETCH_MAX];
+    const FTSENT *keys[CRAWL_PREFETCH_MAX]; /* entries paths belong to */
+    size_t top;                 /* next directory to prefetch */
+    size_t count;               /* number of queued directories */
+    unsigned char stop;         /* threads must exit */
+    pthread_t *threads;
+    unsigned int num_threads;   /* number of started threads */
+
+    /* main thread only */
+    const FTSENT *last;         /* last entry returned by fts_read() */
+    int last_info;              /* and its fts_info */
+    const FTSENT *tail;         /* last entry of last queued list */
+    const FTSENT *tail_parent;  /* and its parent */
+    const FTSENT *scan[CRAWL_PREFETCH_MAX]; /* directories of a list */
+};
+
+/* A crawling thread */
+struct crawl_worker {
+    struct crawl *crawlp;
+    unsigned int index;         /* own deque index */
+    pthread_t thread;
+};
+
+/* A crawl */
+struct crawl {
+    FTS *ftsp;                  /* fts(3) stream, single-threaded crawl */
+    struct crawl_prefetch *prefetchp; /* prefetching threads, or NULL */
+
+    /* multi-threaded crawl (options, fts_options, prunefunc and cwd_fd are
+       also used by prefetching threads) */
+    struct program_options *options;
+    int fts_options;            /* FTS_LOGICAL, FTS_PHYSICAL, FTS_XDEV */
+    int crawl_flags;            /* CRAWL_DIRSFIRST */
+    int (*prunefunc)(const FTSENT * const, struct program_options *);
+    struct cache *cachep;       /* crawl cache, or NULL */
+    int cwd_fd;                 /* initial working directory */
+    dev_t root_dev;             /* root device (FTS_XDEV) */
+    FTSENT *root_parent;        /* dummy root parent */
+    FTSENT *root;               /* root entry, until returned */
+    FTSENT *cur;                /* last returned entry */
+    char *path;                 /* current entry path */
+    size_t path_size;           /* path buffer size */
+
+    pthread_mutex_t lock;       /* protects everything below and crawl_dirs */
+    pthread_cond_t work_cv;     /* work queued or room available */
+    pthread_cond_t done_cv;     /* directory read */
+    struct crawl_deque *deques; /* one per thread + one for main thread */
+    unsigned int num_deques;
+    struct crawl_worker *workers;
+    unsigned int num_workers;   /* number of started threads */
+    struct crawl_device **devices; /* filesystems crossed */
+    unsigned int num_devices;
+    fnum_t ahead;               /* read entries not yet consumed */
+    unsigned char stop;         /* threads must exit */
+};
+
+#if !defined(FTS_DIRSFIRST)
+/* Compare entries to list directories first
+   - compar() function used by fts_open() when CRAWL_DIRSFIRST requested */
+static int
+#if (defined(__linux__) || defined(__NetBSD__) || defined(__APPLE__)) && !defined(EMBED_FTS)
+fts_dirsfirst(const FTSENT **a, const FTSENT **b)
+#else
+fts_dirsfirst(const FTSENT * const *a, const FTSENT * const *b)
+#endif
+{
+    assert(a != NULL);
+    assert((*a) != NULL);
+    assert(b != NULL);
+    assert((*b) != NULL);
+
+    if(((*a)->fts_info == FTS_NS) ||
+       ((*a)->fts_info == FTS_NSOK) ||
+       ((*b)->fts_info == FTS_NS) ||
+       ((*b)->fts_info == FTS_NSOK))
+        return (0);
+
+    /* place non-directory entries after directory ones */
+    if(S_ISDIR((*a)->fts_statp->st_mode))
+        if(!S_ISDIR((*b)->fts_statp->st_mode))
+            return (-1);
+        else
+            return (0);
+    else
+        if(S_ISDIR((*b)->fts_statp->st_mode))
+            return (1);
+        else
+            return (0);
+}
+#endif
+
+/* Allocate an FTSENT, its name and stat structure in one chunk
+   - returns NULL if error */
+static FTSENT *
+crawl_alloc(const char *name, size_t namelen)
+{
+    FTSENT *p = NULL;
+    size_t len = round_num(sizeof(FTSENT) + namelen + 1,
+        alignof(struct stat));
+
+    if((p = calloc(1, len + sizeof(struct stat))) == NULL) {
+        fprintf(stderr, "%s(): cannot allocate memory\n", __func__);
+        return (NULL);
+    }
+
+#if defined(_HAS_FTS_NAME_POINTER)
+    p->fts_name = (char *)(p + 1);
+#endif
+    memcpy((char *)p + ((char *)p->fts_name - (char *)p), name, namelen);
+    p->fts_namelen = namelen;
+    p->fts_statp = (struct stat *)((char *)p + len);
+    p->fts_symfd = -1;
+    p->fts_instr = FTS_NOINSTR;
+
+    return (p);
+}
+
+/* Allocate a new path made of dir_path + '/' + name
+   - returned memory must be freed afterwards
+   - returns NULL if error */
+static char *
+crawl_path_join(const FTSENT * const dir, const char *name, size_t namelen,
+    size_t *pathlen)
+{
+    char *path = NULL;
+    size_t len = NAPPEND(dir);
+
+    if_not_malloc(path, len + 1 + namelen + 1,
+        return (NULL);
+    )
+    memcpy(path, dir->fts_path, len);
+    path[len] = '/';
+    memcpy(path + len + 1, name, namelen + 1);
+    *pathlen = len + 1 + namelen;
+
+    return (path);
+}
+
+/* Stat an entry through fstatat_light(), under crawl throttle (option -O)
+   - returns 0 (success) or -1 (failure, errno set) */
+static int
+crawl_fstatat(struct crawl *crawlp, int dfd, const char *path,
+    struct stat *sbp, int flags)
+{
+    struct timespec start;
+    int retval = 0;
+    int saved_errno = 0;
+
+    throttle_start(crawlp->options->throttle, &start);
+    retval = fstatat_light(dfd, path, sbp, flags, crawlp->options);
+    saved_errno = errno;
+    throttle_charge(crawlp->options->throttle, 1, &start);
+    errno = saved_errno;
+    return (retval);
+}
+
+/* Stat an entry the same way fts(3) would
+   - dfd and path are passed to crawl_fstatat()
+   - parent is used for cycle detection
+   - returns entry's fts_info */
+static int
+crawl_stat(struct crawl *crawlp, FTSENT *p, int dfd, const char *path,
+    const struct crawl_dir *parent)
+{
+    struct stat *sbp = p->fts_statp;
+    int saved_errno = 0;
+
+    if(crawlp->fts_options & FTS_LOGICAL) {
+        if(crawl_fstatat(crawlp, dfd, path, sbp, 0) != 0) {
+            saved_errno = errno;
+            if(crawl_fstatat(crawlp, dfd, path, sbp,
+                AT_SYMLINK_NOFOLLOW) != 0) {
+                p->fts_errno = saved_errno;
+                memset(sbp, 0, sizeof(struct stat));
+                return (FTS_NS);
+            }
+            if(S_ISLNK(sbp->st_mode))
+                return (FTS_SLNONE);
+        }
+    }
+    else if(crawl_fstatat(crawlp, dfd, path, sbp,
+        AT_SYMLINK_NOFOLLOW) != 0) {
+        p->fts_errno = errno;
+        memset(sbp, 0, sizeof(struct stat));
+        return (FTS_NS);
+    }
+
+    if(S_ISDIR(sbp->st_mode)) {
+        p->fts_dev = sbp->st_dev;
+        p->fts_ino = sbp->st_ino;
+        p->fts_nlink = sbp->st_nlink;
+
+        /* check for cycles (only possible when following symlinks) */
+        while(parent != NULL) {
+            if((parent->dev == p->fts_dev) && (parent->ino == p->fts_ino))
+                return (FTS_DC);
+            parent = parent->parent;
+        }
+        return (FTS_D);
+    }
+    if(S_ISLNK(sbp->st_mode))
+        return (FTS_SL);
+    if(S_ISREG(sbp->st_mode))
+        return (FTS_F);
+    return (FTS_DEFAULT);
+}
+
+/* Compare entries' inode numbers
+   - compar() function used by qsort(3) in crawl_stat_pending() */
+static int
+crawl_inocmp(const void *a, const void *b)
+{
+    const FTSENT *pa = *(FTSENT * const *)a;
+    const FTSENT *pb = *(FTSENT * const *)b;
+
+    if(pa->fts_ino < pb->fts_ino)
+        return (-1);
+    return (pa->fts_ino > pb->fts_ino);
+}
+
+/* Stat entries left to FTS_NSOK by crawl_readdir() (CRAWL_INOORDER), in
+   order of the inode numbers returned by readdir(3): many filesystems store
+   inodes in tables indexed by their number, so random seeks become mostly
+   sequential reads
+   - entries keep their order within the list
+   - if memory is short, entries are stat()ed in list order */
+static void
+crawl_stat_pending(struct crawl *crawlp, FTSENT *head, fnum_t npending,
+    int dfd, const struct crawl_dir *parent)
+{
+    FTSENT **pending = NULL;
+    FTSENT *p = NULL;
+    fnum_t i = 0;
+
+    if((pending = malloc(npending * sizeof(FTSENT *))) == NULL) {
+        for(p = head; p != NULL; p = p->fts_link)
+            if(p->fts_info == FTS_NSOK)
+                p->fts_info = crawl_stat(crawlp, p, dfd, p->fts_name, parent);
+        return;
+    }
+
+    for(p = head; p != NULL; p = p->fts_link)
+        if(p->fts_info == FTS_NSOK)
+            pending[i++] = p;
+    assert(i == npending);
+    qsort(pending, npending, sizeof(FTSENT *), &crawl_inocmp);
+
+    for(i = 0; i < npending; i++)
+        pending[i]->fts_info =
+            crawl_stat(crawlp, pending[i], dfd, pending[i]->fts_name, parent);
+    free(pending);
+}
+
+/* Classify an entry from its directory entry type, without stat()ing it
+   (CRAWL_TRUSTDTYPE)
+   - only file type is known afterwards, sizes are left to 0
+   - directories get their parent's device and d_ino as inode number
+   - entries below -d's cutoff are always stat()ed: they are only crawled to
+     size their ancestor, from all of their sizes (see get_size())
+   - returns entry's fts_info, or FTS_NSOK if entry must be stat()ed */
+static int
+crawl_dtype(struct crawl *crawlp, FTSENT *p, const struct dirent *dp,
+    const struct crawl_dir *parent)
+{
+#if defined(DT_UNKNOWN) && defined(DTTOIF)
+    struct stat *sbp = p->fts_statp;
+
+    if((crawlp->options->dir_depth != OPT_NODIRDEPTH) &&
+        (p->fts_level > crawlp->options->dir_depth))
+        return (FTS_NSOK);
+
+    switch(dp->d_type) {
+        case DT_DIR:
+            /* real device needed to stay on the same filesystem (option -b)
+               and to detect cycles when following symlinks, times needed
+               to look directory up in crawl cache */
+            if((crawlp->fts_options & (FTS_XDEV | FTS_LOGICAL)) ||
+                (crawlp->cachep != NULL))
+                return (FTS_NSOK);
+            sbp->st_mode = S_IFDIR;
+            sbp->st_dev = p->fts_dev = parent->dev;
+            sbp->st_ino = p->fts_ino = dp->d_ino;
+            return (FTS_D);
+        case DT_LNK:
+            /* symlinks' targets must be examined when following them */
+            if(crawlp->fts_options & FTS_LOGICAL)
+                return (FTS_NSOK);
+            sbp->st_mode = S_IFLNK;
+            return (FTS_SL);
+        case DT_FIFO:
+        case DT_CHR:
+        case DT_BLK:
+        case DT_SOCK:
+            sbp->st_mode = DTTOIF(dp->d_type);
+            return (FTS_DEFAULT);
+        default:
+            /* regular files (size needed) and unknown types */
+            return (FTS_NSOK);
+    }
+#else
+    return (FTS_NSOK);
+#endif
+}
+
+/* Classify an entry from its crawl cache attributes, without stat()ing it
+   - directories are always stat()ed, to check their own cached listing
+   - returns entry's fts_info, or FTS_NSOK if entry must be stat()ed */
+static int
+crawl_cached(struct crawl *crawlp, FTSENT *p, const struct stat *csbp,
+    const struct crawl_dir *parent)
+{
+    struct stat *sbp = p->fts_statp;
+
+    if((csbp->st_mode == 0) || S_ISDIR(csbp->st_mode))
+        return (FTS_NSOK);
+    /* symlinks' targets must be examined when following them */
+    if(S_ISLNK(csbp->st_mode) && (crawlp->fts_options & FTS_LOGICAL))
+        return (FTS_NSOK);
+    /* link counts are not cached */
+    if(S_ISREG(csbp->st_mode) &&
+        (crawlp->options->hardlinks == OPT_HARDLINKS))
+        return (FTS_NSOK);
+
+    sbp->st_mode = csbp->st_mode;
+    sbp->st_size = csbp->st_size;
+    sbp->st_ino = csbp->st_ino;
+    sbp->st_dev = parent->dev;
+    if(S_ISLNK(sbp->st_mode))
+        return (FTS_SL);
+    if(S_ISREG(sbp->st_mode))
+        return (FTS_F);
+    return (FTS_DEFAULT);
+}
+
+/* Allocate a new directory to be read, taking ownership of path
+   - returns NULL if error */
+static struct crawl_dir *
+crawl_dir_new(FTSENT *p, char *path, struct crawl_dir *parent)
+{
+    struct crawl_dir *d = NULL;
+
+    if_not_malloc(d, sizeof(struct crawl_dir),
+        return (NULL);
+    )
+    d->path = path;
+    d->ent = p;
+    d->dev = p->fts_dev;
+    d->ino = p->fts_ino;
+    d->mtime = *CACHE_MTIME(p->fts_statp);
+    d->ctime = *CACHE_CTIME(p->fts_statp);
+    d->level = p->fts_level + 1;
+    d->parent = parent;
+    d->state = CD_QUEUED;
+    d->abandoned = 0;
+    d->refs = 0;
+    d->children = NULL;
+    d->nitems = 0;
+    d->info = FTS_D;
+    d->read_errno = 0;
+
+    return (d);
+}
+
+/* Drop a reference to a directory, freeing it (and maybe its parents) when
+   unreferenced
+   - lock must be held */
+static void
+crawl_dir_release(struct crawl_dir *d)
+{
+    struct crawl_dir *parent = NULL;
+
+    while((d != NULL) && (--d->refs == 0)) {
+        assert(d->children == NULL);
+        parent = d->parent;
+        free(d->path);
+        free(d);
+        d = parent;
+    }
+}
+
+static void crawl_dir_abandon(struct crawl *crawlp, struct crawl_dir *d);
+
+/* Free a list of entries, abandoning their directories
+   - lock must be held */
+static void
+crawl_lfree(struct crawl *crawlp, FTSENT *head)
+{
+    FTSENT *p = NULL;
+
+    while((p = head) != NULL) {
+        head = head->fts_link;
+        if(p->fts_pointer != NULL)
+            crawl_dir_abandon(crawlp, p->fts_pointer);
+        free(p);
+    }
+}
+
+/* Drop owner's reference to a directory, discarding its children if they
+   have not been consumed
+   - lock must be held */
+static void
+crawl_dir_abandon(struct crawl *crawlp, struct crawl_dir *d)
+{
+    d->abandoned = 1;
+    switch(d->state) {
+        case CD_QUEUED:
+            /* will be dropped when dequeued */
+            d->state = CD_CANCELLED;
+            break;
+        case CD_DONE:
+            crawlp->ahead -= d->nitems;
+            d->nitems = 0;
+            crawl_lfree(crawlp, d->children);
+            d->children = NULL;
+            break;
+        default:
+            /* CD_READING: reader will discard children when publishing */
+            break;
+    }
+    crawl_dir_release(d);
+}
+
+/* Free an entry returned by crawl_read(), releasing its directory */
+static void
+crawl_free(struct crawl *crawlp, FTSENT *p)
+{
+    if(p->fts_pointer != NULL) {
+        pthread_mutex_lock(&crawlp->lock);
+        crawl_dir_abandon(crawlp, p->fts_pointer);
+        pthread_mutex_unlock(&crawlp->lock);
+        p->fts_pointer = NULL;
+    }
+    free(p);
+}
+
+/* Push a directory at the bottom of a deque
+   - lock must be held
+   - returns 0 (success) or 1 (failure) */
+static int
+crawl_deque_push(struct crawl_deque *dq, struct crawl_dir *d)
+{
+    if(dq->count == dq->size) {
+        struct crawl_dir **dirs = NULL;
+        size_t size = (dq->size > 0) ? (dq->size * 2) : 64;
+        size_t i;
+
+        if_not_malloc(dirs, sizeof(struct crawl_dir *) * size,
+            return (1);
+        )
+        for(i = 0; i < dq->count; i++)
+            dirs[i] = dq->dirs[(dq->top + i) % dq->size];
+        free(dq->dirs);
+        dq->dirs = dirs;
+        dq->size = size;
+        dq->top = 0;
+    }
+    dq->dirs[(dq->top + dq->count) % dq->size] = d;
+    dq->count++;
+
+    return (0);
+}
+
+/* Reverse the order of the last num elements pushed to a deque
+   - lock must be held */
+static void
+crawl_deque_reverse(struct crawl_deque *dq, size_t num)
+{
+    assert(num <= dq->count);
+
+    if(num < 2)
+        return;
+
+    size_t i = dq->top + dq->count - num;
+    size_t j = dq->top + dq->count - 1;
+
+    while(i < j) {
+        struct crawl_dir *tmp = dq->dirs[i % dq->size];
+        dq->dirs[i % dq->size] = dq->dirs[j % dq->size];
+        dq->dirs[j % dq->size] = tmp;
+        i++;
+        j--;
+    }
+}
+
+/* Get a directory to read: pop own deque (newest first), else steal from
+   another one (oldest first)
+   - lock must be held
+   - returns NULL if no work is available */
+static struct crawl_dir *
+crawl_deque_take(struct crawl *crawlp, unsigned int index)
+{
+    struct crawl_deque *dq = &crawlp->deques[index];
+    struct crawl_dir *d = NULL;
+    unsigned int i;
+
+    if(dq->count > 0) {
+        dq->count--;
+        return (dq->dirs[(dq->top + dq->count) % dq->size]);
+    }
+
+    for(i = 1; i < crawlp->num_deques; i++) {
+        dq = &crawlp->deques[(index + i) % crawlp->num_deques];
+        if(dq->count > 0) {
+            d = dq->dirs[dq->top];
+            dq->top = (dq->top + 1) % dq->size;
+            dq->count--;
+            return (d);
+        }
+    }
+    return (NULL);
+}
+
+/* Stable partition of a list of entries, directories first */
+static FTSENT *
+crawl_dirsfirst(FTSENT *head)
+{
+    FTSENT *dhead = NULL, *dtail = NULL;
+    FTSENT *ohead = NULL, *otail = NULL;
+    FTSENT *p = NULL;
+
+    while((p = head) != NULL) {
+        head = head->fts_link;
+        p->fts_link = NULL;
+        if((p->fts_info != FTS_NS) && (p->fts_info != FTS_NSOK) &&
+            S_ISDIR(p->fts_statp->st_mode)) {
+            if(dhead == NULL)
+                dhead = p;
+            else
+                dtail->fts_link = p;
+            dtail = p;
+        }
+        else {
+            if(ohead == NULL)
+                ohead = p;
+            else
+                otail->fts_link = p;
+            otail = p;
+        }
+    }
+    if(dtail == NULL)
+        return (ohead);
+    dtail->fts_link = ohead;
+    return (dhead);
+}
+
+/* Read a directory: build its list of children and prepare sub-directories
+   to be read (they will be queued by crawl_publish())
+   - an unchanged directory's listing comes from the crawl cache, if any
+   - called without lock held, d being in CD_READING state */
+static void
+crawl_readdir(struct crawl *crawlp, struct crawl_dir *d)
+{
+    DIR *dirp = NULL;
+    struct dirent *dp = NULL;
+    FTSENT *p = NULL, *head = NULL, *tail = NULL;
+    fnum_t nitems = 0;
+    fnum_t npending = 0;                /* entries left to stat (FTS_NSOK) */
+    int fd = -1;
+    int cached = 0;                     /* listing read from crawl cache */
+    struct cache_listing listing;
+    struct stat csb;                    /* cached entry attributes */
+    const char *name = NULL;
+    size_t namelen = 0;
+    ino_t ino = 0;
+    struct timespec start;              /* directory read start, and */
+    int charged = 0;                    /* read charged to crawl throttle */
+
+    throttle_start(crawlp->options->throttle, &start);
+    if((fd = openat(crawlp->cwd_fd, d->path,
+        O_RDONLY | O_DIRECTORY | O_CLOEXEC)) >= 0) {
+        if(crawlp->cachep != NULL)
+            cached = cache_lookup(crawlp->cachep, d->dev, d->ino, &d->mtime,
+                &d->ctime, &listing);
+        if(!cached && ((dirp = fdopendir(fd)) == NULL)) {
+            d->read_errno = errno;
+            d->info = FTS_DNR;
+            close(fd);
+            return;
+        }
+    }
+    else {
+        d->read_errno = errno;
+        d->info = FTS_DNR;
+        return;
+    }
+
+    for(;;) {
+        if(cached) {
+            if(!cache_next(&listing, &name, &namelen, &csb))
+                break;
+            ino = csb.st_ino;
+        }
+        else {
+            int saved_errno = 0;
+
+            errno = 0;
+            dp = readdir(dirp);
+            saved_errno = errno;
+            /* opening directory and reading its first entries make one
+               operation */
+            if(!charged) {
+                throttle_charge(crawlp->options->throttle, 1, &start);
+                charged = 1;
+            }
+            errno = saved_errno;
+            if(dp == NULL) {
+                if(errno != 0) {
+                    d->read_errno = errno;
+                    /* if we've not read any items yet, treat
+                       the error as if we can't access the dir */
+                    d->info = (nitems > 0) ? FTS_ERR : FTS_DNR;
+                }
+                break;
+            }
+            if(ISDOT(dp->d_name))
+                continue;
+            name = dp->d_name;
+            namelen = strlen(dp->d_name);
+            ino = dp->d_ino;
+        }
+
+        if((p = crawl_alloc(name, namelen)) == NULL) {
+            d->read_errno = ENOMEM;
+            d->info = (nitems > 0) ? FTS_ERR : FTS_DNR;
+            break;
+        }
+        p->fts_level = d->level;
+        p->fts_parent = d->ent;
+        if(cached)
+            p->fts_info = crawl_cached(crawlp, p, &csb, d);
+        else if(crawlp->crawl_flags & CRAWL_TRUSTDTYPE)
+            p->fts_info = crawl_dtype(crawlp, p, dp, d);
+        else
+            p->fts_info = FTS_NSOK;
+        if(p->fts_info == FTS_NSOK) {
+            if(crawlp->crawl_flags & CRAWL_INOORDER) {
+                /* deferred, see crawl_stat_pending() */
+                p->fts_ino = ino;
+                npending++;
+            }
+            else
+                p->fts_info = crawl_stat(crawlp, p, fd, p->fts_name, d);
+        }
+
+        if(head == NULL)
+            head = p;
+        else
+            tail->fts_link = p;
+        tail = p;
+        nitems++;
+    }
+    if(npending > 0)
+        crawl_stat_pending(crawlp, head, npending, fd, d);
+    if(dirp != NULL)
+        closedir(dirp);
+    else
+        close(fd);
+
+    /* only complete listings are cached */
+    if((crawlp->cachep != NULL) && (d->info == FTS_D))
+        cache_add(crawlp->cachep, d->dev, d->ino, &d->mtime, &d->ctime, head,
+            cached);
+
+    if(crawlp->crawl_flags & CRAWL_DIRSFIRST)
+        head = crawl_dirsfirst(head);
+
+    /* prepare sub-directories */
+    FTSENT dir_ent;                     /* d->ent may already be in use */
+    dir_ent.fts_path = d->path;
+    dir_ent.fts_pathlen = strlen(d->path);
+    for(p = head; p != NULL; p = p->fts_link) {
+        char *path = NULL;
+        size_t pathlen = 0;
+
+        if(p->fts_info != FTS_D)
+            continue;
+        /* do not cross mount points if requested */
+        if((crawlp->fts_options & FTS_XDEV) &&
+            (p->fts_dev != crawlp->root_dev))
+            continue;
+        if((path = crawl_path_join(&dir_ent, p->fts_name, p->fts_namelen,
+            &pathlen)) == NULL)
+            continue;   /* will be read by crawl_read() if needed */
+
+        /* ask consumer if it will skip that directory */
+        if(crawlp->prunefunc != NULL) {
+            p->fts_path = p->fts_accpath = path;
+            p->fts_pathlen = pathlen;
+            if(crawlp->prunefunc(p, crawlp->options)) {
+                free(path);
+                continue;
+            }
+        }
+        if((p->fts_pointer = crawl_dir_new(p, path, d)) == NULL)
+            free(path);
+    }
+
+    d->children = head;
+    d->nitems = nitems;
+}
+
+/* Publish a directory that has just been read and queue its sub-directories
+   - lock must be held */
+static void
+crawl_publish(struct crawl *crawlp, struct crawl_dir *d, unsigned int index)
+{
+    FTSENT *p = NULL;
+
+    if(d->abandoned) {
+        /* nobody wants those children anymore,
+           sub-directories are not referenced yet */
+        while((p = d->children) != NULL) {
+            d->children = p->fts_link;
+            if(p->fts_pointer != NULL) {
+                free(((struct crawl_dir *)p->fts_pointer)->path);
+                free(p->fts_pointer);
+            }
+            free(p);
+        }
+        d->nitems = 0;
+        d->state = CD_DONE;
+        return;
+    }
+
+    size_t pushed = 0;
+    for(p = d->children; p != NULL; p = p->fts_link) {
+        struct crawl_dir *child = p->fts_pointer;
+        if(child == NULL)
+            continue;
+        child->refs = 1;                /* owner */
+        d->refs++;                      /* child's parent */
+        /* no thread to steal it when main thread crawls alone */
+        if((crawlp->num_deques > 1) &&
+            (crawl_deque_push(&crawlp->deques[index], child) == 0)) {
+            child->refs++;              /* deque */
+            pushed++;
+        }
+    }
+    /* threads pop their own deque from the bottom: reverse pushed
+       directories for them to be read in crawl_read()'s order */
+    if(index != crawlp->num_deques - 1)
+        crawl_deque_reverse(&crawlp->deques[index], pushed);
+
+    d->state = CD_DONE;
+    crawlp->ahead += d->nitems;
+    pthread_cond_broadcast(&crawlp->done_cv);
+    if(pushed > 0)
+        pthread_cond_broadcast(&crawlp->work_cv);
+}
+
+/* Get (or create) a device's state
+   - lock must be held
+   - returns NULL if error (the device is then not limited) */
+static struct crawl_device *
+crawl_device_get(struct crawl *crawlp, dev_t dev)
+{
+    struct crawl_device *dv = NULL;
+    unsigned int i;
+
+    for(i = 0; i < crawlp->num_devices; i++)
+        if(crawlp->devices[i]->dev == dev)
+            return (crawlp->devices[i]);
+
+    if((dv = calloc(1, sizeof(struct crawl_device))) == NULL)
+        return (NULL);
+    if_not_realloc(crawlp->devices,
+        sizeof(struct crawl_device *) * (crawlp->num_devices + 1),
+        {
+            free(dv);
+            return (NULL);
+        }
+    )
+    dv->dev = dev;
+    dv->cap = crawlp->num_deques - 1;   /* crawling threads */
+    dv->limit = 1;
+    dv->slow_start = 1;
+    crawlp->devices[crawlp->num_devices++] = dv;
+    return (dv);
+}
+
+/* Tell if a device can take one more directory read
+   - lock must be held */
+static int
+crawl_device_available(const struct crawl_device *dv)
+{
+    return ((dv == NULL) || (dv->active < (unsigned int)dv->limit));
+}
+
+/* Account for a directory read on a device and adapt its limit, then give
+   parked directories back to deque index
+   - elapsed is the time spent reading the directory, nitems the number of
+     entries read
+   - lock must be held */
+static void
+crawl_device_done(struct crawl *crawlp, struct crawl_device *dv,
+    double elapsed, fnum_t nitems, unsigned int index)
+{
+    double lat = elapsed / (double)(nitems + 1);
+    size_t unparked = 0;
+
+    if(dv == NULL)
+        return;
+    dv->active--;
+
+    /* smoothed latencies, the short-term one following load changes */
+    if(dv->long_lat == 0) {
+        dv->short_lat = lat;
+        dv->long_lat = lat;
+    }
+    else {
+        dv->short_lat += (lat - dv->short_lat) / 4;
+        dv->long_lat += (lat - dv->long_lat) / 64;
+    }
+
+    /* AIMD: halve limit when reads slow down (at most once per round of
+       reads), else increase it (by 1 per read during slow start, then by 1
+       per round) */
+    dv->since_decrease++;
+    if(dv->short_lat > dv->long_lat * CRAWL_DEV_SLOWDOWN) {
+        if(dv->since_decrease >= (unsigned int)dv->limit) {
+            dv->limit = max(dv->limit / 2, 1);
+            dv->slow_start = 0;
+            dv->since_decrease = 0;
+        }
+    }
+    else if(dv->limit < dv->cap)
+        dv->limit = min(dv->limit + (dv->slow_start ? 1 : (1 / dv->limit)),
+            (double)dv->cap);
+
+    /* parked directories (newest first) can now be read */
+    while((dv->parked.count > 0) &&
+        (dv->active + unparked < (unsigned int)dv->limit)) {
+        struct crawl_dir *d =
+            dv->parked.dirs[(dv->parked.top + dv->parked.count - 1) %
+            dv->parked.size];
+        if(crawl_deque_push(&crawlp->deques[index], d) != 0)
+            break;
+        dv->parked.count--;
+        unparked++;
+    }
+    if(unparked > 0)
+        pthread_cond_broadcast(&crawlp->work_cv);
+}
+
+/* Set fixed limits (option -G) of devices holding given paths
+   - lock must be held */
+static void
+crawl_device_caps(struct crawl *crawlp, struct program_options *options)
+{
+    struct crawl_device *dv = NULL;
+    struct stat sb;
+    unsigned int i;
+
+    for(i = 0; i < options->nfs_threads; i++) {
+        char *path = strchr(options->fs_threads[i], ':') + 1;
+        unsigned int cap =
+            (unsigned int)strtoul(options->fs_threads[i], NULL, 10);
+
+        if(stat(path, &sb) != 0) {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            continue;
+        }
+        if((dv = crawl_device_get(crawlp, sb.st_dev)) == NULL)
+            continue;
+        dv->cap = min(dv->cap, cap);
+    }
+}
+
+/* Return the time elapsed since start, in seconds */
+static double
+crawl_elapsed(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((double)(now.tv_sec - start->tv_sec) +
+        (double)(now.tv_nsec - start->tv_nsec) / 1000000000);
+}
+
+/* Crawling thread main loop */
+static void *
+crawl_worker(void *arg)
+{
+    struct crawl_worker *worker = arg;
+    struct crawl *crawlp = worker->crawlp;
+    struct crawl_dir *d = NULL;
+    struct crawl_device *dv = NULL;
+    struct timespec start;
+    fnum_t nitems = 0;
+
+    pthread_mutex_lock(&crawlp->lock);
+    while(!crawlp->stop) {
+        /* do not read too far ahead of consumer */
+        if((crawlp->ahead >= CRAWL_MAX_AHEAD) ||
+            ((d = crawl_deque_take(crawlp, worker->index)) == NULL)) {
+            pthread_cond_wait(&crawlp->work_cv, &crawlp->lock);
+            continue;
+        }
+        /* directory read by main thread or abandoned */
+        if(d->state != CD_QUEUED) {
+            crawl_dir_release(d);
+            continue;
+        }
+        /* device saturated, park directory (keeping deque reference) */
+        dv = crawl_device_get(crawlp, d->dev);
+        if(!crawl_device_available(dv) &&
+            (crawl_deque_push(&dv->parked, d) == 0))
+            continue;
+        if(dv != NULL)
+            dv->active++;
+        d->state = CD_READING;
+        pthread_mutex_unlock(&crawlp->lock);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        crawl_readdir(crawlp, d);
+        nitems = d->nitems;
+
+        pthread_mutex_lock(&crawlp->lock);
+        crawl_device_done(crawlp, dv, crawl_elapsed(&start), nitems,
+            worker->index);
+        crawl_publish(crawlp, d, worker->index);
+        crawl_dir_release(d);   /* deque reference */
+    }
+    pthread_mutex_unlock(&crawlp->lock);
+
+    return (NULL);
+}
+
+/* Get the children of a directory, reading it if necessary
+   - called from main thread, without lock held
+   - returns children list (or NULL), with d->info and d->read_errno set */
+static FTSENT *
+crawl_children(struct crawl *crawlp, struct crawl_dir *d)
+{
+    FTSENT *head = NULL;
+    struct crawl_device *dv = NULL;
+    struct timespec start;
+    fnum_t nitems = 0;
+
+    pthread_mutex_lock(&crawlp->lock);
+    if(d->state == CD_QUEUED) {
+        /* not read yet, do it ourselves (whatever its device's limit: we
+           need it now) */
+        if((crawlp->num_workers > 0) &&
+            ((dv = crawl_device_get(crawlp, d->dev)) != NULL))
+            dv->active++;
+        d->state = CD_READING;
+        pthread_mutex_unlock(&crawlp->lock);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        crawl_readdir(crawlp, d);
+        nitems = d->nitems;
+
+        pthread_mutex_lock(&crawlp->lock);
+        crawl_device_done(crawlp, dv, crawl_elapsed(&start), nitems,
+            crawlp->num_deques - 1);
+        crawl_publish(crawlp, d, crawlp->num_deques - 1);
+    }
+    while(d->state != CD_DONE)
+        pthread_cond_wait(&crawlp->done_cv, &crawlp->lock);
+
+    /* consume children */
+    if(crawlp->ahead >= CRAWL_MAX_AHEAD)
+        pthread_cond_broadcast(&crawlp->work_cv);
+    crawlp->ahead -= d->nitems;
+    d->nitems = 0;
+    head = d->children;
+    d->children = NULL;
+    pthread_mutex_unlock(&crawlp->lock);
+
+    return (head);
+}
+
+/* Set current path to p's one (p's parent path + '/' + p's name)
+   - returns 0 (success) or 1 (failure) */
+static int
+crawl_setpath(struct crawl *crawlp, FTSENT *p)
+{
+    /* current path starts with parent's one, which may have been moved by
+       a previous realloc(3) */
+    size_t len = p->fts_parent->fts_pathlen;
+    if((len > 0) && (crawlp->path[len - 1] == '/'))
+        len--;
+    size_t needed = len + 1 + p->fts_namelen + 1;
+
+    if(needed > crawlp->path_size) {
+        size_t path_size = needed + MAXPATHLEN;
+        {
+            if_not_realloc(crawlp->path, path_size,
+                return (1);
+            )
+        }
+        crawlp->path_size = path_size;
+    }
+    crawlp->path[len] = '/';
+    memcpy(crawlp->path + len + 1, p->fts_name, p->fts_namelen + 1);
+    p->fts_pathlen = len + 1 + p->fts_namelen;
+    p->fts_path = p->fts_accpath = crawlp->path;
+
+    return (0);
+}
+
+/* Read and stat(2) the entries of a directory queued for prefetching
+   - results are dropped, that only warms caches up for fts(3) */
+static void
+crawl_prefetch_dir(struct crawl *crawlp, const char *path)
+{
+    struct crawl_prefetch *pf = crawlp->prefetchp;
+    DIR *dirp = NULL;
+    struct dirent *dp = NULL;
+    struct stat sb;
+    int flags = (crawlp->fts_options & FTS_LOGICAL) ? 0 : AT_SYMLINK_NOFOLLOW;
+    unsigned int n = 0;
+    unsigned char stop = 0;
+    int fd = -1;
+    struct timespec start;
+
+    throttle_start(crawlp->options->throttle, &start);
+    if((fd = openat(crawlp->cwd_fd, path,
+        O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+        return;
+    if((dirp = fdopendir(fd)) == NULL) {
+        close(fd);
+        return;
+    }
+    while(!stop && ((dp = readdir(dirp)) != NULL)) {
+        /* see crawl_readdir() */
+        if(n++ == 0)
+            throttle_charge(crawlp->options->throttle, 1, &start);
+        if(ISDOT(dp->d_name))
+            continue;
+        (void)crawl_fstatat(crawlp, dirfd(dirp), dp->d_name, &sb, flags);
+
+        /* do not finish large directories once crawl is closed */
+        if((n % 1024) == 0) {
+            pthread_mutex_lock(&pf->lock);
+            stop = pf->stop;
+            pthread_mutex_unlock(&pf->lock);
+        }
+    }
+    closedir(dirp);
+}
+
+/* Prefetching thread main loop */
+static void *
+crawl_prefetch_worker(void *arg)
+{
+    struct crawl *crawlp = arg;
+    struct crawl_prefetch *pf = crawlp->prefetchp;
+    char *path = NULL;
+
+    pthread_mutex_lock(&pf->lock);
+    while(!pf->stop) {
+        if(pf->count == 0) {
+            pthread_cond_wait(&pf->work_cv, &pf->lock);
+            continue;
+        }
+        path = pf->paths[pf->top];
+        pf->top = (pf->top + 1) % CRAWL_PREFETCH_MAX;
+        pf->count--;
+        pthread_mutex_unlock(&pf->lock);
+
+        crawl_prefetch_dir(crawlp, path);
+        free(path);
+
+        pthread_mutex_lock(&pf->lock);
+    }
+    pthread_mutex_unlock(&pf->lock);
+
+    return (NULL);
+}
+
+/* Queue sub-directories of a list of entries for prefetching
+   - p is the first entry of the list, just returned by fts_read() (and read
+     by fts(3) next if it is a directory)
+   - directories are queued on top, first ones to be prefetched first; when
+     the queue is full, the deepest-buried ones are dropped */
+static void
+crawl_prefetch_list(struct crawl *crawlp, FTSENT *p)
+{
+    struct crawl_prefetch *pf = crawlp->prefetchp;
+    FTSENT *s = NULL;
+    size_t dir_len = p->fts_pathlen - p->fts_namelen; /* with '/' */
+    size_t n = 0;
+
+    pf->tail = p;
+    for(s = p->fts_link; s != NULL; s = s->fts_link) {
+        pf->tail = s;
+        if((s->fts_info != FTS_D) || (n == CRAWL_PREFETCH_MAX))
+            continue;
+        /* do not cross mount points if requested */
+        if((crawlp->fts_options & FTS_XDEV) &&
+            (s->fts_dev != p->fts_parent->fts_dev))
+            continue;
+        pf->scan[n++] = s;
+    }
+    pf->tail_parent = p->fts_parent;
+
+    while(n > 0) {
+        char *path = NULL;
+
+        s = (FTSENT *)pf->scan[--n];
+        if_not_malloc(path, dir_len + s->fts_namelen + 1,
+            return;
+        )
+        memcpy(path, p->fts_path, dir_len);
+        memcpy(&path[dir_len], s->fts_name, s->fts_namelen + 1);
+
+        /* ask consumer if it will skip that directory */
+        if(crawlp->prunefunc != NULL) {
+            char *saved_path = s->fts_path;
+            char *saved_accpath = s->fts_accpath;
+            size_t saved_pathlen = s->fts_pathlen;
+            int pruned = 0;
+
+            s->fts_path = s->fts_accpath = path;
+            s->fts_pathlen = dir_len + s->fts_namelen;
+            pruned = crawlp->prunefunc(s, crawlp->options);
+            s->fts_path = saved_path;
+            s->fts_accpath = saved_accpath;
+            s->fts_pathlen = saved_pathlen;
+            if(pruned) {
+                free(path);
+                continue;
+            }
+        }
+
+        pthread_mutex_lock(&pf->lock);
+        if(pf->count == CRAWL_PREFETCH_MAX) {
+            pf->count--;
+            free(pf->paths[(pf->top + pf->count) % CRAWL_PREFETCH_MAX]);
+        }
+        pf->top = (pf->top + CRAWL_PREFETCH_MAX - 1) % CRAWL_PREFETCH_MAX;
+        pf->paths[pf->top] = path;
+        pf->keys[pf->top] = s;
+        pf->count++;
+        pthread_cond_signal(&pf->work_cv);
+        pthread_mutex_unlock(&pf->lock);
+    }
+}
+
+/* Follow fts_read()'s progress, p being the entry it just returned:
+   forget a directory fts(3) is about to read by itself and queue
+   sub-directories of new lists of entries (a directory's first entries or a
+   new batch of them, see FTS_STREAM) */
+static void
+crawl_prefetch(struct crawl *crawlp, FTSENT *p)
+{
+    struct crawl_prefetch *pf = crawlp->prefetchp;
+
+    if(p->fts_info == FTS_D) {
+        pthread_mutex_lock(&pf->lock);
+        if((pf->count > 0) && (pf->keys[pf->top] == p)) {
+            free(pf->paths[pf->top]);
+            pf->top = (pf->top + 1) % CRAWL_PREFETCH_MAX;
+            pf->count--;
+        }
+        pthread_mutex_unlock(&pf->lock);
+    }
+
+    if(((pf->last == p->fts_parent) && (pf->last_info == FTS_D)) ||
+        ((pf->last == pf->tail) && (p->fts_parent == pf->tail_parent)))
+        crawl_prefetch_list(crawlp, p);
+
+    pf->last = p;
+    pf->last_info = p->fts_info;
+}
+
+/* Start prefetching threads for a single-threaded crawl
+   - returns 0 (success) or 1 (failure) */
+static int
+crawl_prefetch_start(struct crawl *crawlp, unsigned int num_threads)
+{
+    struct crawl_prefetch *pf = NULL;
+    unsigned int i;
+    int error = 0;
+
+    if((pf = calloc(1, sizeof(struct crawl_prefetch))) == NULL) {
+        fprintf(stderr, "%s(): cannot allocate memory\n", __func__);
+        return (1);
+    }
+    if_not_malloc(pf->threads, sizeof(pthread_t) * num_threads,
+        free(pf);
+        return (1);
+    )
+    pthread_mutex_init(&pf->lock, NULL);
+    pthread_cond_init(&pf->work_cv, NULL);
+    crawlp->prefetchp = pf;
+
+    /* threads open directories relative to initial working directory, as
+       fts(3) may change it */
+    if((crawlp->cwd_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+        crawlp->cwd_fd = AT_FDCWD;
+
+    for(i = 0; i < num_threads; i++) {
+        if((error = pthread_create(&pf->threads[pf->num_threads], NULL,
+            &crawl_prefetch_worker, crawlp)) != 0) {
+            /* go on with less threads */
+            fprintf(stderr, "%s(): cannot create thread: %s\n", __func__,
+                strerror(error));
+            break;
+        }
+        pf->num_threads++;
+    }
+    return (0);
+}
+
+/* Stop prefetching threads and drop queued directories */
+static void
+crawl_prefetch_stop(struct crawl *crawlp)
+{
+    struct crawl_prefetch *pf = crawlp->prefetchp;
+    unsigned int i;
+
+    pthread_mutex_lock(&pf->lock);
+    pf->stop = 1;
+    pthread_cond_broadcast(&pf->work_cv);
+    pthread_mutex_unlock(&pf->lock);
+    for(i = 0; i < pf->num_threads; i++)
+        pthread_join(pf->threads[i], NULL);
+
+    while(pf->count > 0) {
+        free(pf->paths[pf->top]);
+        pf->top = (pf->top + 1) % CRAWL_PREFETCH_MAX;
+        pf->count--;
+    }
+    pthread_cond_destroy(&pf->work_cv);
+    pthread_mutex_destroy(&pf->lock);
+    if(crawlp->cwd_fd >= 0)
+        close(crawlp->cwd_fd);
+    free(pf->threads);
+    free(pf);
+    crawlp->prefetchp = NULL;
+}
+
+/* Open a crawl on path
+   - crawl_flags may contain CRAWL_DIRSFIRST, CRAWL_TRUSTDTYPE,
+     CRAWL_INOORDER and CRAWL_DONTSYNC
+   - prunefunc (may be NULL) tells if a directory will be skipped (through
+     crawl_set(..., FTS_SKIP)) by consumer, to avoid reading it
+   - cachep (may be NULL) is a crawl cache to read listings from and record
+     them into
+   - returns NULL if error */
+struct crawl *
+crawl_open(char *path, int crawl_flags,
+    int (*prunefunc)(const FTSENT * const, struct program_options *),
+    struct cache *cachep, struct program_options *options)
+{
+    assert(path != NULL);
+    assert(options != NULL);
+
+    struct crawl *crawlp = NULL;
+    int fts_options = (options->follow_symbolic_links == OPT_FOLLOWSYMLINKS) ?
+        FTS_LOGICAL : FTS_PHYSICAL;
+    fts_options |= (options->cross_fs_boundaries == OPT_NOCROSSFSBOUNDARIES) ?
+        FTS_XDEV : 0;
+#if defined(FTS_DONTSYNC)
+    fts_options |= (options->sync_attrs == OPT_NOSYNCATTRS) ?
+        FTS_DONTSYNC : 0;
+#endif
+
+    if((crawlp = calloc(1, sizeof(struct crawl))) == NULL) {
+        fprintf(stderr, "%s(): cannot allocate memory\n", __func__);
+        return (NULL);
+    }
+
+    /* flags fts(3) cannot honour */
+    int engine_flags = CRAWL_TRUSTDTYPE;
+#if !defined(FTS_INOORDER)
+    engine_flags |= CRAWL_INOORDER;
+#endif
+#if !defined(FTS_DONTSYNC)
+    engine_flags |= CRAWL_DONTSYNC;
+#endif
+
+    /* single-threaded crawl, use fts(3) */
+    if((options->crawl_threads <= 1) && !(crawl_flags & engine_flags) &&
+        (cachep == NULL)) {
+        char *fts_argv[] = { path, NULL };
+
+        /* sort function */
+#if (defined(__linux__) || defined(__NetBSD__) || defined(__APPLE__)) && !defined(EMBED_FTS)
+        int (*fts_sortfuncp)(const FTSENT **, const FTSENT **) = NULL;
+#else
+        int (*fts_sortfuncp)(const FTSENT * const *, const FTSENT * const *) = NULL;
+#endif
+        if(crawl_flags & CRAWL_DIRSFIRST)
+#if defined(FTS_DIRSFIRST)
+            /* embedded fts(3): partition entries instead of sorting them */
+            fts_options |= FTS_DIRSFIRST;
+#else
+            fts_sortfuncp = &fts_dirsfirst;
+#endif
+
+#if defined(FTS_OPENAT)
+        /* embedded fts(3): walk relative to directory descriptors instead
+           of changing the current working directory */
+        fts_options |= FTS_OPENAT;
+#endif
+#if defined(FTS_INOORDER)
+        if(crawl_flags & CRAWL_INOORDER)
+            fts_options |= FTS_INOORDER;
+#endif
+#if defined(FTS_STREAM)
+        /* embedded fts(3): unsorted directories can be read by batches */
+        if(!(crawl_flags & CRAWL_DIRSFIRST))
+            fts_options |= FTS_STREAM;
+#endif
+
+        if((crawlp->ftsp = fts_open(fts_argv, fts_options,
+            fts_sortfuncp)) == NULL) {
+            free(crawlp);
+            return (NULL);
+        }
+        crawlp->options = options;
+
+        /* prefetching threads */
+        if(options->prefetch_threads > 0) {
+            crawlp->fts_options = fts_options;
+            crawlp->prunefunc = prunefunc;
+            if(crawl_prefetch_start(crawlp, options->prefetch_threads) != 0) {
+                fts_close(crawlp->ftsp);
+                free(crawlp);
+                return (NULL);
+            }
+        }
+        return (crawlp);
+    }
+
+    /* multi-threaded crawl (or single-threaded one fts(3) cannot handle, run
+       by main thread only) */
+    crawlp->options = options;
+    crawlp->fts_options = fts_options;
+    crawlp->crawl_flags = crawl_flags;
+    crawlp->prunefunc = prunefunc;
+    crawlp->cachep = cachep;
+
+    /* keep a reference to initial working directory as fts(3) may be used
+       to compute directory sizes (and change cwd) while threads are
+       crawling */
+    if((crawlp->cwd_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+        crawlp->cwd_fd = AT_FDCWD;
+
+    /* initialize current path */
+    size_t path_len = strlen(path);
+    crawlp->path_size = max(path_len + 1, MAXPATHLEN);
+    if_not_malloc(crawlp->path, crawlp->path_size,
+        goto err;
+    )
+    memcpy(crawlp->path, path, path_len + 1);
+
+    /* allocate root and its parent, the same way fts_open() does */
+    if((crawlp->root_parent = crawl_alloc("", 0)) == NULL)
+        goto err;
+    crawlp->root_parent->fts_level = FTS_ROOTPARENTLEVEL;
+
+    const char *name = strrchr(path, '/');
+    if((name != NULL) && ((name != path) || (name[1] != '\0')))
+        name++;
+    else
+        name = path;
+    if((crawlp->root = crawl_alloc(name, strlen(name))) == NULL)
+        goto err;
+    crawlp->root->fts_level = FTS_ROOTLEVEL;
+    crawlp->root->fts_parent = crawlp->root_parent;
+    crawlp->root->fts_path = crawlp->root->fts_accpath = crawlp->path;
+    crawlp->root->fts_pathlen = path_len;
+    crawlp->root->fts_info =
+        crawl_stat(crawlp, crawlp->root, crawlp->cwd_fd, path, NULL);
+    crawlp->root_dev = crawlp->root->fts_statp->st_dev;
+
+    /* threads and their deques (+ one for the main thread); a single-threaded
+       crawl uses its prefetching threads (option -A) as crawling threads:
+       directories are then read ahead only once, the way crawl_readdir()
+       does (e.g. without stat(2)ing entries CRAWL_TRUSTDTYPE classifies),
+       and entries are still returned in the same order */
+    unsigned int num_threads =
+        (options->crawl_threads > 1) ? options->crawl_threads :
+        options->prefetch_threads;
+    crawlp->num_deques = num_threads + 1;
+    if((crawlp->deques = calloc(crawlp->num_deques,
+        sizeof(struct crawl_deque))) == NULL) {
+        fprintf(stderr, "%s(): cannot allocate memory\n", __func__);
+        goto err;
+    }
+    if(num_threads > 0) {
+        if_not_malloc(crawlp->workers,
+            sizeof(struct crawl_worker) * num_threads,
+            goto err;
+        )
+    }
+    pthread_mutex_init(&crawlp->lock, NULL);
+    pthread_cond_init(&crawlp->work_cv, NULL);
+    pthread_cond_init(&crawlp->done_cv, NULL);
+    if(num_threads > 0)
+        crawl_device_caps(crawlp, options);
+
+    /* queue root directory */
+    if(crawlp->root->fts_info == FTS_D) {
+        struct crawl_dir *d = NULL;
+        char *root_path = NULL;
+
+        if_not_malloc(root_path, path_len + 1,
+            goto err_threads;
+        )
+        memcpy(root_path, path, path_len + 1);
+        if((d = crawl_dir_new(crawlp->root, root_path, NULL)) == NULL) {
+            free(root_path);
+            goto err_threads;
+        }
+        d->refs = 1;                    /* owner */
+        crawlp->root->fts_pointer = d;
+        if((crawlp->num_deques > 1) &&
+            (crawl_deque_push(&crawlp->deques[crawlp->num_deques - 1], d) == 0))
+            d->refs++;                  /* deque */
+    }
+
+    /* start threads */
+    unsigned int i;
+    int error = 0;
+    for(i = 0; i < num_threads; i++) {
+        crawlp->workers[crawlp->num_workers].crawlp = crawlp;
+        crawlp->workers[crawlp->num_workers].index = crawlp->num_workers;
+        if((error = pthread_create(&crawlp->workers[crawlp->num_workers].thread,
+            NULL, &crawl_worker, &crawlp->workers[crawlp->num_workers])) != 0) {
+            /* go on with less threads, main thread will read remaining
+               directories by itself if necessary */
+            fprintf(stderr, "%s(): cannot create thread: %s\n", __func__,
+                strerror(error));
+            break;
+        }
+        crawlp->num_workers++;
+    }
+
+    return (crawlp);
+
+err_threads:
+    pthread_cond_destroy(&crawlp->done_cv);
+    pthread_cond_destroy(&crawlp->work_cv);
+    pthread_mutex_destroy(&crawlp->lock);
+err:
+    if(crawlp->workers != NULL)
+        free(crawlp->workers);
+    if(crawlp->deques != NULL)
+        free(crawlp->deques);
+    if(crawlp->root != NULL)
+        free(crawlp->root);
+    if(crawlp->root_parent != NULL)
+        free(crawlp->root_parent);
+    if(crawlp->path != NULL)
+        free(crawlp->path);
+    if(crawlp->cwd_fd >= 0)
+        close(crawlp->cwd_fd);
+    free(crawlp);
+    return (NULL);
+}
+
+/* Return next entry, in fts_read() order
+   - returns NULL with errno set to 0 when crawl is over,
+     or NULL with errno set if error */
+FTSENT *
+crawl_read(struct crawl *crawlp)
+{
+    assert(crawlp != NULL);
+
+    FTSENT *p = NULL, *tmp = NULL;
+    int instr;
+
+    if(crawlp->ftsp != NULL) {
+        struct timespec start;
+
+        throttle_start(crawlp->options->throttle, &start);
+        if((p = fts_read(crawlp->ftsp)) != NULL) {
+            throttle_charge(crawlp->options->throttle, throttle_ops(p),
+                &start);
+            if(crawlp->prefetchp != NULL)
+                crawl_prefetch(crawlp, p);
+        }
+        return (p);
+    }
+
+    /* first call, return root */
+    if(crawlp->cur == NULL) {
+        if(crawlp->root == NULL) {
+            /* crawl over */
+            errno = 0;
+            return (NULL);
+        }
+        crawlp->cur = crawlp->root;
+        crawlp->root = NULL;
+        return (crawlp->cur);
+    }
+    p = crawlp->cur;
+
+    /* save and zero out user instructions */
+    instr = p->fts_instr;
+    p->fts_instr = FTS_NOINSTR;
+
+    /* directory in pre-order */
+    if(p->fts_info == FTS_D) {
+        struct crawl_dir *d = p->fts_pointer;
+        FTSENT *children = NULL;
+
+        /* if skipped or crossed mount point, do post-order visit */
+        if((instr == FTS_SKIP) || ((crawlp->fts_options & FTS_XDEV) &&
+            (p->fts_dev != crawlp->root_dev))) {
+            if(d != NULL) {
+                pthread_mutex_lock(&crawlp->lock);
+                crawl_dir_abandon(crawlp, d);
+                pthread_mutex_unlock(&crawlp->lock);
+                p->fts_pointer = NULL;
+            }
+            p->fts_info = FTS_DP;
+            return (p);
+        }
+
+        /* directory pruned by crawling threads but not skipped by consumer,
+           prepare it to be read now */
+        if(d == NULL) {
+            char *path = NULL;
+            size_t path_len = strlen(crawlp->path);
+
+            if_not_malloc(path, path_len + 1,
+                errno = ENOMEM;
+                return (NULL);
+            )
+            memcpy(path, crawlp->path, path_len + 1);
+            if((d = crawl_dir_new(p, path,
+                p->fts_parent->fts_pointer)) == NULL) {
+                free(path);
+                errno = ENOMEM;
+                return (NULL);
+            }
+            pthread_mutex_lock(&crawlp->lock);
+            d->refs = 1;                /* owner */
+            if(d->parent != NULL)
+                d->parent->refs++;
+            pthread_mutex_unlock(&crawlp->lock);
+            p->fts_pointer = d;
+        }
+
+        children = crawl_children(crawlp, d);
+        if(d->info == FTS_DNR) {
+            p->fts_info = FTS_DNR;
+            p->fts_errno = d->read_errno;
+            return (p);
+        }
+        if(children == NULL) {
+            p->fts_info = FTS_DP;
+            return (p);
+        }
+        if(d->info == FTS_ERR)
+            p->fts_errno = d->read_errno;
+
+        p = children;
+        goto name;
+    }
+
+    /* move to next node on this level */
+    tmp = p;
+    if((p = p->fts_link) != NULL) {
+        crawl_free(crawlp, tmp);
+name:
+        if(crawl_setpath(crawlp, p) != 0) {
+            errno = ENOMEM;
+            return (NULL);
+        }
+        return (crawlp->cur = p);
+    }
+
+    /* move up to the parent node */
+    p = tmp->fts_parent;
+    crawl_free(crawlp, tmp);
+
+    if(p->fts_level == FTS_ROOTPARENTLEVEL) {
+        /* done; set errno to 0 so the user can distinguish between error
+           and EOF */
+        free(p);
+        crawlp->root_parent = NULL;
+        crawlp->cur = NULL;
+        errno = 0;
+        return (NULL);
+    }
+
+    /* NUL terminate the pathname */
+    crawlp->path[p->fts_pathlen] = '\0';
+    p->fts_path = p->fts_accpath = crawlp->path;
+    p->fts_info = p->fts_errno ? FTS_ERR : FTS_DP;
+    return (crawlp->cur = p);
+}
+
+/* Set instructions for an entry (see fts_set()) */
+int
+crawl_set(struct crawl *crawlp, FTSENT *p, int instr)
+{
+    assert(crawlp != NULL);
+    assert(p != NULL);
+
+    if(crawlp->ftsp != NULL)
+        return (fts_set(crawlp->ftsp, p, instr));
+
+    p->fts_instr = instr;
+    return (0);
+}
+
+/* Close a crawl, stopping threads and freeing remaining entries
+   - returns 0 (success) or -1 (failure) */
+int
+crawl_close(struct crawl *crawlp)
+{
+    assert(crawlp != NULL);
+
+    FTSENT *p = NULL, *freep = NULL;
+    unsigned int i;
+    int retval = 0;
+
+    if(crawlp->ftsp != NULL) {
+        if(crawlp->prefetchp != NULL)
+            crawl_prefetch_stop(crawlp);
+        retval = fts_close(crawlp->ftsp);
+        free(crawlp);
+        return (retval);
+    }
+
+    /* stop threads */
+    pthread_mutex_lock(&crawlp->lock);
+    crawlp->stop = 1;
+    pthread_cond_broadcast(&crawlp->work_cv);
+    pthread_mutex_unlock(&crawlp->lock);
+    for(i = 0; i < crawlp->num_workers; i++)
+        pthread_join(crawlp->workers[i].thread, NULL);
+
+    /* free remaining entries (crawl not finished) */
+    if(crawlp->root != NULL)
+        crawl_free(crawlp, crawlp->root);
+    for(p = crawlp->cur; (p != NULL) && (p->fts_level >= FTS_ROOTLEVEL);) {
+        freep = p;
+        p = (p->fts_link != NULL) ? p->fts_link : p->fts_parent;
+        crawl_free(crawlp, freep);
+    }
+    if(crawlp->root_parent != NULL)
+        free(crawlp->root_parent);
+
+    /* drop deques' references */
+    pthread_mutex_lock(&crawlp->lock);
+    for(i = 0; i < crawlp->num_deques; i++) {
+        struct crawl_dir *d = NULL;
+        while((d = crawl_deque_take(crawlp, i)) != NULL) {
+            if(d->state == CD_QUEUED)
+                d->state = CD_CANCELLED;
+            crawl_dir_release(d);
+        }
+        if(crawlp->deques[i].dirs != NULL)
+            free(crawlp->deques[i].dirs);
+    }
+    for(i = 0; i < crawlp->num_devices; i++) {
+        struct crawl_deque *dq = &crawlp->devices[i]->parked;
+        while(dq->count > 0) {
+            struct crawl_dir *d = dq->dirs[dq->top];
+            dq->top = (dq->top + 1) % dq->size;
+            dq->count--;
+            if(d->state == CD_QUEUED)
+                d->state = CD_CANCELLED;
+            crawl_dir_release(d);
+        }
+        if(dq->dirs != NULL)
+            free(dq->dirs);
+        free(crawlp->devices[i]);
+    }
+    if(crawlp->devices != NULL)
+        free(crawlp->devices);
+    pthread_mutex_unlock(&crawlp->lock);
+
+    pthread_cond_destroy(&crawlp->done_cv);
+    pthread_cond_destroy(&crawlp->work_cv);
+    pthread_mutex_destroy(&crawlp->lock);
+    if(crawlp->cwd_fd >= 0)
+        close(crawlp->cwd_fd);
+    free(crawlp->workers);
+    free(crawlp->deques);
+    free(crawlp->path);
+    free(crawlp);
+
+    return (retval);
+}
@@ -0,0 +1,88 @@
+/*-
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2011-2026 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _CRAWL_H
+#define _CRAWL_H
+
+#include "options.h"
+#include "cache.h"
+
+/* fts(3) */
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(EMBED_FTS)
+#include "fts.h"
+#else
+#include <fts.h>
+#endif
+
+/* fts_name is a pointer within embedded and FreeBSD's fts(3),
+   a trailing array elsewhere */
+#if defined(EMBED_FTS) || defined(__FreeBSD__)
+#define _HAS_FTS_NAME_POINTER
+#endif
+
+#if !defined(CRAWL_MAX_AHEAD)
+#define CRAWL_MAX_AHEAD 1048576     /* maximum number of entries read by
+                                       crawling threads and not yet returned
+                                       by crawl_read() */
+#endif
+
+#if !defined(CRAWL_DEV_SLOWDOWN)
+#define CRAWL_DEV_SLOWDOWN 2.0      /* ratio of short to long-term read
+                                       latencies above which a filesystem
+                                       is considered overloaded */
+#endif
+
+#if !defined(CRAWL_PREFETCH_MAX)
+#define CRAWL_PREFETCH_MAX 1024     /* maximum number of directories queued
+                                       for prefetching threads */
+#endif
+
+/* crawl_open() flags */
+#define CRAWL_DIRSFIRST 0x01        /* return directories first */
+#define CRAWL_TRUSTDTYPE 0x02       /* only stat(2) entries whose type is
+                                       unknown or whose attributes are
+                                       needed */
+#define CRAWL_INOORDER 0x04         /* stat(2) a directory's entries in
+                                       inode order */
+#define CRAWL_DONTSYNC 0x08         /* do not sync attributes with server
+                                       (statx(2)) */
+
+/* A crawl (see crawl.c) */
+struct crawl;
+
+struct crawl *crawl_open(char *path, int crawl_flags,
+    int (*prunefunc)(const FTSENT * const, struct program_options *),
+    struct cache *cachep, struct program_options *options);
+FTSENT *crawl_read(struct crawl *crawlp);
+int crawl_set(struct crawl *crawlp, FTSENT *p, int instr);
+int crawl_close(struct crawl *crawlp);
+
+#endif /* _CRAWL_H */
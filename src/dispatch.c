@@ -30,6 +30,7 @@
 #include "types.h"
 #include "utils.h"
 #include "dispatch.h"
+#include "spill.h"
 
 /* NULL */
 #include <stdlib.h>
@@ -44,36 +45,54 @@
  File entry dispatch functions
  *****************************/
 
-/* Sort an array of file_entry pointers given file size, biggest to smallest
+/* Sort an array of file_entry keys given file size, biggest to smallest,
+   then in crawling order
    This function is used by qsort(3) */
 int
-sort_file_entry_p(const void *a, const void *b)
+sort_file_entry_keys(const void *a, const void *b)
 {
-    assert((a != NULL) && (*(struct file_entry **)a != NULL));
-    assert((b != NULL) && (*(struct file_entry **)b != NULL));
+    assert(a != NULL);
+    assert(b != NULL);
 
-    if((*(struct file_entry **)a)->size < (*(struct file_entry **)b)->size)
+    const struct file_entry_key *ka = (const struct file_entry_key *)a;
+    const struct file_entry_key *kb = (const struct file_entry_key *)b;
+
+    if(ka->size < kb->size)
+        return (1);
+    else if(ka->size > kb->size)
+        return (-1);
+    else if(ka->index > kb->index)
         return (1);
-    else if((*(struct file_entry **)a)->size > (*(struct file_entry **)b)->size)
+    else if(ka->index < kb->index)
         return (-1);
     else
         return (0);
 }
 
-/* Dispatch file_entries by assigning them a partition number
-   - a sorted array of file entry pointers must be provided as an argument
+/* Dispatch file entries by assigning them a partition number
+   - a sorted array of file entry keys must be provided as an argument
    - as well as a pointer to a double linked-list of partitions' head
      that will contain the total amount of data of each assigned file */
 int
-dispatch_file_entry_p_by_size(struct file_entry **file_entry_p,
-    fnum_t num_entries, struct partition *head, pnum_t num_parts)
+dispatch_file_entry_keys_by_size(struct file_entries *entries,
+    const struct file_entry_key *keys, fnum_t num_entries,
+    struct partition *head, pnum_t num_parts)
 {
+    assert(entries != NULL);
+    assert(keys != NULL);
     assert(head != NULL);
     assert(num_parts > 0);
+    assert(num_parts - 1 <= FE_PNUM_MAX);
 
     fnum_t i = 0;
-    while((file_entry_p != NULL) && (file_entry_p[i] != NULL) &&
-        (i < num_entries)) {
+    for(i = 0; i < num_entries; i++) {
+        fnum_t e = keys[i].index;
+
+        /* hardlinks follow their first link
+           (see dispatch_link_file_entries()) */
+        if(fe_link(entries, e) != 0)
+            continue;
+
         /* find most approriate partition */
         pnum_t smallest_partition_index = find_smallest_partition_index(head);
         struct partition *smallest_partition =
@@ -84,31 +103,30 @@ dispatch_file_entry_p_by_size(struct file_entry **file_entry_p,
             return (1);
         }
         /* assign it */
-        file_entry_p[i]->partition_index = smallest_partition_index;
+        fe_partition(entries, e) = smallest_partition_index;
 #if defined(DEBUG)
         fprintf(stderr, "%s(): %s assigned to partition_index %ju (%p)\n",
             __func__,
-            file_entry_p[i]->path, file_entry_p[i]->partition_index,
+            file_entry_path(entries, e), (uintmax_t)fe_partition(entries, e),
             smallest_partition);
 #endif
         /* and load the partition with file size */
-        smallest_partition->size += file_entry_p[i]->size;
+        smallest_partition->size += keys[i].size;
         smallest_partition->num_files++;
-        i++;
     }
     return (0);
 }
 
-/* Dispatch empty file_entries (files with zero-byte size) from head by
+/* Dispatch empty file entries (files with zero-byte size) by
    assigning them a more appropriate partition number.
    The idea is to get empty files spread accross partitions and not get them
    all in the last one.
    - a double-linked list of partitions is provided as an argument */
 int
-dispatch_empty_file_entries(struct file_entry *head, fnum_t num_entries,
+dispatch_empty_file_entries(struct file_entries *entries, fnum_t num_entries,
     struct partition *part_head, pnum_t num_parts)
 {
-    assert(head != NULL);
+    assert(entries != NULL);
     assert(part_head != NULL);
     assert(num_parts > 0);
 
@@ -118,27 +136,29 @@ dispatch_empty_file_entries(struct file_entry *head, fnum_t num_entries,
     fnum_t mean_files = (num_entries / num_parts);
     fnum_t extra_files = (num_entries % num_parts);
 
-    /* be sure to start at first partition as we are handling indexes here.
-       Starting at first file_entry is not necessary as we would not corrupt
-       any information, but just skip a few file entries */
+    /* be sure to start at first partition as we are handling indexes here */
     rewind_list(part_head);
 
     /* for each empty file, associate it with the first partition
        having less files than mean_files (+ 1 for first extra_files partitions,
        to leave extra_files being dispatched there) */
-    while(head != NULL) {
-        if(head->size == 0) {
+    fnum_t e = 0;
+    for(e = 0; e < entries->num_entries; e++) {
+        /* hardlinks follow their first link
+           (see dispatch_link_file_entries()) */
+        if((fe_size(entries, e) == 0) && (fe_link(entries, e) == 0)) {
             /* empty file found */
             pnum_t j = 0;
             /* backup partition head */
             struct partition *part_start = part_head;
 
             while(part_head != NULL) {
-                if((head->partition_index != j) &&
+                if((fe_partition(entries, e) != j) &&
                     (part_head->num_files < (mean_files +
                         (j < extra_files ? 1 : 0)))) {
                     struct partition *previous_partition =
-                        get_partition_at(part_start, head->partition_index);
+                        get_partition_at(part_start,
+                        fe_partition(entries, e));
                     if(previous_partition == NULL) {
                         fprintf(stderr, "%s(): "
                             "get_partition_at() returned NULL\n", __func__);
@@ -150,11 +170,11 @@ dispatch_empty_file_entries(struct file_entry *head, fnum_t num_entries,
                     /* load the new part */
                     part_head->num_files++;
                     /* assign new index to file entry */
-                    head->partition_index = j;
+                    fe_partition(entries, e) = j;
 #if defined(DEBUG)
                     fprintf(stderr, "%s(): %s (empty) re-assigned to partition_index "
-                        "%ju (%p)\n", __func__, head->path,
-                        head->partition_index, part_head);
+                        "%ju (%p)\n", __func__, file_entry_path(entries, e),
+                        (uintmax_t)fe_partition(entries, e), part_head);
 #endif
                     break;
                 }
@@ -164,25 +184,120 @@ dispatch_empty_file_entries(struct file_entry *head, fnum_t num_entries,
             /* go back to original head */
             part_head = part_start;
         }
-        head = head->nextp;
     }
     return (0);
 }
 
-/* Dispatch file_entries from head into partitions that will be created
+/* Dispatch spilled file entries (option -M) the same way
+   dispatch_file_entry_keys_by_size() and dispatch_empty_file_entries() do
+   for entries held in memory, merging sorted runs of entries
+   - all entries must have been spilled
+   - dispatched entries are written to a new run (entries->dispatched),
+     with partition index as sequence number */
+int
+dispatch_spilled_file_entries(struct file_entries *entries,
+    fnum_t num_entries, struct partition *part_head, pnum_t num_parts)
+{
+    assert(entries != NULL);
+    assert(entries->spillp != NULL);
+    assert(entries->num_entries == 0);
+    assert(entries->dispatched == NULL);
+    assert(part_head != NULL);
+    assert(num_parts > 0);
+    assert(num_parts - 1 <= FE_PNUM_MAX);
+
+    struct spill_run *runp = NULL;
+    /* partition empty files have first been assigned to */
+    struct partition *empty_partition = NULL;
+    pnum_t empty_partition_index = 0;
+    int retval = 0;
+
+    /* see dispatch_empty_file_entries() */
+    fnum_t mean_files = (num_entries / num_parts);
+    fnum_t extra_files = (num_entries % num_parts);
+
+    if((entries->dispatched = spill_run_create()) == NULL)
+        return (1);
+    if(spill_merge_start(entries->spillp) != 0)
+        return (1);
+
+    while((retval = spill_merge_next(entries->spillp, &runp)) > 0) {
+        pnum_t partition_index = 0;
+
+        if(runp->size > 0) {
+            partition_index = find_smallest_partition_index(part_head);
+            struct partition *smallest_partition =
+                get_partition_at(part_head, partition_index);
+            if(smallest_partition == NULL) {
+                fprintf(stderr, "%s(): get_partition_at() returned NULL\n",
+                    __func__);
+                return (1);
+            }
+            smallest_partition->size += runp->size;
+            smallest_partition->num_files++;
+        }
+        else {
+            /* empty files come last and, partition sizes being unchanged,
+               would all be assigned to the same partition before being
+               re-dispatched in crawling order */
+            if(empty_partition == NULL) {
+                empty_partition_index =
+                    find_smallest_partition_index(part_head);
+                empty_partition =
+                    get_partition_at(part_head, empty_partition_index);
+                if(empty_partition == NULL) {
+                    fprintf(stderr, "%s(): get_partition_at() returned "
+                        "NULL\n", __func__);
+                    return (1);
+                }
+                empty_partition->num_files += entries->num_spilled_empty;
+            }
+            partition_index = empty_partition_index;
+
+            struct partition *partp = part_head;
+            pnum_t j = 0;
+            while(partp != NULL) {
+                if((empty_partition_index != j) &&
+                    (partp->num_files < (mean_files +
+                        (j < extra_files ? 1 : 0)))) {
+                    empty_partition->num_files--;
+                    partp->num_files++;
+                    partition_index = j;
+                    break;
+                }
+                partp = partp->nextp;
+                j++;
+            }
+        }
+#if defined(DEBUG)
+        fprintf(stderr, "%s(): %s assigned to partition_index %ju\n",
+            __func__, runp->path, (uintmax_t)partition_index);
+#endif
+        if(spill_run_write(entries->dispatched, runp->size,
+            partition_index, runp->path) != 0)
+            return (1);
+    }
+    return ((retval < 0) ? 1 : 0);
+}
+
+/* Dispatch file entries into partitions that will be created
    on-the-fly, with respect to max_entries (maximum files per partitions)
    and max_size (max partition size)
    - must be called with *part_head == NULL (will create partitions)
    - if max_size > 0, partition 0 will hold files that cannot be held by other
      partitions
+   - hardlinks (option -H) are dispatched along with their first link, which
+     is placed so that their whole group fits within limits. A group holding
+     more than max_entries files gets a partition of its own, one bigger than
+     max_size goes to partition 0
    - returns the number of parts created with part_head set to the first
      element */
 pnum_t
-dispatch_file_entries_by_limits(struct file_entry *head,
+dispatch_file_entries_by_limits(struct file_entries *entries,
     struct partition **part_head, fnum_t max_entries, fsize_t max_size,
     struct program_options *options, struct program_status *status)
 {
-    assert(head != NULL);
+    assert(entries != NULL);
     assert((part_head != NULL) && (*part_head == NULL));
     assert(options != NULL);
     assert(status != NULL);
@@ -215,26 +330,54 @@ dispatch_file_entries_by_limits(struct file_entry *head,
     /* for each file, associate it with current partition
        (or default_partition) */
     pnum_t current_partition_index = start_partition_index;
-    while(head != NULL) {
+    fnum_t e = 0;
+    for(e = 0; e < entries->num_entries; e++) {
+        fnum_t link = fe_link(entries, e);
+
+        /* hardlinks follow their first link, which has been dispatched (and
+           accounted for them) before */
+        if(link != 0) {
+            fe_partition(entries, e) = fe_partition(entries, link - 1);
+#if defined(DEBUG)
+            fprintf(stderr, "%s(): %s (link) assigned to partition_index "
+                "%ju\n", __func__, file_entry_path(entries, e),
+                (uintmax_t)fe_partition(entries, e));
+#endif
+            continue;
+        }
+
+        /* file, along with its hardlinks */
+        fsize_t size = fe_size(entries, e) + fe_link_sizes(entries, e);
+        fnum_t num_files = 1 + fe_link_files(entries, e);
+
         /* max_size provided and file size > max_size,
            associate file to default partition */
-        if((max_size > 0) && (head->size > max_size)) {
-            head->partition_index = default_partition_index;
-            default_partition->size += head->size;
-            default_partition->num_files++;
+        if((max_size > 0) && (size > max_size)) {
+            fe_partition(entries, e) = default_partition_index;
+            default_partition->size += size;
+            default_partition->num_files += num_files;
 #if defined(DEBUG)
             fprintf(stderr, "%s(): %s assigned to partition_index %ju (%p)\n",
-                __func__, head->path, head->partition_index, default_partition);
+                __func__, file_entry_path(entries, e),
+                (uintmax_t)fe_partition(entries, e), default_partition);
 #endif
         }
         else {
             /* examine each partition */
             while((*part_head) != NULL) {
-                /* if file does not fit in partition */
-                if(((max_entries > 0) && (((*part_head)->num_files + 1) > max_entries)) ||
-                    ((max_size > 0) && (((*part_head)->size + head->size) > max_size))) {
+                /* if file does not fit in partition (a group of hardlinks
+                   having more than max_entries files fits in an empty one) */
+                if(((max_entries > 0) && ((*part_head)->num_files > 0) &&
+                    (((*part_head)->num_files + num_files) > max_entries)) ||
+                    ((max_size > 0) && (((*part_head)->size + size) > max_size))) {
                     /* and we reached last partition, chain a new one */
                     if((*part_head)->nextp == NULL) {
+                        if(num_parts_created > FE_PNUM_MAX) {
+                            fprintf(stderr, "%s(): too many partitions\n",
+                                __func__);
+                            *part_head = start_partition;
+                            return (num_parts_created);
+                        }
                         if(add_partitions(part_head, 1, options, status) != 0) {
                             fprintf(stderr, "%s(): cannot create partition\n",
                                 __func__);
@@ -255,13 +398,13 @@ dispatch_file_entries_by_limits(struct file_entry *head,
                 }
                 else {
                     /* file fits in current partition, add it */
-                    head->partition_index = current_partition_index;
-                    (*part_head)->size += head->size;
-                    (*part_head)->num_files++;
+                    fe_partition(entries, e) = current_partition_index;
+                    (*part_head)->size += size;
+                    (*part_head)->num_files += num_files;
 #if defined(DEBUG)
                     fprintf(stderr, "%s(): %s assigned to partition_index %ju (%p)\n",
-                        __func__, head->path, head->partition_index,
-                        *part_head);
+                        __func__, file_entry_path(entries, e),
+                        (uintmax_t)fe_partition(entries, e), *part_head);
 #endif
 
                     /* examine next file */
@@ -272,9 +415,6 @@ dispatch_file_entries_by_limits(struct file_entry *head,
             assert(*part_head != NULL);
         }
 
-        /* examine next file */
-        head = head->nextp;
-
         /* come back to the first partition */
         current_partition_index = start_partition_index;
         *part_head = start_partition;
@@ -293,3 +433,56 @@ dispatch_file_entries_by_limits(struct file_entry *head,
 
     return (num_parts_created);
 }
+
+/* Dispatch hardlinks (option -H) by assigning them the partition number of
+   the first entry linked to the same file, which must have been dispatched
+   before by dispatch_file_entry_keys_by_size() (hardlinks are dispatched by
+   dispatch_file_entries_by_limits() itself)
+   - a double-linked list of partitions is provided as an argument */
+int
+dispatch_link_file_entries(struct file_entries *entries,
+    struct partition *part_head, pnum_t num_parts)
+{
+    assert(entries != NULL);
+    assert(part_head != NULL);
+    assert(num_parts > 0);
+
+    struct partition **part_p = NULL;
+    pnum_t i = 0;
+
+    /* index partitions, to avoid walking the list for each link */
+    if_not_malloc(part_p, sizeof(struct partition *) * num_parts,
+        return (1);
+    )
+    rewind_list(part_head);
+    for(i = 0; (i < num_parts) && (part_head != NULL); i++) {
+        part_p[i] = part_head;
+        part_head = part_head->nextp;
+    }
+
+    fnum_t e = 0;
+    for(e = 0; e < entries->num_entries; e++) {
+        fnum_t link = fe_link(entries, e);
+
+        if(link != 0) {
+            pnum_t partition_index = fe_partition(entries, link - 1);
+
+            if(partition_index >= i) {
+                fprintf(stderr, "%s(): invalid partition index\n", __func__);
+                free(part_p);
+                return (1);
+            }
+            fe_partition(entries, e) = partition_index;
+            part_p[partition_index]->size += fe_size(entries, e);
+            part_p[partition_index]->num_files++;
+#if defined(DEBUG)
+            fprintf(stderr, "%s(): %s (link) assigned to partition_index "
+                "%ju (%p)\n", __func__, file_entry_path(entries, e), partition_index,
+                part_p[partition_index]);
+#endif
+        }
+    }
+
+    free(part_p);
+    return (0);
+}
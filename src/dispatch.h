@@ -35,13 +35,18 @@
 #include "file_entry.h"
 #include "options.h"
 
-int sort_file_entry_p(const void *a, const void *b);
-int dispatch_file_entry_p_by_size(struct file_entry **file_entry_p,
-    fnum_t num_entries, struct partition *head, pnum_t num_parts);
-int dispatch_empty_file_entries(struct file_entry *head, fnum_t num_entries,
-    struct partition *part_head, pnum_t num_parts);
-pnum_t dispatch_file_entries_by_limits(struct file_entry *head,
+int sort_file_entry_keys(const void *a, const void *b);
+int dispatch_file_entry_keys_by_size(struct file_entries *entries,
+    const struct file_entry_key *keys, fnum_t num_entries,
+    struct partition *head, pnum_t num_parts);
+int dispatch_empty_file_entries(struct file_entries *entries,
+    fnum_t num_entries, struct partition *part_head, pnum_t num_parts);
+int dispatch_spilled_file_entries(struct file_entries *entries,
+    fnum_t num_entries, struct partition *part_head, pnum_t num_parts);
+pnum_t dispatch_file_entries_by_limits(struct file_entries *entries,
     struct partition **part_head, fnum_t max_entries, fsize_t max_size,
     struct program_options *options, struct program_status *status);
+int dispatch_link_file_entries(struct file_entries *entries,
+    struct partition *part_head, pnum_t num_parts);
 
 #endif /* _DISPATCH_H */
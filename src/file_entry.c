@@ -32,6 +32,14 @@
 #include "options.h"
 #include "partition.h"
 #include "file_entry.h"
+#include "crawl.h"
+#include "sizer.h"
+#include "cache.h"
+#include "match.h"
+#include "links.h"
+#include "arena.h"
+#include "spill.h"
+#include "dispatch.h"
 
 /* stat(2) */
 #include <sys/types.h>
@@ -99,6 +107,11 @@ static struct {
     fnum_t partition_num_files;  /* number of files in current partition */
     int partition_errno;         /* 0 if every single entry has been fts_read()
                                     without error, else last entry's errno */
+    int links_hold;              /* 1 if current partition must not be ended
+                                    yet, to keep hardlinks together */
+    int links_split;             /* 1 if current partition must be ended
+                                    before adding a group of hardlinks
+                                    that does not fit in it */
     int exit_summary;            /* 0 if every single hook exit()ed with 0,
                                     else 1 */
     pid_t child_pid;
@@ -111,6 +124,8 @@ static struct {
     0,
     0,
     0,
+    0,
+    0,
     -1
 };
 
@@ -518,15 +533,264 @@ cleanup:
     return (retval);
 }
 
+/******************************************
+ Hardlinks-related functions (option -H)
+ ******************************************/
+
+/* A link waiting to be printed (live mode) */
+struct link_entry {
+    char *path;
+    fsize_t size;
+    fnum_t link;                 /* hardlinks' group */
+    size_t seq;                  /* arrival order */
+    int entry_errno;
+};
+
+/* Hardlinks status */
+static struct {
+    struct links *linksp;        /* hardlinked files seen so far */
+    fnum_t *leaders;             /* index + 1 of first entry of each group,
+                                    by group number (non-live mode) */
+    fnum_t num_leaders;
+    struct link_entry *pending;  /* links waiting to be printed, until
+                                    current argument has been crawled
+                                    (live mode) */
+    size_t num_pending;
+    size_t max_pending;
+} links_status = {
+    NULL,
+    NULL,
+    0,
+    NULL,
+    0,
+    0
+};
+
+/* Look a file up in hardlinked files seen so far
+   - sets *link to the file's group (or 0 if the file is not hardlinked)
+   - zeroes *size if another link to that file has already been seen,
+     to count the file once
+   - returns < 0 if error */
+static int
+links_lookup(const FTSENT * const p, fnum_t *link, fsize_t *size,
+    struct program_options *options)
+{
+    assert(p != NULL);
+    assert(link != NULL);
+    assert(size != NULL);
+    assert(options != NULL);
+
+    int seen = 0;
+
+    *link = 0;
+    if((options->hardlinks != OPT_HARDLINKS) ||
+        (p->fts_info != FTS_F) || (p->fts_statp->st_nlink <= 1))
+        return (0);
+
+    if((links_status.linksp == NULL) &&
+        ((links_status.linksp = links_init()) == NULL))
+        return (-1);
+
+    if((seen = links_get(links_status.linksp, p->fts_statp->st_dev,
+        p->fts_statp->st_ino, link)) < 0)
+        return (-1);
+    if(seen)
+        *size = 0;
+    return (0);
+}
+
+/* Link file entry index to the first entry of its group (non-live mode),
+   that first entry accounting for the whole group (see
+   dispatch_file_entries_by_limits())
+   - returns < 0 if error */
+static int
+links_attach(struct file_entries *entries, fnum_t index, fnum_t link)
+{
+    assert(entries != NULL);
+    assert(index < entries->num_entries);
+    assert(fe_chunk(entries, index)->links != NULL);
+    assert(link > 0);
+
+    if(link > links_status.num_leaders) {
+        fnum_t num_leaders = max(link, links_status.num_leaders * 2);
+        {
+            if_not_realloc(links_status.leaders,
+                sizeof(fnum_t) * num_leaders,
+                return (-1);
+            )
+        }
+        memset(&links_status.leaders[links_status.num_leaders], 0,
+            sizeof(fnum_t) * (num_leaders - links_status.num_leaders));
+        links_status.num_leaders = num_leaders;
+    }
+
+    fnum_t first = links_status.leaders[link - 1];
+
+    if(first == 0) {
+        links_status.leaders[link - 1] = index + 1;
+        return (0);
+    }
+    fe_chunk(entries, index)->links[index % FE_CHUNK_ENTRIES] = first;
+    first--;
+    fe_chunk(entries, first)->link_files[first % FE_CHUNK_ENTRIES]++;
+    fe_chunk(entries, first)->link_sizes[first % FE_CHUNK_ENTRIES] +=
+        fe_size(entries, index);
+    return (0);
+}
+
+/* Keep a link aside until its whole group is known (live mode)
+   - path is copied
+   - returns < 0 if error */
+static int
+links_defer(char *path, fsize_t size, fnum_t link, int entry_errno)
+{
+    assert(path != NULL);
+    assert(link > 0);
+
+    struct link_entry *e = NULL;
+    size_t malloc_size = strlen(path) + 1;
+
+    if(links_status.num_pending == links_status.max_pending) {
+        size_t max_pending = max(links_status.max_pending * 2, 64);
+        {
+            if_not_realloc(links_status.pending,
+                sizeof(struct link_entry) * max_pending,
+                return (-1);
+            )
+        }
+        links_status.max_pending = max_pending;
+    }
+
+    e = &links_status.pending[links_status.num_pending];
+    if_not_malloc(e->path, malloc_size,
+        return (-1);
+    )
+    snprintf(e->path, malloc_size, "%s", path);
+    e->size = size;
+    e->link = link;
+    e->seq = links_status.num_pending;
+    e->entry_errno = entry_errno;
+    links_status.num_pending++;
+    return (0);
+}
+
+/* Sort links by group, then by arrival order
+   This function is used by qsort(3) */
+static int
+links_sort(const void *a, const void *b)
+{
+    assert(a != NULL);
+    assert(b != NULL);
+
+    const struct link_entry *la = (const struct link_entry *)a;
+    const struct link_entry *lb = (const struct link_entry *)b;
+
+    if(la->link != lb->link)
+        return ((la->link < lb->link) ? -1 : 1);
+    if(la->seq != lb->seq)
+        return ((la->seq < lb->seq) ? -1 : 1);
+    return (0);
+}
+
+/* Free links kept aside */
+static void
+links_drop(void)
+{
+    size_t i = 0;
+
+    for(i = 0; i < links_status.num_pending; i++)
+        free(links_status.pending[i].path);
+    links_status.num_pending = 0;
+}
+
+/* Print links kept aside, group after group, preventing partitions from
+   being ended within a group (live mode)
+   - returns < 0 if error */
+static int
+links_flush(struct program_options *options, struct program_status *status)
+{
+    assert(options != NULL);
+    assert(options->live_mode == OPT_LIVEMODE);
+    assert(status != NULL);
+
+    size_t i = 0;
+    int skipped = 0;
+
+    if(links_status.num_pending == 0)
+        return (0);
+
+    qsort(links_status.pending, links_status.num_pending,
+        sizeof(struct link_entry), &links_sort);
+
+    for(i = 0; i < links_status.num_pending; i++) {
+        struct link_entry *e = &links_status.pending[i];
+        int retval = 0;
+
+        /* first link of a group skipped (option -S), skip others too */
+        if((i > 0) && (e->link == links_status.pending[i - 1].link) &&
+            skipped) {
+            display_file_entry(0, e->size, e->path,
+                ENTRY_DISPLAY_TYPE_SKIPPED);
+            continue;
+        }
+
+        /* first link of a group, start a new partition if the whole group
+           does not fit in current one (option -f) */
+        if((i == 0) || (e->link != links_status.pending[i - 1].link)) {
+            size_t n = i + 1;
+
+            while((n < links_status.num_pending) &&
+                (links_status.pending[n].link == e->link))
+                n++;
+            live_status.links_split = (options->max_entries > 0) &&
+                ((live_status.partition_num_files + (n - i)) >
+                options->max_entries);
+        }
+
+        live_status.links_hold = ((i + 1) < links_status.num_pending) &&
+            (links_status.pending[i + 1].link == e->link);
+        retval = live_print_file_entry(e->path, e->size, e->entry_errno,
+            options, status);
+        live_status.links_hold = 0;
+        live_status.links_split = 0;
+        if(retval < 0) {
+            links_drop();
+            return (-1);
+        }
+        skipped = (retval == 1);
+    }
+    fflush(stdout);
+
+    links_drop();
+    return (0);
+}
+
+/* Release hardlinks status */
+static void
+links_cleanup(void)
+{
+    links_drop();
+    free(links_status.pending);
+    links_status.pending = NULL;
+    links_status.max_pending = 0;
+    free(links_status.leaders);
+    links_status.leaders = NULL;
+    links_status.num_leaders = 0;
+    links_uninit(links_status.linksp);
+    links_status.linksp = NULL;
+}
+
 /* Print or add a file entry (redirector)
+   - link is the entry's hardlinks group (option -H), or 0
    - returns (0) if entry has been added
    - returns (1) if entry has been skipped (option -S)
    - returns (-1) if error */
 int
-handle_file_entry(struct file_entry **head, char *path, fsize_t size,
-    int entry_errno, struct program_options *options,
+handle_file_entry(struct file_entries **entries, char *path, fsize_t size,
+    fnum_t link, int entry_errno, struct program_options *options,
     struct program_status *status)
 {
+    assert(entries != NULL);
     assert(options != NULL);
     assert(status != NULL);
     assert(entry_errno >= 0);
@@ -534,11 +798,20 @@ handle_file_entry(struct file_entry **head, char *path, fsize_t size,
     /* overload and round size */
     size = round_num(size + options->overload_size, options->round_size);
 
-    if(options->live_mode == OPT_LIVEMODE)
+    if(options->live_mode == OPT_LIVEMODE) {
+        /* hardlinks are printed once their group is complete */
+        if(link > 0)
+            return (links_defer(path, size, link, entry_errno));
         return (live_print_file_entry(path, size, entry_errno, options, status));
-    else
-        /* XXX propagate (and exploit) entry_errno in non-live mode too ? */
-        return (add_file_entry(head, path, size, options, status));
+    }
+
+    /* XXX propagate (and exploit) entry_errno in non-live mode too ? */
+    if(add_file_entry(entries, path, size, options, status) != 0)
+        return (-1);
+    if((link > 0) &&
+        (links_attach(*entries, (*entries)->num_entries - 1, link) != 0))
+        return (-1);
+    return (0);
 }
 
 /* Display a single entry line */
@@ -565,9 +838,10 @@ live_print_file_entry(char *path, fsize_t size, int entry_errno,
     struct program_options *options, struct program_status *status)
 {
 /* split states */
-#define SPLIT_NONE 0
-#define SPLIT_DO   1
-#define SPLIT_END  2
+#define SPLIT_NONE  0
+#define SPLIT_DO    1
+#define SPLIT_END   2
+#define SPLIT_LINKS 3
 
     assert(path != NULL);
     assert(entry_errno >= 0);
@@ -592,6 +866,13 @@ live_print_file_entry(char *path, fsize_t size, int entry_errno,
         }
     }
 
+    /* close current -non-empty- partition before adding a group of
+       hardlinks that does not fit in it (see links_flush()) */
+    if(live_status.links_split && (live_status.partition_num_files > 0)) {
+        split = SPLIT_LINKS;
+        goto end_part;
+    }
+
     /* beginning of a new partition */
     if(live_status.partition_num_files == 0) {
 start_part:
@@ -683,11 +964,12 @@ start_part:
     if(options->verbose >= OPT_VVERBOSE)
         fprintf(stderr, "%s\n", path);
 
-    /* if end of partition reached */
-    if(((options->max_entries > 0) &&
+    /* if end of partition reached (and no hardlink to be added to it) */
+    if((!live_status.links_hold &&
+        (((options->max_entries > 0) &&
             (live_status.partition_num_files >= options->max_entries)) ||
-        ((options->max_size > 0) && 
-            (live_status.partition_size >= options->max_size)) ||
+        ((options->max_size > 0) &&
+            (live_status.partition_size >= options->max_size)))) ||
         (split == SPLIT_END)) {
 end_part:
         /* display parent directories if requested */
@@ -786,60 +1068,347 @@ end_part:
             split = SPLIT_END;
             goto start_part;
         }
+        /* create another partition for a group of hardlinks */
+        if (split == SPLIT_LINKS) {
+            split = SPLIT_NONE;
+            goto start_part;
+        }
+    }
+
+    return (0);
+}
+
+/***************************************************
+ File entries manipulation functions (non-live mode)
+ ***************************************************/
+
+/* Add a chunk to file entries
+   - returns < 0 if error */
+static int
+add_file_entry_chunk(struct file_entries *entries,
+    struct program_options *options)
+{
+    assert(entries != NULL);
+    assert(options != NULL);
+
+    struct file_entry_chunk *chunk = NULL;
+
+    if(entries->num_chunks == entries->max_chunks) {
+        fnum_t max_chunks = max(entries->max_chunks * 2, 16);
+        {
+            if_not_realloc(entries->chunks,
+                sizeof(struct file_entry_chunk *) * max_chunks,
+                return (-1);
+            )
+        }
+        entries->max_chunks = max_chunks;
+    }
+
+    if_not_malloc(chunk, sizeof(struct file_entry_chunk),
+        return (-1);
+    )
+    chunk->links = NULL;
+    chunk->link_files = NULL;
+    chunk->link_sizes = NULL;
+    if(options->hardlinks == OPT_HARDLINKS) {
+        if(((chunk->links = calloc(FE_CHUNK_ENTRIES, sizeof(fnum_t))) == NULL) ||
+            ((chunk->link_files =
+                calloc(FE_CHUNK_ENTRIES, sizeof(fnum_t))) == NULL) ||
+            ((chunk->link_sizes =
+                calloc(FE_CHUNK_ENTRIES, sizeof(fsize_t))) == NULL)) {
+            fprintf(stderr, "%s(): cannot allocate memory\n", __func__);
+            free(chunk->link_files);
+            free(chunk->links);
+            free(chunk);
+            return (-1);
+        }
+    }
+    entries->chunks[entries->num_chunks++] = chunk;
+    return (0);
+}
+
+/* Add a directory to file entries
+   - name is len bytes long
+   - sets *id to the new directory's id
+   - returns < 0 if error */
+static int
+add_file_entry_dir(struct file_entries *entries, fe_dnum_t parent,
+    const char *name, size_t len, fe_dnum_t *id)
+{
+    assert(entries != NULL);
+    assert(name != NULL);
+    assert(id != NULL);
+
+    char *dir_name = NULL;
+    fe_dnum_t d = 0;
+
+    if(entries->num_dirs == FE_DNUM_MAX) {
+        fprintf(stderr, "%s(): too many directories\n", __func__);
+        return (-1);
+    }
+
+    /* chunk full */
+    if((entries->num_dirs / FE_CHUNK_ENTRIES) == entries->num_dir_chunks) {
+        if(entries->num_dir_chunks == entries->max_dir_chunks) {
+            fnum_t max_dir_chunks = max(entries->max_dir_chunks * 2, 16);
+            {
+                if_not_realloc(entries->dir_chunks,
+                    sizeof(struct file_entry_dir_chunk *) * max_dir_chunks,
+                    return (-1);
+                )
+            }
+            entries->max_dir_chunks = max_dir_chunks;
+        }
+        if_not_malloc(entries->dir_chunks[entries->num_dir_chunks],
+            sizeof(struct file_entry_dir_chunk),
+            return (-1);
+        )
+        entries->num_dir_chunks++;
+    }
+
+    if((dir_name = arena_strndup(entries->names, name, len)) == NULL)
+        return (-1);
+
+    d = ++entries->num_dirs;
+    fe_dir_parent(entries, d) = parent;
+    fe_dir_name(entries, d) = dir_name;
+    *id = d;
+    return (0);
+}
+
+/* Get the id of a directory, adding it and its ancestors if needed
+   - dir (a path) is len bytes long
+   - as entries are usually added in crawling order, components of dir are
+     only compared to those of the last directory got, directories being
+     added again if they do not match
+   - returns < 0 if error */
+static int
+get_file_entry_dir(struct file_entries *entries, const char *dir,
+    size_t len, fe_dnum_t *id)
+{
+    assert(entries != NULL);
+    assert(dir != NULL);
+    assert(id != NULL);
+
+    const char *end = dir + len;
+    fe_dnum_t parent = 0;
+    size_t level = 0;
+
+    while(1) {
+        const char *sep = memchr(dir, '/', end - dir);
+        size_t comp_len = 0;
+
+        if(sep == NULL)
+            sep = end;
+        comp_len = sep - dir;
+
+        if(level < entries->num_levels) {
+            const char *name = fe_dir_name(entries, entries->levels[level]);
+
+            if((strncmp(name, dir, comp_len) != 0) ||
+                (name[comp_len] != '\0'))
+                /* new branch, forget deeper directories */
+                entries->num_levels = level;
+        }
+
+        if(level == entries->num_levels) {
+            if(entries->num_levels == entries->max_levels) {
+                size_t max_levels = max(entries->max_levels * 2, 64);
+                {
+                    if_not_realloc(entries->levels,
+                        sizeof(fe_dnum_t) * max_levels,
+                        return (-1);
+                    )
+                }
+                entries->max_levels = max_levels;
+            }
+            if(add_file_entry_dir(entries, parent, dir, comp_len,
+                &entries->levels[level]) != 0)
+                return (-1);
+            entries->num_levels++;
+        }
+
+        parent = entries->levels[level];
+        level++;
+        if(sep == end)
+            break;
+        dir = sep + 1;
     }
 
+    /* directory found or added, forget its descendants */
+    entries->num_levels = level;
+    *id = parent;
     return (0);
 }
 
-/*********************************************************
- Double-linked list of file_entries manipulation functions
- *********************************************************/
+/* Build path of file entry index
+   - returns a pointer to an internal buffer, valid until next call
+   - returns NULL if error */
+const char *
+file_entry_path(struct file_entries *entries, fnum_t index)
+{
+    assert(entries != NULL);
+    assert(index < entries->num_entries);
+
+    fe_dnum_t dir = fe_dir(entries, index);
+    const char *name = fe_name(entries, index);
+    size_t name_size = strlen(name) + 1;
+    fe_dnum_t d = 0;
 
-/* Add a file entry to a double-linked list of file_entries
-   - if head is NULL, creates a new file entry ; if not, chains a new file
-     entry to it
+    if(dir == 0)
+        return (name);
+
+    /* build directory's path, from the end */
+    if(dir != entries->path_dir) {
+        size_t dir_len = 0;
+
+        for(d = dir; d != 0; d = fe_dir_parent(entries, d))
+            dir_len += strlen(fe_dir_name(entries, d)) + 1;
+
+        if(dir_len + name_size > entries->path_size) {
+            size_t path_size = max(dir_len + name_size,
+                entries->path_size * 2);
+            {
+                if_not_realloc(entries->path, path_size,
+                    return (NULL);
+                )
+            }
+            entries->path_size = path_size;
+        }
+
+        entries->path_dir_len = dir_len;
+        for(d = dir; d != 0; d = fe_dir_parent(entries, d)) {
+            const char *dir_name = fe_dir_name(entries, d);
+            size_t len = strlen(dir_name);
+
+            entries->path[--dir_len] = '/';
+            dir_len -= len;
+            memcpy(&entries->path[dir_len], dir_name, len);
+        }
+        entries->path_dir = dir;
+    }
+
+    if(entries->path_dir_len + name_size > entries->path_size) {
+        size_t path_size = max(entries->path_dir_len + name_size,
+            entries->path_size * 2);
+        {
+            if_not_realloc(entries->path, path_size,
+                return (NULL);
+            )
+        }
+        entries->path_size = path_size;
+    }
+    memcpy(&entries->path[entries->path_dir_len], name, name_size);
+    return (entries->path);
+}
+
+/* Get memory used by file entries, including keys needed to sort them
+   (qsort(3) may need as much again) */
+static fsize_t
+file_entries_memory(const struct file_entries *entries)
+{
+    assert(entries != NULL);
+
+    return ((fsize_t)
+        (sizeof(struct file_entry_chunk *) * entries->max_chunks) +
+        (sizeof(struct file_entry_chunk) * entries->num_chunks) +
+        (sizeof(struct file_entry_dir_chunk *) * entries->max_dir_chunks) +
+        (sizeof(struct file_entry_dir_chunk) * entries->num_dir_chunks) +
+        (sizeof(fe_dnum_t) * entries->max_levels) + entries->path_size +
+        arena_size(entries->names) +
+        (2 * sizeof(struct file_entry_key) * entries->num_entries));
+}
+
+/* Add a file entry
+   - if *entries is NULL, creates a new store
    - increments *status counters
    - returns (0) if entry has been added
-   - returns (-1) if error
-   - returns with head set to the newly added element */
+   - returns (-1) if error */
 int
-add_file_entry(struct file_entry **head, char *path, fsize_t size,
+add_file_entry(struct file_entries **entries, char *path, fsize_t size,
     struct program_options *options, struct program_status *status)
 {
-    assert(head != NULL);
+    assert(entries != NULL);
     assert(path != NULL);
     assert(options != NULL);
     assert(options->live_mode == OPT_NOLIVEMODE);
     assert(status != NULL);
 
-    struct file_entry **current = head; /* current file_entry pointer address */
-    struct file_entry *previous = NULL; /* previous file_entry pointer */
+    struct file_entries *fep = *entries;
+    char *entry_name = NULL;
+    fe_dnum_t dir = 0;
+    size_t name_start = 0;
+    fnum_t i = 0;
 
-    /* backup current structure pointer and initialize a new structure */
-    previous = *current;
-    if_not_malloc(*current, sizeof(struct file_entry),
-        return (-1);
-    )
+    /* create store */
+    if(fep == NULL) {
+        if_not_malloc(fep, sizeof(struct file_entries),
+            return (-1);
+        )
+        fep->chunks = NULL;
+        fep->num_chunks = 0;
+        fep->max_chunks = 0;
+        fep->num_entries = 0;
+        fep->dir_chunks = NULL;
+        fep->num_dir_chunks = 0;
+        fep->max_dir_chunks = 0;
+        fep->num_dirs = 0;
+        fep->levels = NULL;
+        fep->num_levels = 0;
+        fep->max_levels = 0;
+        fep->path = NULL;
+        fep->path_size = 0;
+        fep->path_dir = 0;
+        fep->path_dir_len = 0;
+        fep->first_seq = 0;
+        fep->spillp = NULL;
+        fep->num_spilled_empty = 0;
+        fep->dispatched = NULL;
+        if(options->spool == OPT_SPOOL) {
+            int fd = spill_tmpfile();
+            fep->names = (fd < 0) ? NULL :
+                arena_init_spool(ARENA_SPOOL_BLOCK_SIZE, fd);
+        }
+        else
+            fep->names = arena_init(ARENA_BLOCK_SIZE);
+        if(fep->names == NULL) {
+            free(fep);
+            return (-1);
+        }
+        *entries = fep;
+    }
 
-    /* set current file data */
-    size_t malloc_size = strlen(path) + 1;
+    /* chunk full */
+    i = fep->num_entries;
+    if((i / FE_CHUNK_ENTRIES) == fep->num_chunks) {
+        if(add_file_entry_chunk(fep, options) != 0)
+            return (-1);
+    }
 
-    if_not_malloc((*current)->path, malloc_size,
-        free(*current);
-        *current = previous;
+    /* split path into directory and name, a trailing '/' (option -e)
+       being part of the name */
+    name_start = strlen(path);
+    if((name_start > 0) && (path[name_start - 1] == '/'))
+        name_start--;
+    while((name_start > 0) && (path[name_start - 1] != '/'))
+        name_start--;
+    if((name_start > 0) &&
+        (get_file_entry_dir(fep, path, name_start - 1, &dir) != 0))
+        return (-1);
+    if((entry_name = arena_strdup(fep->names, &path[name_start])) == NULL)
         return (-1);
-    )
-    snprintf((*current)->path, malloc_size, "%s", path);
-    (*current)->size = size;
-
-    /* set current file entry's index and pointers */
-    (*current)->partition_index = 0;    /* set during dispatch */
-    (*current)->nextp = NULL;           /* set in next pass (see below) */
-    (*current)->prevp = previous;
 
-    /* set previous' nextp pointer */
-    if(previous != NULL)
-        previous->nextp = *current;
+    /* set file data, partition index is set during dispatch */
+    fe_size(fep, i) = size;
+    fe_partition(fep, i) = 0;
+    fe_dir(fep, i) = dir;
+    fe_name(fep, i) = entry_name;
+    if(fe_chunk(fep, i)->links != NULL) {
+        fe_chunk(fep, i)->links[i % FE_CHUNK_ENTRIES] = 0;
+        fe_chunk(fep, i)->link_files[i % FE_CHUNK_ENTRIES] = 0;
+        fe_chunk(fep, i)->link_sizes[i % FE_CHUNK_ENTRIES] = 0;
+    }
+    fep->num_entries++;
 
     /* count file in */
     status->total_size += size;
@@ -847,84 +1416,313 @@ add_file_entry(struct file_entry **head, char *path, fsize_t size,
 
     /* display added filename */
     if(options->verbose >= OPT_VVERBOSE)
-        fprintf(stderr, "%s\n", (*current)->path);
+        fprintf(stderr, "%s\n", path);
+
+    /* keep entries within memory budget (option -M) */
+    if((options->max_memory != DFLT_OPT_MAX_MEMORY) &&
+        (file_entries_memory(fep) > options->max_memory) &&
+        (spill_file_entries(fep) != 0))
+        return (-1);
+
+    return (0);
+}
+
+/* Sort file entries and spill them to a temporary file (option -M), then
+   empty memory (keeping chunks for next entries)
+   - returns < 0 if error */
+int
+spill_file_entries(struct file_entries *entries)
+{
+    assert(entries != NULL);
+
+    struct file_entry_key *keys = NULL;
+    struct spill_run *runp = NULL;
+    fnum_t i = 0;
 
+    if(entries->num_entries == 0)
+        return (0);
+
+    if((entries->spillp == NULL) &&
+        ((entries->spillp = spill_init()) == NULL))
+        return (-1);
+
+    /* sort entries the same way as dispatch_file_entry_keys_by_size()
+       expects them */
+    if_not_malloc(keys,
+        sizeof(struct file_entry_key) * entries->num_entries,
+        return (-1);
+    )
+    init_file_entry_keys(keys, entries);
+    qsort(&keys[0], entries->num_entries, sizeof(struct file_entry_key),
+        &sort_file_entry_keys);
+
+    if((runp = spill_run_create()) == NULL) {
+        free(keys);
+        return (-1);
+    }
+    for(i = 0; i < entries->num_entries; i++) {
+        const char *path = file_entry_path(entries, keys[i].index);
+
+        if((path == NULL) || (spill_run_write(runp, keys[i].size,
+            entries->first_seq + keys[i].index, path) != 0)) {
+            spill_run_close(runp);
+            free(keys);
+            return (-1);
+        }
+        if(keys[i].size == 0)
+            entries->num_spilled_empty++;
+    }
+    free(keys);
+    if(spill_add_run(entries->spillp, runp) != 0)
+        return (-1);
+
+    entries->first_seq += entries->num_entries;
+    entries->num_entries = 0;
+    entries->num_dirs = 0;
+    entries->num_levels = 0;
+    entries->path_dir = 0;
+    if(arena_reset(entries->names) != 0)
+        return (-1);
     return (0);
 }
 
-/* Compare entries to list directories first
-   - compar() function used by fts_open() when in dirs_only or leaf_dirs mode */
+/* Per-level size accumulators, used to get recursive directory sizes
+   without crawling directories twice: sizes[n] holds the size of entries
+   found so far below current directory of level n - 1 */
+struct subtree_sizes {
+    fsize_t *sizes;
+    size_t num_sizes;
+};
+
+/* Enter a directory (FTS_D), starting a new accumulator for its children
+   - returns 0 (success) or 1 (failure) */
 static int
-#if (defined(__linux__) || defined(__NetBSD__) || defined(__APPLE__)) && !defined(EMBED_FTS)
-fts_dirsfirst(const FTSENT **a, const FTSENT **b)
-#else
-fts_dirsfirst(const FTSENT * const *a, const FTSENT * const *b)
-#endif
+subtree_sizes_enter(struct subtree_sizes *ss, const FTSENT * const p)
 {
-    assert(a != NULL);
-    assert((*a) != NULL);
-    assert(b != NULL);
-    assert((*b) != NULL);
+    assert(ss != NULL);
+    assert(p != NULL);
+    assert(p->fts_level >= 0);
 
-    if(((*a)->fts_info == FTS_NS) ||
-       ((*a)->fts_info == FTS_NSOK) ||
-       ((*b)->fts_info == FTS_NS) ||
-       ((*b)->fts_info == FTS_NSOK))
+    size_t level = p->fts_level + 1;
+
+    if(level >= ss->num_sizes) {
+        size_t num_sizes = level + 1 + 32;
+        {
+            if_not_realloc(ss->sizes, sizeof(fsize_t) * num_sizes,
+                return (1);
+            )
+        }
+        memset(&ss->sizes[ss->num_sizes], 0,
+            sizeof(fsize_t) * (num_sizes - ss->num_sizes));
+        ss->num_sizes = num_sizes;
+    }
+    ss->sizes[level] = 0;
+    return (0);
+}
+
+/* Add an entry's size to its parent directory's accumulator */
+static void
+subtree_sizes_add(struct subtree_sizes *ss, const FTSENT * const p,
+    fsize_t size)
+{
+    assert(ss != NULL);
+    assert(p != NULL);
+    assert(p->fts_level >= 0);
+
+    /* files given as arguments have no parent directory */
+    if(p->fts_level > 0) {
+        assert((size_t)p->fts_level < ss->num_sizes);
+        ss->sizes[p->fts_level] += size;
+    }
+}
+
+/* Leave a directory (FTS_DP, or FTS_DNR and FTS_ERR for directories),
+   adding its recursive size to its parent directory's accumulator
+   - returns directory's recursive size */
+static fsize_t
+subtree_sizes_leave(struct subtree_sizes *ss, const FTSENT * const p)
+{
+    assert(ss != NULL);
+    assert(p != NULL);
+    assert((p->fts_level >= 0) && ((size_t)p->fts_level < ss->num_sizes));
+
+    size_t level = p->fts_level + 1;
+    fsize_t size = 0;
+
+    if(level < ss->num_sizes) {
+        size = ss->sizes[level];
+        ss->sizes[level] = 0;
+    }
+    ss->sizes[level - 1] += size;
+    return (size);
+}
+
+/* Tell if directories whose depth reached -d's cutoff are sized in background
+   by a sizer (see sizer.c), using crawling threads' count, instead of being
+   crawled by the main crawl
+   - a sizer would not use the crawl cache, so those directories are crawled
+     when one is used
+   - a sizer uses fts(3), so they are also crawled when it cannot honour
+     option -N */
+static int
+init_file_entries_sizer_wanted(struct program_options *options)
+{
+    assert(options != NULL);
+
+#if !defined(FTS_DONTSYNC)
+    if(options->sync_attrs == OPT_NOSYNCATTRS)
         return (0);
+#endif
+    return ((options->crawl_threads > 1) &&
+        (options->dir_depth != OPT_NODIRDEPTH) &&
+        (options->cache_filename == NULL));
+}
 
-    /* place non-directory entries after directory ones */
-    if(S_ISDIR((*a)->fts_statp->st_mode))
-        if(!S_ISDIR((*b)->fts_statp->st_mode))
+/* Tell if a directory whose depth reached -d's cutoff must be crawled to
+   compute its size (see FTS_DP below) or if it can be skipped, either because
+   its size is not needed or because it will be computed by a sizer */
+static int
+init_file_entries_cutoff_sized(const FTSENT * const p,
+    struct program_options *options)
+{
+    assert(p != NULL);
+    assert(options != NULL);
+
+    /* leaf directories get a single-depth (i.e. 0) size with option -D and
+       invalid ones will not be added */
+    return ((options->leaf_dirs != OPT_LEAFDIRS) &&
+        !init_file_entries_sizer_wanted(options) &&
+        valid_file(p, options, VF_FULLTEST));
+}
+
+/* Hand entries whose size is known over to handle_file_entry(), in crawling
+   order
+   - if wait is set, wait for all entries to be sized, else only wait if too
+     many directories are waiting to be sized
+   - returns < 0 if error */
+static int
+init_file_entries_flush(struct sizer *sizerp, int wait,
+    struct file_entries **entries, struct program_options *options,
+    struct program_status *status)
+{
+    assert(sizerp != NULL);
+
+    char *path = NULL;
+    fsize_t size = 0;
+    fnum_t link = 0;
+    int entry_errno = 0;
+
+    while(sizer_next(sizerp, wait || sizer_full(sizerp), &path, &size,
+        &link, &entry_errno)) {
+        if(handle_file_entry(entries, path, size, link, entry_errno, options,
+            status) < 0) {
+            free(path);
             return (-1);
-        else
-            return (0);
-    else
-        if(S_ISDIR((*b)->fts_statp->st_mode))
-            return (1);
-        else
-            return (0);
+        }
+        free(path);
+    }
+    return (0);
+}
+
+/* Add or display an entry
+   - if size_path is not NULL, entry's size will be computed recursively
+     from it by sizer (which must be set)
+   - link is the entry's hardlinks group (option -H), or 0
+   - returns < 0 if error */
+static int
+init_file_entries_add(struct sizer *sizerp, char *path,
+    const FTSENT * const size_ent, fsize_t size, fnum_t link,
+    int entry_errno, struct file_entries **entries,
+    struct program_options *options, struct program_status *status)
+{
+    assert((size_ent == NULL) || (sizerp != NULL));
+
+    /* nothing being sized, add entry directly */
+    if((sizerp == NULL) || ((size_ent == NULL) && sizer_empty(sizerp)))
+        return (handle_file_entry(entries, path, size, link, entry_errno,
+            options, status));
+
+    if(sizer_add(sizerp, path,
+        (size_ent != NULL) ? size_ent->fts_path : NULL,
+        (size_ent != NULL) ? size_ent->fts_statp : NULL,
+        size, link, entry_errno) != 0)
+        return (-1);
+    return (init_file_entries_flush(sizerp, 0, entries, options, status));
 }
 
-/* Initialize a double-linked list of file_entries from a path
+/* Tell if a directory can be skipped because include lists are only made of
+   paths that cannot match it nor any of its descendants. Its contents are not
+   needed to compute sizes: only directories that reached -d's cutoff get a
+   recursive size, and their descendants are not checked here */
+static int
+init_file_entries_unwanted(const FTSENT * const p,
+    struct program_options *options)
+{
+    assert(p != NULL);
+    assert(options != NULL);
+
+    return ((options->matcher != NULL) &&
+        matcher_prune(options->matcher, p));
+}
+
+/* Tell crawling threads if a directory will be skipped (see FTS_D below)
+   - prunefunc() function used by crawl_open()
+   - returns 1 if directory will be skipped, else 0 */
+static int
+init_file_entries_prune(const FTSENT * const p,
+    struct program_options *options)
+{
+    assert(p != NULL);
+    assert(options != NULL);
+
+    if(!valid_file(p, options, VF_EXCLUDEONLY))
+        return (1);
+    if(((options->dir_depth == OPT_NODIRDEPTH) ||
+        (p->fts_level <= options->dir_depth)) &&
+        init_file_entries_unwanted(p, options))
+        return (1);
+    if((options->dir_depth != OPT_NODIRDEPTH) &&
+        (p->fts_level == options->dir_depth) &&
+        !init_file_entries_cutoff_sized(p, options))
+        return (1);
+    return (0);
+}
+
+/* Add file entries from a path
    - file_path may be a file or directory
-   - if head is NULL, creates a new list ; if not, chains a new list to it
+   - if *entries is NULL, creates a new store ; if not, appends entries to it
+   - cachep (may be NULL) is the crawl cache to use and update
    - increments *status counters
-   - returns != 0 if critical error
-   - returns with head set to the last element added */
+   - returns != 0 if critical error */
 int
-init_file_entries(char *file_path, struct file_entry **head,
-	struct program_options *options, struct program_status *status)
+init_file_entries(char *file_path, struct file_entries **entries,
+	struct cache *cachep, struct program_options *options,
+	struct program_status *status)
 {
     assert(file_path != NULL);
-    assert(head != NULL);
+    assert(entries != NULL);
     assert(options != NULL);
     assert(status != NULL);
 
-    /* prepare fts */
-    FTS *ftsp = NULL;
+    /* prepare crawl */
+    struct crawl *crawlp = NULL;
     FTSENT *p = NULL;
-    int fts_options = (options->follow_symbolic_links == OPT_FOLLOWSYMLINKS) ?
-        FTS_LOGICAL : FTS_PHYSICAL;
-    fts_options |= (options->cross_fs_boundaries == OPT_NOCROSSFSBOUNDARIES) ?
-        FTS_XDEV : 0;
+    int crawl_flags = 0;
 
-    char *fts_argv[] = { file_path, NULL };
-
-    /* sort function */
-#if (defined(__linux__) || defined(__NetBSD__) || defined(__APPLE__)) && !defined(EMBED_FTS)
-    int (*fts_sortfuncp)(const FTSENT **, const FTSENT **);
-#else
-    int (*fts_sortfuncp)(const FTSENT * const *, const FTSENT * const *);
-#endif
     if((options->dirs_only == OPT_DIRSONLY) ||
        (options->leaf_dirs == OPT_LEAFDIRS) ||
        (options->add_parents == OPT_ADDPARENTS))
-        fts_sortfuncp = &fts_dirsfirst;
-    else
-        fts_sortfuncp = NULL;
-
-    if((ftsp = fts_open(fts_argv, fts_options, fts_sortfuncp)) == NULL) {
-        fprintf(stderr, "%s: fts_open()\n", file_path);
+        crawl_flags |= CRAWL_DIRSFIRST;
+    if(options->trust_dtype == OPT_TRUSTDTYPE)
+        crawl_flags |= CRAWL_TRUSTDTYPE;
+    if(options->inode_order == OPT_INODEORDER)
+        crawl_flags |= CRAWL_INOORDER;
+    if(options->sync_attrs == OPT_NOSYNCATTRS)
+        crawl_flags |= CRAWL_DONTSYNC;
+
+    if((crawlp = crawl_open(file_path, crawl_flags, &init_file_entries_prune,
+        cachep, options)) == NULL) {
+        fprintf(stderr, "%s: crawl_open()\n", file_path);
         return (0);
     }
 
@@ -936,6 +1734,13 @@ init_file_entries(char *file_path, struct file_entry **head,
                                            current dir */
     unsigned char curdir_addme = 0;     /* current dir must be added */
     fsize_t curdir_size = 0;            /* current dir size */
+    int cutoff_level = -1;              /* level of the directory that
+                                           reached -d's cutoff and whose
+                                           descendants are being crawled to
+                                           compute its size, or -1 */
+    struct subtree_sizes ss = { NULL, 0 };
+    struct sizer *sizerp = NULL;        /* sizer for directories that reached
+                                           -d's cutoff, if any */
 
     int fts_read_errno = 0;             /* kept apart because p->fts_errno
                                            is only significant with
@@ -943,6 +1748,12 @@ init_file_entries(char *file_path, struct file_entry **head,
                                            (see fts(3)), but fts_read_errno is
                                            needed in FTS_DP */
 
+    if(init_file_entries_sizer_wanted(options) &&
+        ((sizerp = sizer_init(options->crawl_threads, options)) == NULL)) {
+        crawl_close(crawlp);
+        return (1);
+    }
+
     /* keep a copy of current entry path in live mode */
     if(options->live_mode == OPT_LIVEMODE) {
         /* free() previous entry path if necessary */
@@ -957,7 +1768,7 @@ init_file_entries(char *file_path, struct file_entry **head,
         snprintf(live_status.entry_path, malloc_size, "%s", file_path);
     }
 
-    while((p = fts_read(ftsp)) != NULL) {
+    while((p = crawl_read(crawlp)) != NULL) {
         if(options->verbose >= OPT_VVVERBOSE) {
             fprintf(stderr, "%s(%s): fts_info=%d, fts_errno=%d\n", __func__,
                 p->fts_path, p->fts_info, p->fts_errno);
@@ -975,6 +1786,79 @@ init_file_entries(char *file_path, struct file_entry **head,
                 break;
         }
 
+        /* maintain recursive directory sizes */
+        fsize_t subtree_size = 0;
+        switch (p->fts_info) {
+            case FTS_D:
+                if(subtree_sizes_enter(&ss, p) != 0)
+                    goto err;
+                break;
+            case FTS_ERR:
+                if(!S_ISDIR(p->fts_statp->st_mode))
+                    break;
+                /* fallthrough */
+            case FTS_DNR:
+            case FTS_DP:
+                subtree_size = subtree_sizes_leave(&ss, p);
+                break;
+        }
+
+        /* descendants of a directory that reached -d's cutoff are only
+           crawled to compute its size, the same way get_size() would do */
+        if((cutoff_level >= 0) && (p->fts_level > cutoff_level)) {
+            switch (p->fts_info) {
+                case FTS_ERR:
+                case FTS_DNR:
+                case FTS_NS:
+                    fprintf(stderr, "%s: %s\n", p->fts_path,
+                        strerror(fts_read_errno));
+                    continue;
+
+                case FTS_DC:
+                    fprintf(stderr, "%s: filesystem loop detected\n",
+                        p->fts_path);
+                    continue;
+
+                case FTS_D:
+                    /* excluded directories do not account for size */
+                    if(!valid_file(p, options, VF_EXCLUDEONLY)) {
+                        if(options->verbose >= OPT_VVVERBOSE)
+                            fprintf(stderr, "%s(): skipping directory: %s\n",
+                                __func__, p->fts_path);
+                        crawl_set(crawlp, p, FTS_SKIP);
+                    }
+                    continue;
+
+                case FTS_NSOK:
+                case FTS_DOT:
+                case FTS_DP:
+                    continue;
+
+                default:
+                    /* excluded files do not account for size */
+                    if(!valid_file(p, options, VF_EXCLUDEONLY)) {
+                        if(options->verbose >= OPT_VVVERBOSE)
+                            fprintf(stderr, "%s(): skipping file: %s\n",
+                                __func__, p->fts_path);
+                    }
+                    else
+                        /* XXX unlike for top-level entries, st_size is
+                           used for all file types (e.g. symlinks) */
+                        subtree_sizes_add(&ss, p, p->fts_statp->st_size);
+                    continue;
+            }
+        }
+
+        /* a directory that reached -d's cutoff is added even if it could
+           not be (fully) read, as when get_size() was computing its size */
+        if((p->fts_level == cutoff_level) &&
+            ((p->fts_info == FTS_DNR) || (p->fts_info == FTS_ERR))) {
+            fprintf(stderr, "%s: %s\n", p->fts_path,
+                strerror(fts_read_errno));
+            fts_read_errno = 0;
+            goto add_directory;
+        }
+
         switch (p->fts_info) {
             case FTS_ERR:   /* misc errors, but also partially-read dirs */
                 fprintf(stderr, "%s: %s\n", p->fts_path,
@@ -1073,8 +1957,7 @@ add_directory:
                        added */
                     size_t malloc_size = p->fts_pathlen + 1 + 1;
                     if_not_malloc(curdir_entry_path, malloc_size,
-                        fts_close(ftsp);
-                        return (1);
+                        goto err;
                     )
 
                     /* add slash if requested and necessary */
@@ -1088,6 +1971,7 @@ add_directory:
                             p->fts_path);
 
                     /* adapt curdir_size for special cases */
+                    const FTSENT *size_ent = NULL;
                     if((p->fts_level > 0) &&
                         (options->cross_fs_boundaries == OPT_NOCROSSFSBOUNDARIES) &&
                         (p->fts_parent->fts_statp->st_dev != p->fts_statp->st_dev))
@@ -1104,20 +1988,25 @@ add_directory:
                            leaf_dirs mode activated (-D) and current directory is a leaf,
                            then we can trust current *single-depth* curdir_size.
                            In all other cases (e.g. when dir_depth requested and
-                           reached), we must compute the directory size
-                           *recursively* through get_size(). */
-                        curdir_size =
-                            get_size(p->fts_accpath, p->fts_statp, options);
+                           reached), we must use the directory size computed
+                           *recursively* while crawling it, or get it from
+                           sizer. */
+                    {
+                        if(sizerp != NULL)
+                            size_ent = p;
+                        else
+                            curdir_size = subtree_size;
+                    }
                     /* else, trust curdir_size and leave it untouched. */
 
                     /* add or display it */
-                    if(handle_file_entry(head, curdir_entry_path, curdir_size,
-                        fts_read_errno, options, status) < 0) {
+                    if(init_file_entries_add(sizerp, curdir_entry_path,
+                        size_ent, curdir_size, 0, fts_read_errno, entries,
+                        options, status) < 0) {
                         fprintf(stderr, "%s(): cannot add file entry\n",
                             __func__);
                         free(curdir_entry_path);
-                        fts_close(ftsp);
-                        return (1);
+                        goto err;
                     }
 
                     /* cleanup */
@@ -1126,6 +2015,8 @@ add_directory:
 
                 /* reset parent (now current) dir state */
 reset_directory:
+                if(p->fts_level == cutoff_level)
+                    cutoff_level = -1;
                 curdir_empty = 0;
                 curdir_dirsfound = 1;
                 curdir_addme = 0;
@@ -1144,18 +2035,33 @@ reset_directory:
                     if(options->verbose >= OPT_VERBOSE)
                         fprintf(stderr, "Skipping directory: '%s'\n",
                             p->fts_path);
-                    fts_set(ftsp, p, FTS_SKIP);
+                    crawl_set(crawlp, p, FTS_SKIP);
                     continue;
                 }
 
-                /* if dir_depth requested and reached,
-                   skip descendants but add directory entry (in post order) */
+                /* check for directories that cannot lead to included
+                   entries */
+                if(init_file_entries_unwanted(p, options)) {
+                    if(options->verbose >= OPT_VVERBOSE)
+                        fprintf(stderr, "Skipping directory: '%s'\n",
+                            p->fts_path);
+                    crawl_set(crawlp, p, FTS_SKIP);
+                    continue;
+                }
+
+                /* if dir_depth requested and reached, do not add
+                   descendants but add directory entry (in post order).
+                   Descendants are only crawled to compute directory size,
+                   when needed */
                 if((options->dir_depth != OPT_NODIRDEPTH) &&
                     (p->fts_level >= options->dir_depth)) {
-                    fts_set(ftsp, p, FTS_SKIP);
+                    if(init_file_entries_cutoff_sized(p, options))
+                        cutoff_level = p->fts_level;
+                    else
+                        crawl_set(crawlp, p, FTS_SKIP);
                     curdir_addme = 1;
-                    /* as we have not crawled into this directory yet,
-                       remove the empty flag to allow a call to get_size() in
+                    /* as we will not see this directory's contents,
+                       remove the empty flag to get its recursive size in
                        FTS_DP */
                     curdir_empty = 0;
                 }
@@ -1188,6 +2094,10 @@ curdir_size and add an option to get_size() to enable single-depth
 performances, that's why we chose to maintain curdir_size anyway, but with a
 two-pass check to handle include and exclude options properly. */
 
+                /* match include and exclude lists once for both passes */
+                int matches = file_matches(p, options,
+                    MATCH_INCLUDE | MATCH_EXCLUDE);
+
                 /* first pass: check for name validity regarding exclude
                    options only.
                    Honoring include options here would make most files excluded
@@ -1195,14 +2105,15 @@ two-pass check to handle include and exclude options properly. */
                    size of a subdir that would be selected through a -y option.
                    E.g. : fpart -f 10 -e -y './my/sub/dir' -E ./
                 */
-                if(valid_file(p, options, VF_EXCLUDEONLY)) {
+                if(valid_match(matches, options, VF_EXCLUDEONLY)) {
                     curdir_empty = 0;
                     curdir_size += curfile_size;
+                    subtree_sizes_add(&ss, p, curfile_size);
                 }
 
                 /* second pass: re-check for name validity regarding
                    exclude *and* include options */
-                if(!valid_file(p, options, VF_FULLTEST)) {
+                if(!valid_match(matches, options, VF_FULLTEST)) {
                     if(options->verbose >= OPT_VERBOSE)
                         fprintf(stderr, "Skipping file: '%s'\n", p->fts_path);
                     continue;
@@ -1219,13 +2130,23 @@ two-pass check to handle include and exclude options properly. */
                     ((options->leaf_dirs == OPT_LEAFDIRS) && (!curdir_dirsfound))))
                     continue;
 
+                /* hardlinked files are counted once (option -H) */
+                fsize_t curentry_size = curfile_size;
+                fnum_t curentry_link = 0;
+                if(links_lookup(p, &curentry_link, &curentry_size,
+                    options) < 0) {
+                    fprintf(stderr, "%s(): cannot look hardlinks up\n",
+                        __func__);
+                    goto err;
+                }
+
                 /* add or display it */
-                if(handle_file_entry(head, p->fts_path,
-                       curfile_size, 0 /* fts_read_errno is always 0 here,
-                       so hardcode it */, options, status) < 0) {
+                if(init_file_entries_add(sizerp, p->fts_path, NULL,
+                       curentry_size, curentry_link,
+                       0 /* fts_read_errno is always 0 here,
+                       so hardcode it */, entries, options, status) < 0) {
                     fprintf(stderr, "%s(): cannot add file entry\n", __func__);
-                    fts_close(ftsp);
-                    return (1);
+                    goto err;
                 }
                 continue;
             }
@@ -1233,40 +2154,75 @@ two-pass check to handle include and exclude options properly. */
     }
 
     if(errno != 0) {
-        fprintf(stderr, "%s: fts_read()\n", file_path);
-        fts_close(ftsp);
-        return (1);
+        fprintf(stderr, "%s: crawl_read()\n", file_path);
+        goto err;
+    }
+
+    /* wait for remaining directories to be sized */
+    if(sizerp != NULL) {
+        if(init_file_entries_flush(sizerp, 1, entries, options, status) < 0) {
+            fprintf(stderr, "%s(): cannot add file entry\n", __func__);
+            goto err;
+        }
+        sizer_uninit(sizerp);
+        sizerp = NULL;
     }
 
-    if(fts_close(ftsp) < 0)
-        fprintf(stderr, "%s: fts_close()\n", file_path);
+    /* print hardlinks kept aside while crawling */
+    if((options->live_mode == OPT_LIVEMODE) &&
+        (options->hardlinks == OPT_HARDLINKS) &&
+        (links_flush(options, status) < 0)) {
+        fprintf(stderr, "%s(): cannot add file entry\n", __func__);
+        goto err;
+    }
+
+    free(ss.sizes);
+
+    if(crawl_close(crawlp) < 0)
+        fprintf(stderr, "%s: crawl_close()\n", file_path);
 
     return (0);
+
+err:
+    if(sizerp != NULL)
+        sizer_uninit(sizerp);
+    free(ss.sizes);
+    crawl_close(crawlp);
+    return (1);
 }
 
-/* Un-initialize a double-linked list of file_entries */
+/* Un-initialize file entries (entries may be NULL) */
 void
-uninit_file_entries(struct file_entry *head, struct program_options *options,
-    struct program_status *status)
+uninit_file_entries(struct file_entries *entries,
+    struct program_options *options, struct program_status *status)
 {
     assert(options != NULL);
     assert(status != NULL);
 
-    /* be sure to start from last file entry */
-    fastfw_list(head);
+    if(entries != NULL) {
+        fnum_t i = 0;
 
-    struct file_entry *current = head;
-    struct file_entry *prev = NULL;
-
-    while(current != NULL) {
-        if(current->path != NULL) {
-            free(current->path);
+        for(i = 0; i < entries->num_chunks; i++) {
+            free(entries->chunks[i]->link_sizes);
+            free(entries->chunks[i]->link_files);
+            free(entries->chunks[i]->links);
+            free(entries->chunks[i]);
         }
-        prev = current->prevp;
-        free(current);
-        current = prev;
+        free(entries->chunks);
+        for(i = 0; i < entries->num_dir_chunks; i++)
+            free(entries->dir_chunks[i]);
+        free(entries->dir_chunks);
+        free(entries->levels);
+        free(entries->path);
+        /* names are freed in bulk */
+        arena_uninit(entries->names);
+        spill_uninit(entries->spillp);
+        spill_run_close(entries->dispatched);
+        free(entries);
     }
 
+    links_cleanup();
+
     /* live mode */
     if(options->live_mode == OPT_LIVEMODE) {
         /* display added partition */
@@ -1323,35 +2279,88 @@ uninit_file_entries(struct file_entry *head, struct program_options *options,
     return;
 }
 
-/* Print a double-linked list of file_entries from head
+/* Get next file entry to print, either from memory (entry *e, *e being
+   incremented) or from spilled entries once dispatched (option -M)
+   - returns 1 if an entry has been found, 0 if no more entries, < 0 if
+     error */
+static int
+print_file_entries_next(struct file_entries *entries, fnum_t *e,
+    pnum_t *partition_index, fsize_t *size)
+{
+    assert(entries != NULL);
+    assert(e != NULL);
+    assert(partition_index != NULL);
+    assert(size != NULL);
+
+    if(entries->dispatched != NULL) {
+        int retval = spill_run_read(entries->dispatched);
+
+        if(retval > 0) {
+            *partition_index = entries->dispatched->seq;
+            *size = entries->dispatched->size;
+        }
+        return (retval);
+    }
+
+    if(*e >= entries->num_entries)
+        return (0);
+    *partition_index = fe_partition(entries, *e);
+    *size = fe_size(entries, *e);
+    (*e)++;
+    return (1);
+}
+
+/* Get path of the entry found by print_file_entries_next()
+   - returns NULL if error */
+static const char *
+print_file_entries_path(struct file_entries *entries, fnum_t e)
+{
+    assert(entries != NULL);
+
+    if(entries->dispatched != NULL)
+        return (entries->dispatched->path);
+    return (file_entry_path(entries, e - 1));
+}
+
+/* Print file entries
    - if no filename template given, print to stdout */
 int
-print_file_entries(struct file_entry *head, struct partition *part_head,
+print_file_entries(struct file_entries *entries, struct partition *part_head,
     pnum_t num_parts, struct program_options *options)
 {
-    assert(head != NULL);
+    assert(entries != NULL);
     assert(part_head != NULL);
     assert(num_parts > 0);
     assert(options != NULL);
 
     char *out_template = options->out_filename;
     char *ln_term = (options->out_zero == OPT_OUT0) ? "\0" : "\n";
+    fnum_t e = 0;
+    pnum_t partition_index = 0;
+    fsize_t size = 0;
+    int retval = 0;
 
     /* no template provided, just print to stdout and return */
     if(out_template == NULL) {
-        while(head != NULL) {
-            display_file_entry(adapt_partition_index(head->partition_index, options),
-                head->size, head->path, ENTRY_DISPLAY_TYPE_STANDARD);
-            head = head->nextp;
+        const char *path = NULL;
+
+        if((entries->dispatched != NULL) &&
+            (spill_run_rewind(entries->dispatched) != 0))
+            return (1);
+        while((retval = print_file_entries_next(entries, &e,
+            &partition_index, &size)) > 0) {
+            if((path = print_file_entries_path(entries, e)) == NULL)
+                return (1);
+            display_file_entry(adapt_partition_index(partition_index,
+                options), size, path, ENTRY_DISPLAY_TYPE_STANDARD);
         }
-        return (0);
+        return ((retval < 0) ? 1 : 0);
     }
 
     /* a template has been provided; to avoid opening too many files,
        open chunks of FDs and do as many passes as necessary */
     assert(PRINT_FE_CHUNKS > 0);
 
-    struct file_entry *start = head;
     pnum_t current_chunk = 0;       /* current chunk */
     pnum_t current_fd_index = 0;    /* current file index within chunk */
 
@@ -1412,12 +2421,19 @@ print_file_entries(struct file_entry *head, struct partition *part_head,
         }
 
         /* write data to opened file descriptors */
-        while(head != NULL) {
-            if((head->partition_index >= (current_chunk * PRINT_FE_CHUNKS)) &&
-               (head->partition_index < ((current_chunk + 1) * PRINT_FE_CHUNKS))) {
-                size_t to_write = strlen(head->path);
-                if((write(fd[head->partition_index % PRINT_FE_CHUNKS], head->path, to_write) != (ssize_t)to_write) ||
-                    (write(fd[head->partition_index % PRINT_FE_CHUNKS], ln_term, 1) != 1)) {
+        e = 0;
+        if((entries->dispatched != NULL) &&
+            (spill_run_rewind(entries->dispatched) != 0))
+            retval = -1;
+        else while((retval = print_file_entries_next(entries, &e,
+            &partition_index, &size)) > 0) {
+            if((partition_index >= (current_chunk * PRINT_FE_CHUNKS)) &&
+               (partition_index < ((current_chunk + 1) * PRINT_FE_CHUNKS))) {
+                const char *path = print_file_entries_path(entries, e);
+                size_t to_write = (path != NULL) ? strlen(path) : 0;
+                if((path == NULL) ||
+                    (write(fd[partition_index % PRINT_FE_CHUNKS], path, to_write) != (ssize_t)to_write) ||
+                    (write(fd[partition_index % PRINT_FE_CHUNKS], ln_term, 1) != 1)) {
                     fprintf(stderr, "%s\n", strerror(errno));
                     /* close all open descriptors */
                     pnum_t i;
@@ -1427,16 +2443,15 @@ print_file_entries(struct file_entry *head, struct partition *part_head,
                     return (1);
                 }
             }
-            head = head->nextp;
         }
-        /* come back to first entry */
-        head = start;
 
         /* close file descriptors */
         pnum_t i;
         for(i = 0; (i < PRINT_FE_CHUNKS) && (((current_chunk * PRINT_FE_CHUNKS) + i) < num_parts); i++)
             if(fd[i] >= 0)
                 close(fd[i]);
+        if(retval < 0)
+            return (1);
 
         current_fd_index = 0;
         current_chunk++;
@@ -1445,23 +2460,23 @@ print_file_entries(struct file_entry *head, struct partition *part_head,
     return (0);
 }
 
-/***************************************************
- Array of file_entry pointers manipulation functions
- ***************************************************/
+/***********************************************
+ Array of file_entry keys manipulation functions
+ ***********************************************/
 
-/* Initialize an array of file_entry pointers from a double-linked
-   list of file_entries (head) */
+/* Initialize an array of file_entry keys from file entries
+   (keys must hold entries->num_entries elements) */
 void
-init_file_entry_p(struct file_entry **file_entry_p, fnum_t num_entries,
-    struct file_entry *head)
+init_file_entry_keys(struct file_entry_key *keys,
+    const struct file_entries *entries)
 {
-    assert(file_entry_p != NULL);
+    assert(keys != NULL);
+    assert(entries != NULL);
 
     fnum_t i = 0;
-    while((head != NULL) && (file_entry_p != NULL) && (i < num_entries)) {
-        file_entry_p[i] = head;
-        head = head->nextp;
-        i++;
+    for(i = 0; i < entries->num_entries; i++) {
+        keys[i].size = fe_size(entries, i);
+        keys[i].index = i;
     }
     return;
 }
@@ -32,31 +32,139 @@
 
 #include "fpart.h"
 #include "options.h"
+#include "cache.h"
 
 #include <sys/types.h>
 
+/* uint32_t */
+#include <stdint.h>
+
 #if !defined(PRINT_FE_CHUNKS)
 #define PRINT_FE_CHUNKS 32          /* files per chunk when flushing
                                        partitions to disk */
 #endif
 
-/* A file entry */
-struct file_entry;
-struct file_entry {
-    char *path;                     /* file name */
-    fsize_t size;                   /* size in bytes */
-    pnum_t partition_index;         /* assigned partition index */
+#if !defined(FE_CHUNK_ENTRIES)
+#define FE_CHUNK_ENTRIES 65536      /* file entries per chunk (power of 2) */
+#endif
+
+#if !defined(FE_MIN_MEMORY)
+#define FE_MIN_MEMORY (8 * 1024 * 1024) /* minimum memory budget (option -M),
+                                           in bytes */
+#endif
+
+/* Partition index of a file entry (non-live mode), kept small */
+typedef uint32_t fe_pnum_t;
+#define FE_PNUM_MAX UINT32_MAX
+
+/* Directory id (non-live mode), starting at 1, 0 meaning no directory */
+typedef uint32_t fe_dnum_t;
+#define FE_DNUM_MAX UINT32_MAX
+
+/* A chunk of file entries, stored by column. An entry's path is made of its
+   directory's path, a '/' and its name (or only its name if it has no
+   directory) */
+struct file_entry_chunk {
+    fsize_t sizes[FE_CHUNK_ENTRIES];        /* sizes in bytes */
+    fe_pnum_t partitions[FE_CHUNK_ENTRIES]; /* assigned partition indexes */
+    fe_dnum_t dirs[FE_CHUNK_ENTRIES];       /* directory ids */
+    char *names[FE_CHUNK_ENTRIES];          /* names within directories */
+    fnum_t *links;                  /* index + 1 of first entry linked to the
+                                       same file (option -H), 0 if none;
+                                       NULL if option -H is not used */
+    fnum_t *link_files;             /* number of entries linked to that
+                                       entry, if first of them (option -H);
+                                       NULL if option -H is not used */
+    fsize_t *link_sizes;            /* total size of those entries */
+};
+
+/* A chunk of directories, stored by column. A directory's path is made of
+   its parent's path, a '/' and its name (or only its name if it has no
+   parent) */
+struct file_entry_dir_chunk {
+    fe_dnum_t parents[FE_CHUNK_ENTRIES];    /* parent directory ids */
+    char *names[FE_CHUNK_ENTRIES];          /* names within parents */
+};
+
+struct arena;
+struct spill;
+struct spill_run;
 
-    struct file_entry* nextp;       /* next file_entry */
-    struct file_entry* prevp;       /* previous one */
+/* File entries (non-live mode), in crawling order */
+struct file_entries {
+    struct file_entry_chunk **chunks;
+    fnum_t num_chunks;              /* chunks allocated */
+    fnum_t max_chunks;              /* size of chunks array */
+    fnum_t num_entries;             /* entries added */
+
+    struct file_entry_dir_chunk **dir_chunks;
+    fnum_t num_dir_chunks;          /* directory chunks allocated */
+    fnum_t max_dir_chunks;          /* size of dir_chunks array */
+    fnum_t num_dirs;                /* directories added */
+
+    fe_dnum_t *levels;              /* ids of last directory added to and of
+                                       its ancestors, by depth */
+    size_t num_levels;
+    size_t max_levels;
+
+    char *path;                     /* last path built by file_entry_path() */
+    size_t path_size;
+    fe_dnum_t path_dir;             /* directory of that path */
+    size_t path_dir_len;            /* length of that directory's path,
+                                       including trailing '/' */
+
+    struct arena *names;            /* names storage, possibly spooled
+                                       (option -B) */
+
+    /* option -M */
+    fnum_t first_seq;               /* crawl order of first entry above */
+    struct spill *spillp;           /* entries spilled to temporary files,
+                                       or NULL */
+    fnum_t num_spilled_empty;       /* empty files spilled */
+    struct spill_run *dispatched;   /* spilled entries once dispatched, with
+                                       their partition index as seq */
+};
+
+/* Access file entry i's columns */
+#define fe_chunk(entries, i) ((entries)->chunks[(i) / FE_CHUNK_ENTRIES])
+#define fe_size(entries, i) \
+    (fe_chunk(entries, i)->sizes[(i) % FE_CHUNK_ENTRIES])
+#define fe_partition(entries, i) \
+    (fe_chunk(entries, i)->partitions[(i) % FE_CHUNK_ENTRIES])
+#define fe_dir(entries, i) \
+    (fe_chunk(entries, i)->dirs[(i) % FE_CHUNK_ENTRIES])
+#define fe_name(entries, i) \
+    (fe_chunk(entries, i)->names[(i) % FE_CHUNK_ENTRIES])
+#define fe_link(entries, i) \
+    ((fe_chunk(entries, i)->links == NULL) ? 0 : \
+    fe_chunk(entries, i)->links[(i) % FE_CHUNK_ENTRIES])
+#define fe_link_files(entries, i) \
+    ((fe_chunk(entries, i)->link_files == NULL) ? 0 : \
+    fe_chunk(entries, i)->link_files[(i) % FE_CHUNK_ENTRIES])
+#define fe_link_sizes(entries, i) \
+    ((fe_chunk(entries, i)->link_sizes == NULL) ? 0 : \
+    fe_chunk(entries, i)->link_sizes[(i) % FE_CHUNK_ENTRIES])
+
+/* Access directory d's columns */
+#define fe_dir_chunk(entries, d) \
+    ((entries)->dir_chunks[((d) - 1) / FE_CHUNK_ENTRIES])
+#define fe_dir_parent(entries, d) \
+    (fe_dir_chunk(entries, d)->parents[((d) - 1) % FE_CHUNK_ENTRIES])
+#define fe_dir_name(entries, d) \
+    (fe_dir_chunk(entries, d)->names[((d) - 1) % FE_CHUNK_ENTRIES])
+
+/* A file entry's sort key */
+struct file_entry_key {
+    fsize_t size;
+    fnum_t index;                   /* entry index */
 };
 
 int fpart_hook(const char *cmd, const struct program_options *options,
     const struct program_status *status, const char *live_filename,
     const pnum_t *live_partition_index, const fsize_t *live_partition_size,
     const fnum_t *live_partition_num_files, const int live_partition_errno);
-int handle_file_entry(struct file_entry **head, char *path, fsize_t size,
-    int entry_errno, struct program_options *options,
+int handle_file_entry(struct file_entries **entries, char *path, fsize_t size,
+    fnum_t link, int entry_errno, struct program_options *options,
     struct program_status *status);
 
 /* display types */
@@ -66,15 +174,19 @@ void display_file_entry(pnum_t partition_index, const fsize_t entry_size,
     const char * const entry_path, const unsigned char entry_display_type);
 int live_print_file_entry(char *path, fsize_t size, int entry_errno,
     struct program_options *options, struct program_status *status);
-int add_file_entry(struct file_entry **head, char *path, fsize_t size,
+int add_file_entry(struct file_entries **entries, char *path, fsize_t size,
     struct program_options *options, struct program_status *status);
-int init_file_entries(char *file_path, struct file_entry **head,
-    struct program_options *options, struct program_status *status);
-void uninit_file_entries(struct file_entry *head,
+int init_file_entries(char *file_path, struct file_entries **entries,
+    struct cache *cachep, struct program_options *options,
+    struct program_status *status);
+const char *file_entry_path(struct file_entries *entries, fnum_t index);
+int spill_file_entries(struct file_entries *entries);
+void uninit_file_entries(struct file_entries *entries,
     struct program_options *options, struct program_status *status);
-int print_file_entries(struct file_entry *head, struct partition *part_head,
-    pnum_t num_parts, struct program_options *options);
-void init_file_entry_p(struct file_entry **file_entry_p, fnum_t num_entries,
-    struct file_entry *head);
+int print_file_entries(struct file_entries *entries,
+    struct partition *part_head, pnum_t num_parts,
+    struct program_options *options);
+void init_file_entry_keys(struct file_entry_key *keys,
+    const struct file_entries *entries);
 
 #endif /* _FILE_ENTRY_H */
@@ -34,6 +34,8 @@
 #include "partition.h"
 #include "file_entry.h"
 #include "dispatch.h"
+#include "match.h"
+#include "throttle.h"
 
 /* NULL, exit(3) */
 #include <stdlib.h>
@@ -53,9 +55,9 @@
 
 /* Short options */
 #if defined(_HAS_FNM_CASEFOLD)
-#define OPTIONS "+hVn:f:s:i:ao:0ePvlby:Y:x:X:zZd:DELSw:W:R:p:q:r:"
+#define OPTIONS "+hVn:f:s:M:Bi:ao:0ePvlbNtIC:T:G:A:O:c:y:Y:x:X:J:K:zZd:DELSw:W:R:p:q:r:H"
 #else
-#define OPTIONS "+hVn:f:s:i:ao:0ePvlby:x:zZd:DELSw:W:R:p:q:r:"
+#define OPTIONS "+hVn:f:s:M:Bi:ao:0ePvlbNtIC:T:G:A:O:c:y:x:J:K:zZd:DELSw:W:R:p:q:r:H"
 #endif
 
 /* Long options */
@@ -68,16 +70,26 @@ static struct option long_options[] =
     { "parts",          required_argument,  NULL, 'n' },
     { "files",          required_argument,  NULL, 'f' },
     { "size",           required_argument,  NULL, 's' },
+    { "max-memory",     required_argument,  NULL, 'M' },
+    { "spool",          no_argument,        NULL, 'B' },
     { "arbitrary",      no_argument,        NULL, 'a' },
     { "verbose",        no_argument,        NULL, 'v' },
+    { "threads",        required_argument,  NULL, 'T' },
+    { "fs-threads",     required_argument,  NULL, 'G' },
+    { "prefetch",       required_argument,  NULL, 'A' },
+    { "max-ops",        required_argument,  NULL, 'O' },
+    { "io-class",       required_argument,  NULL, 'c' },
     { "include",        required_argument,  NULL, 'y' },
     { "exclude",        required_argument,  NULL, 'x' },
+    { "include-from",   required_argument,  NULL, 'J' },
+    { "exclude-from",   required_argument,  NULL, 'K' },
     { "leaf-dirs",      no_argument,        NULL, 'D' },
     { "dirs-only",      no_argument,        NULL, 'E' },
     { "live",           no_argument,        NULL, 'L' },
     { "pre-part-cmd",   required_argument,  NULL, 'w' },
     { "post-part-cmd",  required_argument,  NULL, 'W' },
     { "post-run-cmd",   required_argument,  NULL, 'R' },
+    { "hardlinks",      no_argument,        NULL, 'H' },
     { NULL, 0, NULL, 0 }
 };
 #else
@@ -146,6 +158,12 @@ usage(void)
         "or directories\n");
     fprintf(stderr, "  -s, --size           limit partitions to <size> "
         "bytes\n");
+    fprintf(stderr, "  -M, --max-memory     keep file entries within <size> "
+        "bytes of memory, using\n");
+    fprintf(stderr, "                       temporary files (needs -n, see "
+        "man page)\n");
+    fprintf(stderr, "  -B, --spool          spool file names to a temporary "
+        "file instead of memory\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Input control:\n");
     fprintf(stderr, "  -i                   read file list from <infile> "
@@ -172,6 +190,39 @@ usage(void)
     fprintf(stderr, "  -l                   follow symbolic links\n");
     fprintf(stderr, "  -b                   do not cross filesystem "
         "boundaries\n");
+#if defined(_HAS_STATX)
+    fprintf(stderr, "  -N                   do not synchronize file attributes "
+        "with server (network\n");
+    fprintf(stderr, "                       filesystems, see man page)\n");
+#endif
+    fprintf(stderr, "  -t                   trust directory entries' type "
+        "to avoid stat(2) calls\n");
+    fprintf(stderr, "                       (see man page)\n");
+    fprintf(stderr, "  -I                   stat(2) directory entries in "
+        "inode order (see man page)\n");
+    fprintf(stderr, "  -C                   reuse and update crawl cache "
+        "<file> (see man page)\n");
+    fprintf(stderr, "  -T, --threads        crawl filesystem using <num> "
+        "threads (default: 1)\n");
+    fprintf(stderr, "  -G, --fs-threads     use at most <num> threads to "
+        "crawl filesystem holding\n");
+    fprintf(stderr, "                       <path>, given as <num>:<path> "
+        "(may be specified more\n");
+    fprintf(stderr, "                       than once, see man page)\n");
+    fprintf(stderr, "  -A, --prefetch       prefetch sub-directories using "
+        "<num> threads when\n");
+    fprintf(stderr, "                       crawling with a single thread "
+        "(see man page)\n");
+    fprintf(stderr, "  -O, --max-ops        limit crawl to <num> filesystem "
+        "operations per second,\n");
+    fprintf(stderr, "                       given as <num>[:<msec>] to slow "
+        "down when latency exceeds\n");
+    fprintf(stderr, "                       <msec> (see man page)\n");
+#if defined(_HAS_IOPRIO)
+    fprintf(stderr, "  -c, --io-class       crawl using I/O scheduling "
+        "<class> 'idle' or 'be[:level]'\n");
+    fprintf(stderr, "                       (see man page)\n");
+#endif
     fprintf(stderr, "  -y, --include        include files matching <pattern> "
         "only (may be specified\n");
     fprintf(stderr, "                       more than once)\n");
@@ -184,6 +235,10 @@ usage(void)
 #if defined(_HAS_FNM_CASEFOLD)
     fprintf(stderr, "  -X                   same as -x, but ignore case\n");
 #endif
+    fprintf(stderr, "  -J, --include-from   include files listed in <file> "
+        "only (see man page)\n");
+    fprintf(stderr, "  -K, --exclude-from   exclude files listed in <file> "
+        "(see man page)\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Directory handling:\n");
     fprintf(stderr, "  -z                   pack empty directories too "
@@ -222,6 +277,9 @@ usage(void)
         "bytes\n");
     fprintf(stderr, "  -r                   round each file size up to next "
         "<num> bytes multiple\n");
+    fprintf(stderr, "  -H, --hardlinks      count hardlinked files once and "
+        "keep their links in the\n");
+    fprintf(stderr, "                       same partition (see man page)\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Example: fpart -n 3 -o var-parts /var\n");
     fprintf(stderr, "\n");
@@ -236,17 +294,17 @@ usage(void)
 }
 
 /* Handle one argument (either a path to crawl or an arbitrary
-   value) and update file entries (head)
+   value) and update file entries
    - returns != 0 if a critical error occurred
-   - returns with head set to the last element added
    - updates main_status.total_size and main_status.total_num_files with
      the number of elements added */
 static int
-handle_argument(char *argument, struct file_entry **head,
-    struct program_options *options, struct program_status *status)
+handle_argument(char *argument, struct file_entries **entries,
+    struct cache *cachep, struct program_options *options,
+    struct program_status *status)
 {
     assert(argument != NULL);
-    assert(head != NULL);
+    assert(entries != NULL);
     assert(options != NULL);
     assert(status != NULL);
 
@@ -259,8 +317,9 @@ handle_argument(char *argument, struct file_entry **head,
         )
 
         if(sscanf(argument, "%ju %[^\n]", &input_size, input_path) == 2) {
-            if(handle_file_entry(head, input_path, input_size,
-                   0, options, status) /* entry_errno irrelevant here */ < 0) {
+            /* link and entry_errno irrelevant here */
+            if(handle_file_entry(entries, input_path, input_size,
+                   0, 0, options, status) < 0) {
                 fprintf(stderr, "%s(): cannot add file entry\n", __func__);
                 free(input_path);
                 return (1);
@@ -290,7 +349,8 @@ handle_argument(char *argument, struct file_entry **head,
             fprintf(stderr, "init_file_entries(): examining %s\n",
                 input_path);
 #endif
-            if(init_file_entries(input_path, head, options, status) != 0) {
+            if(init_file_entries(input_path, entries, cachep, options,
+                status) != 0) {
                 fprintf(stderr, "%s(): cannot initialize file entries\n",
                     __func__);
                 free(input_path);
@@ -374,6 +434,22 @@ handle_options(struct program_options *options, int *argcp, char ***argvp)
                 options->max_size = (fsize_t)max_size;
                 break;
             }
+            case 'M':
+            {
+                uintmax_t max_memory = str_to_uintmax(optarg, 1);
+                if(max_memory < FE_MIN_MEMORY) {
+                    fprintf(stderr,
+                        "Option -M requires a value of at least %ju.\n",
+                        (uintmax_t)FE_MIN_MEMORY);
+                    return (FPART_OPTS_USAGE |
+                        FPART_OPTS_NOK | FPART_OPTS_EXIT);
+                }
+                options->max_memory = (fsize_t)max_memory;
+                break;
+            }
+            case 'B':
+                options->spool = OPT_SPOOL;
+                break;
             case 'i':
             {
                 /* check for empty argument */
@@ -432,10 +508,145 @@ handle_options(struct program_options *options, int *argcp, char ***argvp)
             case 'b':
                 options->cross_fs_boundaries = OPT_NOCROSSFSBOUNDARIES;
                 break;
+            case 'N':   /* needs _HAS_STATX */
+#if defined(_HAS_STATX)
+                options->sync_attrs = OPT_NOSYNCATTRS;
+                break;
+#else
+                fprintf(stderr,
+                    "Option -N is not supported on this platform.\n");
+                return (FPART_OPTS_NOK | FPART_OPTS_EXIT);
+#endif
+            case 't':
+                options->trust_dtype = OPT_TRUSTDTYPE;
+                break;
+            case 'I':
+                options->inode_order = OPT_INODEORDER;
+                break;
+            case 'C':
+            {
+                /* check for empty argument */
+                if(strlen(optarg) == 0)
+                    break;
+                /* replace previous filename if '-C' specified multiple times */
+                if(options->cache_filename != NULL)
+                    free(options->cache_filename);
+                options->cache_filename = abs_path(optarg);
+                if(options->cache_filename == NULL) {
+                    fprintf(stderr, "%s(): cannot determine absolute path "
+                        "for file '%s'\n", __func__, optarg);
+                    return (FPART_OPTS_NOK | FPART_OPTS_EXIT);
+                }
+                break;
+            }
+            case 'T':
+            {
+                uintmax_t crawl_threads = str_to_uintmax(optarg, 0);
+                if((crawl_threads == 0) || (crawl_threads > UINT_MAX)) {
+                    fprintf(stderr,
+                        "Option -T requires a value greater than 0.\n");
+                    return (FPART_OPTS_USAGE |
+                        FPART_OPTS_NOK | FPART_OPTS_EXIT);
+                }
+                options->crawl_threads = (unsigned int)crawl_threads;
+                break;
+            }
+            case 'G':
+            {
+                char *sep = strchr(optarg, ':');
+                uintmax_t fs_threads = 0;
+                if(sep != NULL) {
+                    *sep = '\0';
+                    fs_threads = str_to_uintmax(optarg, 0);
+                    *sep = ':';
+                }
+                if((sep == NULL) || (sep[1] == '\0') ||
+                    (fs_threads == 0) || (fs_threads > UINT_MAX)) {
+                    fprintf(stderr,
+                        "Option -G requires a value of the form num:path, "
+                        "num being greater than 0.\n");
+                    return (FPART_OPTS_USAGE |
+                        FPART_OPTS_NOK | FPART_OPTS_EXIT);
+                }
+                if(str_push(&options->fs_threads, &options->nfs_threads,
+                    optarg) != 0)
+                    return (FPART_OPTS_NOK | FPART_OPTS_EXIT);
+                break;
+            }
+            case 'A':
+            {
+                uintmax_t prefetch_threads = str_to_uintmax(optarg, 0);
+                if((prefetch_threads == 0) || (prefetch_threads > UINT_MAX)) {
+                    fprintf(stderr,
+                        "Option -A requires a value greater than 0.\n");
+                    return (FPART_OPTS_USAGE |
+                        FPART_OPTS_NOK | FPART_OPTS_EXIT);
+                }
+                options->prefetch_threads = (unsigned int)prefetch_threads;
+                break;
+            }
+            case 'O':
+            {
+                char *sep = strchr(optarg, ':');
+                uintmax_t max_ops = 0;
+                uintmax_t max_latency = 0;
+                if(sep != NULL) {
+                    *sep = '\0';
+                    max_latency = str_to_uintmax(sep + 1, 0);
+                }
+                max_ops = str_to_uintmax(optarg, 1);
+                if(sep != NULL)
+                    *sep = ':';
+                if((max_ops == 0) ||
+                    ((sep != NULL) &&
+                    ((max_latency == 0) || (max_latency > UINT_MAX)))) {
+                    fprintf(stderr,
+                        "Option -O requires a value of the form "
+                        "num[:msec], num and msec being greater than 0.\n");
+                    return (FPART_OPTS_USAGE |
+                        FPART_OPTS_NOK | FPART_OPTS_EXIT);
+                }
+                options->max_ops = (fnum_t)max_ops;
+                options->max_latency = (unsigned int)max_latency;
+                break;
+            }
+            case 'c':   /* needs _HAS_IOPRIO */
+            {
+#if defined(_HAS_IOPRIO)
+                char *endptr = NULL;
+                long io_level = DFLT_OPT_IOLEVEL;
+                options->io_class = OPT_NOIOCLASS;
+                if(strcmp(optarg, "idle") == 0)
+                    options->io_class = OPT_IOCLASS_IDLE;
+                else if(strcmp(optarg, "be") == 0)
+                    options->io_class = OPT_IOCLASS_BE;
+                else if(strncmp(optarg, "be:", 3) == 0) {
+                    io_level = strtol(&optarg[3], &endptr, 10);
+                    if((endptr != &optarg[3]) && (*endptr == '\0') &&
+                        (io_level >= 0) && (io_level <= 7))
+                        options->io_class = OPT_IOCLASS_BE;
+                }
+                if(options->io_class == OPT_NOIOCLASS) {
+                    fprintf(stderr,
+                        "Option -c requires 'idle' or 'be[:level]', "
+                        "level being between 0 and 7.\n");
+                    return (FPART_OPTS_USAGE |
+                        FPART_OPTS_NOK | FPART_OPTS_EXIT);
+                }
+                options->io_level = (unsigned char)io_level;
+                break;
+#else
+                fprintf(stderr,
+                    "Option -c is not supported on this platform.\n");
+                return (FPART_OPTS_NOK | FPART_OPTS_EXIT);
+#endif
+            }
             case 'y':
             case 'Y':   /* needs _HAS_FNM_CASEFOLD */
             case 'x':
             case 'X':   /* needs _HAS_FNM_CASEFOLD */
+            case 'J':
+            case 'K':
             {
                 char ***dst_list = NULL;
                 unsigned int *dst_num = NULL;
@@ -456,6 +667,14 @@ handle_options(struct program_options *options, int *argcp, char ***argvp)
                         dst_list = &(options->exclude_files_ci);
                         dst_num = &(options->nexclude_files_ci);
                     break;
+                    case 'J':
+                        dst_list = &(options->include_from);
+                        dst_num = &(options->ninclude_from);
+                    break;
+                    case 'K':
+                        dst_list = &(options->exclude_from);
+                        dst_num = &(options->nexclude_from);
+                    break;
                 }
                 /* check for empty argument */
                 if(strlen(optarg) == 0)
@@ -576,6 +795,9 @@ handle_options(struct program_options *options, int *argcp, char ***argvp)
                 options->round_size = (fsize_t)round_size;
                 break;
             }
+            case 'H':
+                options->hardlinks = OPT_HARDLINKS;
+                break;
             case '?':
             default:
                 return (FPART_OPTS_USAGE | FPART_OPTS_NOK | FPART_OPTS_EXIT);
@@ -601,18 +823,47 @@ handle_options(struct program_options *options, int *argcp, char ***argvp)
         return (FPART_OPTS_USAGE | FPART_OPTS_NOK | FPART_OPTS_EXIT);
     }
 
+    /* option -M (needs '-n') */
+    if((options->max_memory != DFLT_OPT_MAX_MEMORY) &&
+        ((options->num_parts == DFLT_OPT_NUM_PARTS) ||
+        (options->hardlinks != DFLT_OPT_HARDLINKS))) {
+        fprintf(stderr,
+            "Option -M requires option -n and is incompatible with "
+            "option -H.\n");
+        return (FPART_OPTS_USAGE | FPART_OPTS_NOK | FPART_OPTS_EXIT);
+    }
+
+    /* option -B (file entries are not stored in live mode) */
+    if((options->spool != DFLT_OPT_SPOOL) &&
+        (options->live_mode != DFLT_OPT_LIVEMODE)) {
+        fprintf(stderr, "Option -B is incompatible with option -L.\n");
+        return (FPART_OPTS_USAGE | FPART_OPTS_NOK | FPART_OPTS_EXIT);
+    }
+
     if(options->arbitrary_values == OPT_ARBITRARYVALUES) {
         if((options->add_slash != DFLT_OPT_ADDSLASH) ||
             (options->follow_symbolic_links != DFLT_OPT_FOLLOWSYMLINKS) ||
             (options->cross_fs_boundaries != DFLT_OPT_CROSSFSBOUNDARIES) ||
+            (options->sync_attrs != DFLT_OPT_SYNCATTRS) ||
+            (options->trust_dtype != DFLT_OPT_TRUSTDTYPE) ||
+            (options->inode_order != DFLT_OPT_INODEORDER) ||
+            (options->cache_filename != NULL) ||
+            (options->crawl_threads != DFLT_OPT_CRAWL_THREADS) ||
+            (options->prefetch_threads != DFLT_OPT_PREFETCH_THREADS) ||
+            (options->fs_threads != NULL) ||
+            (options->max_ops != DFLT_OPT_MAX_OPS) ||
+            (options->io_class != DFLT_OPT_IOCLASS) ||
             (options->include_files != NULL) ||
             (options->include_files_ci != NULL) ||
             (options->exclude_files != NULL) ||
             (options->exclude_files_ci != NULL) ||
+            (options->include_from != NULL) ||
+            (options->exclude_from != NULL) ||
             (options->dirs_include != DFLT_OPT_DIRSINCLUDE) ||
             (options->dir_depth != DFLT_OPT_DIR_DEPTH) ||
             (options->leaf_dirs != DFLT_OPT_LEAFDIRS) ||
-            (options->dirs_only != DFLT_OPT_DIRSONLY)) {
+            (options->dirs_only != DFLT_OPT_DIRSONLY) ||
+            (options->hardlinks != DFLT_OPT_HARDLINKS)) {
             fprintf(stderr,
                 "Option -a is incompatible with crawling-related options.\n");
             return (FPART_OPTS_USAGE | FPART_OPTS_NOK | FPART_OPTS_EXIT);
@@ -685,6 +936,22 @@ handle_options(struct program_options *options, int *argcp, char ***argvp)
         snprintf(options->in_filename, malloc_size, "%s", opt_input);
     }
 
+    /* compile include and exclude lists */
+    if(((options->include_files != NULL) ||
+        (options->include_files_ci != NULL) ||
+        (options->exclude_files != NULL) ||
+        (options->exclude_files_ci != NULL) ||
+        (options->include_from != NULL) ||
+        (options->exclude_from != NULL)) &&
+        ((options->matcher = matcher_init(options)) == NULL))
+        return (FPART_OPTS_NOK | FPART_OPTS_EXIT);
+
+    /* set crawl throttle up */
+    if((options->max_ops != DFLT_OPT_MAX_OPS) &&
+        ((options->throttle = throttle_init((double)options->max_ops,
+            (double)options->max_latency / 1000)) == NULL))
+        return (FPART_OPTS_NOK | FPART_OPTS_EXIT);
+
     return (FPART_OPTS_OK);
 }
 
@@ -720,12 +987,26 @@ int main(int argc, char **argv)
             EXIT_FAILURE : EXIT_SUCCESS);
     }
 
+    /* set I/O priority, before any thread gets created */
+    if(throttle_ioprio(&options) != 0) {
+        uninit_options(&options);
+        exit(EXIT_FAILURE);
+    }
+
 /**************
   Handle stdin
 ***************/
 
-    /* our main double-linked file list */
-    struct file_entry *head = NULL;
+    /* our main file entries store */
+    struct file_entries *entries = NULL;
+
+    /* crawl cache */
+    struct cache *cachep = NULL;
+    if((options.cache_filename != NULL) &&
+        ((cachep = cache_open(options.cache_filename, &options)) == NULL)) {
+        uninit_options(&options);
+        exit(EXIT_FAILURE);
+    }
 
     if(options.verbose >= OPT_VERBOSE)
         fprintf(stderr, "Examining filesystem...\n");
@@ -744,6 +1025,8 @@ int main(int argc, char **argv)
             if((in_fp = fopen(options.in_filename, "r")) == NULL) {
                 fprintf(stderr, "%s: %s\n", options.in_filename,
                     strerror(errno));
+                if(cachep != NULL)
+                    cache_close(cachep, 0);
                 uninit_options(&options);
                 exit(EXIT_FAILURE);
             }
@@ -757,10 +1040,13 @@ int main(int argc, char **argv)
             if((line_end_p = strchr(line, '\n')) != NULL)
                 *line_end_p = '\0';
 
-            if(handle_argument(line, &head, &options, &main_status) != 0) {
+            if(handle_argument(line, &entries, cachep, &options,
+                &main_status) != 0) {
                 if(in_fp != stdin)
                     fclose(in_fp);
-                uninit_file_entries(head, &options, &main_status);
+                if(cachep != NULL)
+                    cache_close(cachep, 0);
+                uninit_file_entries(entries, &options, &main_status);
                 uninit_options(&options);
                 exit(EXIT_FAILURE);
             }
@@ -783,15 +1069,19 @@ int main(int argc, char **argv)
     /* now, work on each path provided as arguments */
     int i;
     for(i = 0 ; i < argc ; i++) {
-        if(handle_argument(argv[i], &head, &options, &main_status) != 0) {
-            uninit_file_entries(head, &options, &main_status);
+        if(handle_argument(argv[i], &entries, cachep, &options,
+            &main_status) != 0) {
+            if(cachep != NULL)
+                cache_close(cachep, 0);
+            uninit_file_entries(entries, &options, &main_status);
             uninit_options(&options);
             exit(EXIT_FAILURE);
         }
     }
 
-    /* come back to the first element */
-    rewind_list(head);
+    /* crawl complete, save cache (a failure only affects next run) */
+    if(cachep != NULL)
+        cache_close(cachep, 1);
 
 /****************
   Display status
@@ -799,7 +1089,7 @@ int main(int argc, char **argv)
 
     /* no file found or live mode */
     if((main_status.total_num_files == 0) || (options.live_mode == OPT_LIVEMODE)) {
-        uninit_file_entries(head, &options, &main_status);
+        uninit_file_entries(entries, &options, &main_status);
         /* display final summary */
         if(options.verbose >= OPT_VERBOSE)
             display_final_summary(main_status.total_num_parts,
@@ -820,23 +1110,74 @@ int main(int argc, char **argv)
     /* our list of partitions */
     struct partition *part_head = NULL;
 
+    /* sort spilled files (option -M) with a fixed number of partitions,
+       merging them from temporary files */
+    if((options.num_parts != DFLT_OPT_NUM_PARTS) && (entries->spillp != NULL)) {
+        if(options.num_parts - 1 > FE_PNUM_MAX) {
+            fprintf(stderr, "%s(): too many partitions\n", __func__);
+            uninit_file_entries(entries, &options, &main_status);
+            uninit_options(&options);
+            exit(EXIT_FAILURE);
+        }
+
+        /* spill remaining entries */
+        if(spill_file_entries(entries) != 0) {
+            fprintf(stderr, "%s(): unable to spill file entries\n",
+                __func__);
+            uninit_file_entries(entries, &options, &main_status);
+            uninit_options(&options);
+            exit(EXIT_FAILURE);
+        }
+
+        /* create a double_linked list of partitions
+           which will hold dispatched files */
+        if(add_partitions(&part_head, options.num_parts, &options, &main_status) != 0) {
+            fprintf(stderr, "%s(): cannot init list of partitions\n",
+                __func__);
+            uninit_partitions(part_head);
+            uninit_file_entries(entries, &options, &main_status);
+            uninit_options(&options);
+            exit(EXIT_FAILURE);
+        }
+        /* come back to the first element */
+        rewind_list(part_head);
+
+        /* dispatch files, including empty ones */
+        if(dispatch_spilled_file_entries
+            (entries, main_status.total_num_files, part_head, options.num_parts) != 0) {
+            fprintf(stderr, "%s(): unable to dispatch file entries\n",
+                __func__);
+            uninit_partitions(part_head);
+            uninit_file_entries(entries, &options, &main_status);
+            uninit_options(&options);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     /* sort files with a fixed number of partitions */
-    if(options.num_parts != DFLT_OPT_NUM_PARTS) {
-        /* create a fixed-size array of pointers to sort */
-        struct file_entry **file_entry_p = NULL;
+    else if(options.num_parts != DFLT_OPT_NUM_PARTS) {
+        /* create a fixed-size array of keys to sort */
+        struct file_entry_key *file_entry_keys = NULL;
 
-        if_not_malloc(file_entry_p, sizeof(struct file_entry *) * main_status.total_num_files,
-            uninit_file_entries(head, &options, &main_status);
+        if(options.num_parts - 1 > FE_PNUM_MAX) {
+            fprintf(stderr, "%s(): too many partitions\n", __func__);
+            uninit_file_entries(entries, &options, &main_status);
+            uninit_options(&options);
+            exit(EXIT_FAILURE);
+        }
+
+        if_not_malloc(file_entry_keys, sizeof(struct file_entry_key) * main_status.total_num_files,
+            uninit_file_entries(entries, &options, &main_status);
             uninit_options(&options);
             exit(EXIT_FAILURE);
         )
 
         /* initialize array */
-        init_file_entry_p(file_entry_p, main_status.total_num_files, head);
+        init_file_entry_keys(file_entry_keys, entries);
     
         /* sort array */
-        qsort(&file_entry_p[0], main_status.total_num_files, sizeof(struct file_entry *),
-            &sort_file_entry_p);
+        qsort(&file_entry_keys[0], main_status.total_num_files, sizeof(struct file_entry_key),
+            &sort_file_entry_keys);
     
         /* create a double_linked list of partitions
            which will hold dispatched files */
@@ -844,8 +1185,8 @@ int main(int argc, char **argv)
             fprintf(stderr, "%s(): cannot init list of partitions\n",
                 __func__);
             uninit_partitions(part_head);
-            free(file_entry_p);
-            uninit_file_entries(head, &options, &main_status);
+            free(file_entry_keys);
+            uninit_file_entries(entries, &options, &main_status);
             uninit_options(&options);
             exit(EXIT_FAILURE);
         }
@@ -853,31 +1194,43 @@ int main(int argc, char **argv)
         rewind_list(part_head);
     
         /* dispatch files */
-        if(dispatch_file_entry_p_by_size
-            (file_entry_p, main_status.total_num_files, part_head, options.num_parts) != 0) {
+        if(dispatch_file_entry_keys_by_size
+            (entries, file_entry_keys, main_status.total_num_files, part_head, options.num_parts) != 0) {
             fprintf(stderr, "%s(): unable to dispatch file entries\n",
                 __func__);
             uninit_partitions(part_head);
-            free(file_entry_p);
-            uninit_file_entries(head, &options, &main_status);
+            free(file_entry_keys);
+            uninit_file_entries(entries, &options, &main_status);
             uninit_options(&options);
             exit(EXIT_FAILURE);
         }
     
         /* re-dispatch empty files */
         if(dispatch_empty_file_entries
-            (head, main_status.total_num_files, part_head, options.num_parts) != 0) {
+            (entries, main_status.total_num_files, part_head, options.num_parts) != 0) {
             fprintf(stderr, "%s(): unable to dispatch empty file entries\n",
                 __func__);
             uninit_partitions(part_head);
-            free(file_entry_p);
-            uninit_file_entries(head, &options, &main_status);
+            free(file_entry_keys);
+            uninit_file_entries(entries, &options, &main_status);
+            uninit_options(&options);
+            exit(EXIT_FAILURE);
+        }
+
+        /* dispatch hardlinks along with their first link */
+        if((options.hardlinks == OPT_HARDLINKS) &&
+            (dispatch_link_file_entries
+                (entries, part_head, main_status.total_num_parts) != 0)) {
+            fprintf(stderr, "%s(): unable to dispatch hardlinks\n", __func__);
+            uninit_partitions(part_head);
+            free(file_entry_keys);
+            uninit_file_entries(entries, &options, &main_status);
             uninit_options(&options);
             exit(EXIT_FAILURE);
         }
 
         /* cleanup */
-        free(file_entry_p);
+        free(file_entry_keys);
     }
 
 /***************************************************
@@ -888,12 +1241,12 @@ int main(int argc, char **argv)
        In this case, partitions are dynamically-created */
     else {
         if(dispatch_file_entries_by_limits
-            (head, &part_head, options.max_entries, options.max_size,
+            (entries, &part_head, options.max_entries, options.max_size,
             &options, &main_status) == 0) {
             fprintf(stderr, "%s(): unable to dispatch file entries\n",
                 __func__);
             uninit_partitions(part_head);
-            uninit_file_entries(head, &options, &main_status);
+            uninit_file_entries(entries, &options, &main_status);
             uninit_options(&options);
             exit(EXIT_FAILURE);
         }
@@ -920,14 +1273,14 @@ int main(int argc, char **argv)
         fprintf(stderr, "Writing output lists...\n");
 
     /* print file entries */
-    print_file_entries(head, part_head, main_status.total_num_parts, &options);
+    print_file_entries(entries, part_head, main_status.total_num_parts, &options);
 
     if(options.verbose >= OPT_VERBOSE)
         fprintf(stderr, "Cleaning up...\n");
 
     /* free stuff */
     uninit_partitions(part_head);
-    uninit_file_entries(head, &options, &main_status);
+    uninit_file_entries(entries, &options, &main_status);
     uninit_options(&options);
     exit(EXIT_SUCCESS);
 }
@@ -39,10 +39,28 @@
  * GNU/Linux notes :
  *   - no support for FTS_WHITEOUT (sparse files)
  *   - the FTS_NOSTAT UFS-style links speedup trick is disabled
+ *   - directories are read using getdents64(2) and a large buffer
+ *     (FTS_GETDENTS_BUFSIZE bytes) instead of readdir(3)
+ *   - entries are stat()ed using statx(2) (when available) and a minimal
+ *     attribute mask, FTS_DONTSYNC adds AT_STATX_DONT_SYNC
+ *   - entries of large directories are stat()ed in batches through
+ *     io_uring(7) (when available, see fts_stat_batch())
  *   - should support fts_open_b() by defining WANT_BLOCKS (untested)
  * Darwin notes :
  *   - no support for FTS_NOSTAT_TYPE
  *   - should support fts_open_b() by defining WANT_BLOCKS (untested)
+ * All platforms notes :
+ *   - FTS_OPENAT option added : like FTS_NOCHDIR, but directories are
+ *     opened using openat(2) relative to their parent's descriptor, kept
+ *     open until their post-order visit (see fts_openat())
+ *   - FTS_INOORDER option added : stat(2) a directory's entries in inode
+ *     number order (see fts_stat_pending())
+ *   - FTS_STREAM option added : with FTS_NOCHDIR (or FTS_OPENAT) and no
+ *     comparison routine, read directories by batches of entries returned
+ *     as they come instead of reading them whole first (see fts_build())
+ *   - FTS_DIRSFIRST option added : return directories before other entries,
+ *     keeping their order, without needing a comparison routine (see
+ *     fts_partition())
  *
  */
 
@@ -80,6 +98,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#if defined(__linux__)
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#if defined(HAVE_LINUX_IO_URING_H)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+/* IORING_OP_STATX appeared with IORING_FEAT_RW_CUR_POS (Linux 5.6) */
+#if defined(STATX_TYPE) && defined(IORING_FEAT_RW_CUR_POS) && \
+    defined(SYS_io_uring_setup) && defined(SYS_io_uring_enter)
+#define	_FTS_HAS_URING
+#endif
+#endif
+#endif
 #if defined(__FreeBSD__)
 #include "/usr/src/lib/libc/include/un-namespace.h"
 #include "/usr/src/lib/libc/gen/gen-private.h"
@@ -150,14 +182,28 @@ extern void *_NSConcreteGlobalBlock[] __weak_symbol;
 
 static FTSENT	*fts_alloc(FTS *, char *, size_t);
 static FTSENT	*fts_build(FTS *, int);
-static void	 fts_lfree(FTSENT *);
+static void	 fts_free(FTS *, FTSENT *);
+static void	 fts_lfree(FTS *, FTSENT *);
 static void	 fts_load(FTS *, FTSENT *);
 static size_t	 fts_maxarglen(char * const *);
+static void	 fts_slabs_free(FTS *);
+struct fts_stream;
+static void	 fts_stream_end(FTS *, FTSENT *);
 static void	 fts_padjust(FTS *, FTSENT *);
 static int	 fts_palloc(FTS *, size_t);
 static FTSENT	*fts_sort(FTS *, FTSENT *, size_t);
+static FTSENT	*fts_partition(FTSENT *);
 static int	 fts_stat(FTS *, FTSENT *, int, int);
+static int	 fts_stat_info(FTSENT *, struct stat *);
+static void	 fts_stat_pending(FTS *, FTSENT *, int);
+#if defined(_FTS_HAS_URING)
+struct fts_uring;
+static void	 fts_stat_batch(FTS *, FTSENT **, size_t, int);
+static void	 fts_uring_free(struct fts_uring *);
+#endif
 static int	 fts_safe_changedir(FTS *, FTSENT *, int, char *);
+static int	 fts_openat(FTSENT *);
+static void	 fts_closeat(FTSENT *);
 #if !defined(__linux__)
 static int	 fts_ufslinks(FTS *, const FTSENT *);
 #endif
@@ -175,6 +221,25 @@ static int	 fts_ufslinks(FTS *, const FTSENT *);
 #define	BNAMES		2		/* fts_children, names only */
 #define	BREAD		3		/* fts_read */
 
+/*
+ * Entries are allocated from slabs of FTS_SLABSIZE bytes, by size class of
+ * their name (FTS_NCLASSES classes, from FTS_CLASSMIN bytes and doubling),
+ * and recycled through per-class free lists instead of being freed: a
+ * directory gets the entries released by previous ones, without going
+ * through malloc(3) again.  Slabs are only freed by fts_close().  Entries
+ * with longer names are plain allocations (FTS_NOSLAB).
+ */
+#define	FTS_NCLASSES	4
+#define	FTS_CLASSMIN	32
+#define	FTS_SLABSIZE	(64 * 1024)
+
+struct fts_slab {
+	struct fts_slab *fs_next;	/* next slab of stream */
+};
+
+/* alignment of slabs' contents */
+#define	FTS_SLABALIGN	MAX(alignof(FTSENT), alignof(struct stat))
+
 /*
  * Internal representation of an FTS, including extra implementation
  * details.  The FTS returned from fts_open points to this structure's
@@ -190,6 +255,78 @@ struct _fts_private {
 
 	dev_t		ftsp_dev;
 	int		ftsp_linksreliable;
+#if defined(__linux__)
+	char		*ftsp_dbuf;	/* getdents64(2) buffer */
+	int		ftsp_nostatx;	/* statx(2) not supported */
+#endif
+#if defined(_FTS_HAS_URING)
+	struct fts_uring *ftsp_uring;	/* batched statx(2) ring */
+	int		ftsp_nouring;	/* io_uring(7) not usable */
+#endif
+	FTSENT		*ftsp_free[FTS_NCLASSES]; /* recycled entries */
+	struct fts_slab	*ftsp_slabs;	/* entries storage */
+	struct fts_stream *ftsp_stream;	/* directories read by batches */
+};
+
+#if defined(__linux__)
+/*
+ * Directories are read using getdents64(2), through a buffer shared by all
+ * directories of a stream: that saves a lot of system calls compared to
+ * readdir(3) (and its small internal buffer) when reading large directories.
+ */
+#if !defined(FTS_GETDENTS_BUFSIZE)
+#define	FTS_GETDENTS_BUFSIZE	(1024 * 1024)
+#endif
+
+/* Record returned by getdents64(2) */
+struct fts_dirent {
+	uint64_t	d_ino;		/* inode number */
+	int64_t		d_off;		/* offset to next record */
+	unsigned short	d_reclen;	/* length of this record */
+	unsigned char	d_type;		/* file type */
+	char		d_name[];	/* file name (NUL-terminated) */
+};
+
+/* Directory stream */
+typedef struct {
+	int	dd_fd;			/* directory file descriptor */
+	char	*dd_buf;		/* getdents64(2) buffer */
+	size_t	dd_len;			/* valid data in buffer */
+	size_t	dd_loc;			/* current position in buffer */
+} FTS_DIR;
+
+#define	fts_dirfd(dirp)		((dirp)->dd_fd)
+#define	fts_closedir(dirp)	(ISSET(FTS_OPENAT) ? 0 : _close((dirp)->dd_fd))
+#else
+#define	fts_dirent		dirent
+typedef DIR FTS_DIR;
+
+#define	fts_dirfd(dirp)		_dirfd(dirp)
+#define	fts_closedir(dirp)	closedir(dirp)
+#endif /* defined(__linux__) */
+
+/*
+ * With FTS_STREAM, fts_build() returns at most FTS_STREAMBATCH entries at a
+ * time and leaves the directory open (FTS_STREAMING), fts_read() asking for
+ * the next ones when done with them: memory then depends on the batch size,
+ * not on the size of the directory.  Directories being read that way are the
+ * current one and its parents, their state is kept on a stack.  Entries are
+ * stat()ed (and sorted by inode number with FTS_INOORDER) batch by batch.
+ */
+#if !defined(FTS_STREAMBATCH)
+#define	FTS_STREAMBATCH	4096
+#endif
+
+struct fts_stream {
+	struct fts_stream *fs_next;	/* parent directory's state */
+	FTSENT		*fs_cur;	/* directory being read */
+	FTS_DIR		*fs_dirp;	/* its stream */
+#if defined(__linux__)
+	FTS_DIR		fs_dirs;	/* with its own getdents64(2) buffer */
+#endif
+	long		fs_nlinks;	/* fts_build() state */
+	int		fs_nostat;
+	int		fs_defer;
 };
 
 #if !defined(__linux__)
@@ -221,6 +358,10 @@ __fts_open(FTS *sp, char * const *argv)
 	if (ISSET(FTS_LOGICAL))
 		SET(FTS_NOCHDIR);
 
+	/* OPENAT walks never change directory either. */
+	if (ISSET(FTS_OPENAT))
+		SET(FTS_NOCHDIR);
+
 #if defined(FTS_NOSTAT_TYPE)
 	/* NOSTAT_TYPE implies NOSTAT */
 	if (ISSET(FTS_NOSTAT_TYPE))
@@ -277,6 +418,8 @@ __fts_open(FTS *sp, char * const *argv)
 	}
 	if (sp->fts_compar && nitems > 1)
 		root = fts_sort(sp, root, nitems);
+	else if (ISSET(FTS_DIRSFIRST) && nitems > 1)
+		root = fts_partition(root);
 
 	/*
 	 * Allocate a dummy pointer and make fts_read think that we've just
@@ -301,8 +444,9 @@ __fts_open(FTS *sp, char * const *argv)
 
 	return (sp);
 
-mem3:	fts_lfree(root);
-	free(parent);
+mem3:	fts_lfree(sp, root);
+	fts_free(sp, parent);
+	fts_slabs_free(sp);
 mem2:	free(sp->fts_path);
 mem1:	free(sp);
 	return (NULL);
@@ -431,6 +575,11 @@ fts_close(FTS *sp)
 	FTSENT *freep, *p;
 	int saved_errno;
 
+	/* Close directories left being read by batches. */
+	while (((struct _fts_private *)sp)->ftsp_stream != NULL)
+		fts_stream_end(sp,
+		    ((struct _fts_private *)sp)->ftsp_stream->fs_cur);
+
 	/*
 	 * This still works if we haven't read anything -- the dummy structure
 	 * points to the root list, so we step through to the end of the root
@@ -440,17 +589,25 @@ fts_close(FTS *sp)
 		for (p = sp->fts_cur; p->fts_level >= FTS_ROOTLEVEL;) {
 			freep = p;
 			p = p->fts_link != NULL ? p->fts_link : p->fts_parent;
-			free(freep);
+			fts_closeat(freep);
+			fts_free(sp, freep);
 		}
-		free(p);
+		fts_free(sp, p);
 	}
 
-	/* Free up child linked list, sort array, path buffer. */
+	/* Free up child linked list, entries, sort array, path buffer. */
 	if (sp->fts_child)
-		fts_lfree(sp->fts_child);
+		fts_lfree(sp, sp->fts_child);
+	fts_slabs_free(sp);
 	if (sp->fts_array)
 		free(sp->fts_array);
 	free(sp->fts_path);
+#if defined(__linux__)
+	free(((struct _fts_private *)sp)->ftsp_dbuf);
+#endif
+#if defined(_FTS_HAS_URING)
+	fts_uring_free(((struct _fts_private *)sp)->ftsp_uring);
+#endif
 
 #if defined(WANT_BLOCKS)
 	/* Free up any block pointer. */
@@ -513,7 +670,7 @@ fts_read(FTS *sp)
 
 	/* Any type of file may be re-visited; re-stat and re-turn. */
 	if (instr == FTS_AGAIN) {
-		p->fts_info = fts_stat(sp, p, 0, -1);
+		p->fts_info = fts_stat(sp, p, 0, p->fts_parent->fts_dirfd);
 		return (p);
 	}
 
@@ -525,7 +682,7 @@ fts_read(FTS *sp)
 	 */
 	if (instr == FTS_FOLLOW &&
 	    (p->fts_info == FTS_SL || p->fts_info == FTS_SLNONE)) {
-		p->fts_info = fts_stat(sp, p, 1, -1);
+		p->fts_info = fts_stat(sp, p, 1, p->fts_parent->fts_dirfd);
 		if (p->fts_info == FTS_D && !ISSET(FTS_NOCHDIR)) {
 			if ((p->fts_symfd = _open(".", O_RDONLY | O_CLOEXEC,
 			    0)) < 0) {
@@ -544,8 +701,9 @@ fts_read(FTS *sp)
 		    (ISSET(FTS_XDEV) && p->fts_dev != sp->fts_dev)) {
 			if (p->fts_flags & FTS_SYMFOLLOW)
 				(void)_close(p->fts_symfd);
+			fts_closeat(p);
 			if (sp->fts_child) {
-				fts_lfree(sp->fts_child);
+				fts_lfree(sp, sp->fts_child);
 				sp->fts_child = NULL;
 			}
 			p->fts_info = FTS_DP;
@@ -555,7 +713,7 @@ fts_read(FTS *sp)
 		/* Rebuild if only read the names and now traversing. */
 		if (sp->fts_child != NULL && ISSET(FTS_NAMEONLY)) {
 			CLR(FTS_NAMEONLY);
-			fts_lfree(sp->fts_child);
+			fts_lfree(sp, sp->fts_child);
 			sp->fts_child = NULL;
 		}
 
@@ -592,6 +750,14 @@ fts_read(FTS *sp)
 
 	/* Move to the next node on this level. */
 next:	tmp = p;
+	/* Read the next batch of a directory read by batches. */
+	if (p->fts_link == NULL &&
+	    (p->fts_parent->fts_flags & FTS_STREAMING)) {
+		sp->fts_cur = p->fts_parent;
+		p->fts_link = fts_build(sp, BREAD);
+		if (ISSET(FTS_STOP))
+			return (NULL);
+	}
 	if ((p = p->fts_link) != NULL) {
 		/*
 		 * If reached the top, return to the original directory (or
@@ -602,7 +768,7 @@ next:	tmp = p;
 				SET(FTS_STOP);
 				return (NULL);
 			}
-			free(tmp);
+			fts_free(sp, tmp);
 			fts_load(sp, p);
 			return (sp->fts_cur = p);
 		}
@@ -613,11 +779,12 @@ next:	tmp = p;
 		 * get back if necessary.
 		 */
 		if (p->fts_instr == FTS_SKIP) {
-			free(tmp);
+			fts_free(sp, tmp);
 			goto next;
 		}
 		if (p->fts_instr == FTS_FOLLOW) {
-			p->fts_info = fts_stat(sp, p, 1, -1);
+			p->fts_info = fts_stat(sp, p, 1,
+			    p->fts_parent->fts_dirfd);
 			if (p->fts_info == FTS_D && !ISSET(FTS_NOCHDIR)) {
 				if ((p->fts_symfd =
 				    _open(".", O_RDONLY | O_CLOEXEC, 0)) < 0) {
@@ -629,7 +796,7 @@ next:	tmp = p;
 			p->fts_instr = FTS_NOINSTR;
 		}
 
-		free(tmp);
+		fts_free(sp, tmp);
 
 name:		t = sp->fts_path + NAPPEND(p->fts_parent);
 		*t++ = '/';
@@ -645,8 +812,8 @@ name:		t = sp->fts_path + NAPPEND(p->fts_parent);
 		 * Done; free everything up and set errno to 0 so the user
 		 * can distinguish between error and EOF.
 		 */
-		free(tmp);
-		free(p);
+		fts_free(sp, tmp);
+		fts_free(sp, p);
 		errno = 0;
 		return (sp->fts_cur = NULL);
 	}
@@ -678,7 +845,8 @@ name:		t = sp->fts_path + NAPPEND(p->fts_parent);
 		SET(FTS_STOP);
 		return (NULL);
 	}
-	free(tmp);
+	fts_closeat(p);
+	fts_free(sp, tmp);
 	p->fts_info = p->fts_errno ? FTS_ERR : FTS_DP;
 	return (sp->fts_cur = p);
 }
@@ -740,7 +908,7 @@ fts_children(FTS *sp, int instr)
 
 	/* Free up any previous child list. */
 	if (sp->fts_child != NULL)
-		fts_lfree(sp->fts_child);
+		fts_lfree(sp, sp->fts_child);
 
 	if (instr == FTS_NAMEONLY) {
 		SET(FTS_NAMEONLY);
@@ -799,6 +967,125 @@ fts_set_clientptr(FTS *sp, void *clientptr)
 	sp->fts_clientptr = clientptr;
 }
 
+#define	FTS_DIROFLAGS	(O_RDONLY | O_NONBLOCK | O_DIRECTORY | O_CLOEXEC)
+
+#if !defined(FTS_OPENAT_MAXDEPTH)
+#define	FTS_OPENAT_MAXDEPTH	128
+#endif
+
+/*
+ * With FTS_OPENAT, directory p is opened relative to its parent's descriptor,
+ * which saves a full path lookup per directory and does not depend on the
+ * current working directory.  The descriptor is then kept in p until its
+ * post-order visit, for its own sub-directories to be opened (and its entries
+ * to be stat()ed) relative to it: directories from the root to the current
+ * one hold a descriptor each.
+ */
+static int
+fts_openat(FTSENT *p)
+{
+	FTSENT *t;
+	int pfd;
+
+	/* May have been opened by fts_children() already. */
+	fts_closeat(p);
+
+	if ((pfd = p->fts_parent->fts_dirfd) >= 0)
+		p->fts_dirfd = openat(pfd, p->fts_name, FTS_DIROFLAGS);
+	else
+		p->fts_dirfd = _open(p->fts_accpath, FTS_DIROFLAGS);
+
+	/*
+	 * Out of descriptors: release the ones held by the parents, their
+	 * remaining sub-directories will be opened using their path.
+	 */
+	if (p->fts_dirfd < 0 && (errno == EMFILE || errno == ENFILE)) {
+		for (t = p->fts_parent; t->fts_level >= FTS_ROOTLEVEL;
+		    t = t->fts_parent)
+			/* Directories read by batches still need theirs. */
+			if (!(t->fts_flags & FTS_STREAMING))
+				fts_closeat(t);
+		p->fts_dirfd = _open(p->fts_accpath, FTS_DIROFLAGS);
+	}
+	return (p->fts_dirfd);
+}
+
+static void
+fts_closeat(FTSENT *p)
+{
+	if (p->fts_dirfd >= 0) {
+		(void)_close(p->fts_dirfd);
+		p->fts_dirfd = -1;
+	}
+}
+
+#if defined(__linux__)
+static FTS_DIR *
+fts_opendir(FTS *sp, FTS_DIR *dirp, FTSENT *p)
+{
+	struct _fts_private *priv = (struct _fts_private *)sp;
+
+	if (priv->ftsp_dbuf == NULL &&
+	    (priv->ftsp_dbuf = malloc(FTS_GETDENTS_BUFSIZE)) == NULL)
+		return (NULL);
+	/* FTS_OPENAT descriptors are closed by fts_closeat(), not here */
+	if (ISSET(FTS_OPENAT))
+		dirp->dd_fd = fts_openat(p);
+	else
+		dirp->dd_fd = _open(p->fts_accpath, FTS_DIROFLAGS);
+	if (dirp->dd_fd < 0)
+		return (NULL);
+	dirp->dd_buf = priv->ftsp_dbuf;
+	dirp->dd_len = dirp->dd_loc = 0;
+	return (dirp);
+}
+
+static struct fts_dirent *
+fts_safe_readdir(FTS_DIR *dirp, int *readdir_errno)
+{
+	struct fts_dirent *ret;
+	long n;
+
+	*readdir_errno = 0;
+	if (!dirp)
+		return (NULL);
+	if (dirp->dd_loc >= dirp->dd_len) {
+		/* refill buffer, parsed in place below */
+		n = syscall(SYS_getdents64, dirp->dd_fd, dirp->dd_buf,
+		    FTS_GETDENTS_BUFSIZE);
+		if (n <= 0) {
+			if (n < 0)
+				*readdir_errno = errno;
+			return (NULL);
+		}
+		dirp->dd_len = (size_t)n;
+		dirp->dd_loc = 0;
+	}
+	ret = (struct fts_dirent *)(dirp->dd_buf + dirp->dd_loc);
+	dirp->dd_loc += ret->d_reclen;
+	return (ret);
+}
+#else
+static DIR *
+fts_opendirat(FTSENT *p)
+{
+	DIR *dirp;
+	int fd, saved_errno;
+
+	/* readdir(3) gets its own descriptor, released by closedir(3) */
+	if (fts_openat(p) < 0)
+		return (NULL);
+	if ((fd = dup(p->fts_dirfd)) < 0 || (dirp = fdopendir(fd)) == NULL) {
+		saved_errno = errno;
+		if (fd >= 0)
+			(void)_close(fd);
+		fts_closeat(p);
+		errno = saved_errno;
+		return (NULL);
+	}
+	return (dirp);
+}
+
 static struct dirent *
 fts_safe_readdir(DIR *dirp, int *readdir_errno)
 {
@@ -811,6 +1098,68 @@ fts_safe_readdir(DIR *dirp, int *readdir_errno)
 	*readdir_errno = errno;
 	return (ret);
 }
+#endif /* defined(__linux__) */
+
+/*
+ * Leave directory cur open after a batch of entries (see FTS_STREAM), its
+ * stream and fts_build() state being saved.  Returns 0 if it will be read
+ * by batches, else it has to be read whole.
+ */
+static int
+fts_stream_save(FTS *sp, FTSENT *cur, FTS_DIR **dirpp, long nlinks,
+    int nostat, int defer)
+{
+	struct _fts_private *priv = (struct _fts_private *)sp;
+	struct fts_stream *stream;
+
+	if (cur->fts_flags & FTS_STREAMING) {
+		/* Already saved, only update fts_build() state. */
+		stream = priv->ftsp_stream;
+		stream->fs_nlinks = nlinks;
+		stream->fs_nostat = nostat;
+		stream->fs_defer = defer;
+		return (0);
+	}
+	if ((stream = malloc(sizeof(struct fts_stream))) == NULL)
+		return (-1);
+	stream->fs_cur = cur;
+#if defined(__linux__)
+	/* Keep the shared buffer, another one will be allocated if needed. */
+	stream->fs_dirs = **dirpp;
+	*dirpp = &stream->fs_dirs;
+	if (priv->ftsp_dbuf == stream->fs_dirs.dd_buf)
+		priv->ftsp_dbuf = NULL;
+#endif
+	stream->fs_dirp = *dirpp;
+	stream->fs_nlinks = nlinks;
+	stream->fs_nostat = nostat;
+	stream->fs_defer = defer;
+	stream->fs_next = priv->ftsp_stream;
+	priv->ftsp_stream = stream;
+	cur->fts_flags |= FTS_STREAMING;
+	return (0);
+}
+
+/*
+ * Close directory cur, read by batches (the last one being read).
+ */
+static void
+fts_stream_end(FTS *sp, FTSENT *cur)
+{
+	struct _fts_private *priv = (struct _fts_private *)sp;
+	struct fts_stream *stream = priv->ftsp_stream;
+
+	(void)fts_closedir(stream->fs_dirp);
+#if defined(__linux__)
+	if (priv->ftsp_dbuf == NULL)
+		priv->ftsp_dbuf = stream->fs_dirs.dd_buf;
+	else
+		free(stream->fs_dirs.dd_buf);
+#endif
+	priv->ftsp_stream = stream->fs_next;
+	free(stream);
+	cur->fts_flags &= ~FTS_STREAMING;
+}
 
 /*
  * This is the tricky part -- do not casually change *anything* in here.  The
@@ -829,14 +1178,17 @@ fts_safe_readdir(DIR *dirp, int *readdir_errno)
 static FTSENT *
 fts_build(FTS *sp, int type)
 {
-	struct dirent *dp;
+	struct fts_dirent *dp;
 	FTSENT *p, *head;
 	FTSENT *cur, *tail;
-	DIR *dirp;
+	FTS_DIR *dirp;
+#if defined(__linux__)
+	FTS_DIR dirs;
+#endif
 	void *oldaddr;
-	char *cp;
 	int cderrno, descend, saved_errno, nostat, doadjust,
 		readdir_errno;
+	int defer, batch;
 #ifdef FTS_WHITEOUT
 	int oflag;
 #endif
@@ -847,6 +1199,16 @@ fts_build(FTS *sp, int type)
 	/* Set current node pointer. */
 	cur = sp->fts_cur;
 
+	/* Read the next batch of a directory read by batches. */
+	if (cur->fts_flags & FTS_STREAMING) {
+		dirp = ((struct _fts_private *)sp)->ftsp_stream->fs_dirp;
+		nlinks = ((struct _fts_private *)sp)->ftsp_stream->fs_nlinks;
+		nostat = ((struct _fts_private *)sp)->ftsp_stream->fs_nostat;
+		defer = ((struct _fts_private *)sp)->ftsp_stream->fs_defer;
+		cderrno = descend = 0;
+		goto batch;
+	}
+
 	/*
 	 * Open the directory for reading.  If this fails, we're done.
 	 * If being called from fts_read, set the fts_info field.
@@ -859,7 +1221,12 @@ fts_build(FTS *sp, int type)
 #else
 #define __opendir2(path, flag) opendir(path)
 #endif
-	if ((dirp = __opendir2(cur->fts_accpath, oflag)) == NULL) {
+#if defined(__linux__)
+	if ((dirp = fts_opendir(sp, &dirs, cur)) == NULL) {
+#else
+	if ((dirp = ISSET(FTS_OPENAT) ? fts_opendirat(cur) :
+	    __opendir2(cur->fts_accpath, oflag)) == NULL) {
+#endif
 		if (type == BREAD) {
 			cur->fts_info = FTS_DNR;
 			cur->fts_errno = errno;
@@ -911,7 +1278,7 @@ fts_build(FTS *sp, int type)
 	 */
 	cderrno = 0;
 	if (nlinks || type == BREAD) {
-		if (fts_safe_changedir(sp, cur, _dirfd(dirp), NULL)) {
+		if (fts_safe_changedir(sp, cur, fts_dirfd(dirp), NULL)) {
 			if (nlinks && type == BREAD)
 				cur->fts_errno = errno;
 			cur->fts_flags |= FTS_DONTCHDIR;
@@ -929,22 +1296,32 @@ fts_build(FTS *sp, int type)
 	 * could do them in fts_read before returning the path, but it's a
 	 * lot easier here since the length is part of the dirent structure.
 	 *
-	 * If not changing directories set a pointer so that can just append
-	 * each new name into the path.
+	 * If not changing directories, entries are stat()ed relative to the
+	 * directory's descriptor: their path is only built by fts_read.
 	 */
-	len = NAPPEND(cur);
-	if (ISSET(FTS_NOCHDIR)) {
-		cp = sp->fts_path + len;
-		*cp++ = '/';
-	} else {
-		/* GCC, you're too verbose. */
-		cp = NULL;
-	}
+	/*
+	 * Entries to stat are only marked while reading the directory, to be
+	 * stat()ed all at once afterwards (see fts_stat_pending()).
+	 */
+	defer = !cderrno && !ISSET(FTS_NOSTAT) && (ISSET(FTS_INOORDER)
+#if defined(_FTS_HAS_URING)
+	    || !((struct _fts_private *)sp)->ftsp_nouring
+#endif
+	    );
+
+batch:	len = NAPPEND(cur);
 	len++;
 	maxlen = sp->fts_pathlen - len;
 
 	level = cur->fts_level + 1;
 
+	/*
+	 * With FTS_STREAM, stop after FTS_STREAMBATCH entries, fts_read will
+	 * ask for the next ones.
+	 */
+	batch = type == BREAD && ISSET(FTS_STREAM) && ISSET(FTS_NOCHDIR) &&
+	    !sp->fts_compar && !ISSET(FTS_DIRSFIRST);
+
 	/* Read the directory, attaching each entry to the `link' pointer. */
 	doadjust = 0;
 	readdir_errno = 0;
@@ -970,20 +1347,20 @@ fts_build(FTS *sp, int type)
 				 */
 mem1:				saved_errno = errno;
 				if (p)
-					free(p);
-				fts_lfree(head);
-				(void)closedir(dirp);
+					fts_free(sp, p);
+				fts_lfree(sp, head);
+				if (cur->fts_flags & FTS_STREAMING)
+					fts_stream_end(sp, cur);
+				else
+					(void)fts_closedir(dirp);
 				cur->fts_info = FTS_ERR;
 				SET(FTS_STOP);
 				errno = saved_errno;
 				return (NULL);
 			}
 			/* Did realloc() change the pointer? */
-			if (oldaddr != sp->fts_path) {
+			if (oldaddr != sp->fts_path)
 				doadjust = 1;
-				if (ISSET(FTS_NOCHDIR))
-					cp = sp->fts_path + len;
-			}
 			maxlen = sp->fts_pathlen - len;
 		}
 
@@ -1000,6 +1377,9 @@ mem1:				saved_errno = errno;
 			if (nlinks) {
 				p->fts_info = FTS_NS;
 				p->fts_errno = cderrno;
+				if (p->fts_statp != NULL)
+					memset(p->fts_statp, 0,
+					    sizeof(struct stat));
 			} else
 				p->fts_info = FTS_NSOK;
 			p->fts_accpath = cur->fts_accpath;
@@ -1016,10 +1396,19 @@ mem1:				saved_errno = errno;
 			/* Build a file name for fts_stat to stat. */
 			if (ISSET(FTS_NOCHDIR)) {
 				p->fts_accpath = p->fts_path;
-				memmove(cp, p->fts_name, p->fts_namelen + 1);
-				p->fts_info = fts_stat(sp, p, 0, _dirfd(dirp));
+				if (defer) {
+					p->fts_flags |= FTS_STATPENDING;
+					p->fts_ino = dp->d_ino;
+					p->fts_info = FTS_NSOK;
+				} else
+				p->fts_info = fts_stat(sp, p, 0, fts_dirfd(dirp));
 			} else {
 				p->fts_accpath = p->fts_name;
+				if (defer) {
+					p->fts_flags |= FTS_STATPENDING;
+					p->fts_ino = dp->d_ino;
+					p->fts_info = FTS_NSOK;
+				} else
 				p->fts_info = fts_stat(sp, p, 0, -1);
 			}
 
@@ -1059,19 +1448,31 @@ mem1:				saved_errno = errno;
 			tail = p;
 		}
 		++nitems;
+
+		/* Leave the directory open for the next batch. */
+		if (batch && nitems >= FTS_STREAMBATCH &&
+		    fts_stream_save(sp, cur, &dirp, nlinks, nostat, defer) == 0)
+			break;
 	}
 
 	if (readdir_errno) {
 		cur->fts_errno = readdir_errno;
 		/*
 		 * If we've not read any items yet, treat
-		 * the error as if we can't access the dir.
+		 * the error as if we can't access the dir.  Previous batches
+		 * of a directory read by batches have already been returned.
 		 */
-		cur->fts_info = nitems ? FTS_ERR : FTS_DNR;
+		cur->fts_info = nitems || (cur->fts_flags & FTS_STREAMING) ?
+		    FTS_ERR : FTS_DNR;
 	}
 
-	if (dirp)
-		(void)closedir(dirp);
+	if (defer && nitems)
+		fts_stat_pending(sp, head, fts_dirfd(dirp));
+
+	if (dp == NULL && (cur->fts_flags & FTS_STREAMING))
+		fts_stream_end(sp, cur);
+	else if (dirp && !(cur->fts_flags & FTS_STREAMING))
+		(void)fts_closedir(dirp);
 
 	/*
 	 * If realloc() changed the address of the path, adjust the
@@ -1098,12 +1499,23 @@ mem1:				saved_errno = errno;
 	    (cur->fts_level == FTS_ROOTLEVEL ?
 	    FCHDIR(sp, sp->fts_rfd) :
 	    fts_safe_changedir(sp, cur->fts_parent, -1, ".."))) {
-		fts_lfree(head);
+		fts_lfree(sp, head);
 		cur->fts_info = FTS_ERR;
 		SET(FTS_STOP);
 		return (NULL);
 	}
 
+	/*
+	 * Release the directory's descriptor if it will not be used to open
+	 * sub-directories (no post-order visit through fts_read's moves to
+	 * the parent then).  Past FTS_OPENAT_MAXDEPTH, descriptors are not kept
+	 * either and sub-directories get opened using their path: that bounds
+	 * the number of descriptors held by deep walks.
+	 */
+	if (!(cur->fts_flags & FTS_STREAMING) &&
+	    (!nitems || cur->fts_level >= FTS_OPENAT_MAXDEPTH))
+		fts_closeat(cur);
+
 	/* If didn't find anything, return NULL. */
 	if (!nitems) {
 		if (type == BREAD &&
@@ -1115,15 +1527,368 @@ mem1:				saved_errno = errno;
 	/* Sort the entries. */
 	if (sp->fts_compar && nitems > 1)
 		head = fts_sort(sp, head, nitems);
+	else if (ISSET(FTS_DIRSFIRST) && nitems > 1)
+		head = fts_partition(head);
 	return (head);
 }
 
+#if defined(__linux__) && defined(STATX_TYPE)
+/*
+ * Only ask for attributes used by fts and its consumers: file type, size,
+ * inode (needed for cycle detection) and link count (to spot hardlinked
+ * files), device being always returned.  Network filesystems may then answer
+ * from cached attributes.
+ */
+#define	FTS_STATX_MASK	(STATX_TYPE | STATX_INO | STATX_NLINK | STATX_SIZE)
+
+static void
+fts_statx_copy(const struct statx *stx, struct stat *sbp)
+{
+	memset(sbp, 0, sizeof(struct stat));
+	sbp->st_mode = stx->stx_mode;
+	sbp->st_ino = stx->stx_ino;
+	sbp->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	sbp->st_nlink = stx->stx_nlink;
+	sbp->st_size = stx->stx_size;
+}
+
+static int
+fts_fstatat(FTS *sp, int dfd, const char *path, struct stat *sbp, int flag)
+{
+	struct _fts_private *priv = (struct _fts_private *)sp;
+	struct statx stx;
+
+	if (!priv->ftsp_nostatx) {
+		if (statx(dfd, path, flag |
+		    (ISSET(FTS_DONTSYNC) ? AT_STATX_DONT_SYNC : 0),
+		    FTS_STATX_MASK, &stx) == 0) {
+			fts_statx_copy(&stx, sbp);
+			return (0);
+		}
+		if (errno != ENOSYS)
+			return (-1);
+		/* Kernel too old, do not try again. */
+		priv->ftsp_nostatx = 1;
+	}
+	return (fstatat(dfd, path, sbp, flag));
+}
+#else
+#define	fts_fstatat(sp, dfd, path, sbp, flag)	fstatat(dfd, path, sbp, flag)
+#endif
+
+#if defined(_FTS_HAS_URING)
+/*
+ * When a directory holds many entries to stat, statx(2) requests are
+ * submitted to the kernel in batches through an io_uring(7) instance, set up
+ * using raw system calls: many requests are then kept in flight to the
+ * storage (or network) backend, without using threads.  If io_uring is not
+ * usable (old kernel, seccomp filter, ...), entries are stat()ed one by one.
+ */
+#if !defined(FTS_URING_ENTRIES)
+#define	FTS_URING_ENTRIES	256	/* maximum requests in flight */
+#endif
+#if !defined(FTS_URING_MINBATCH)
+#define	FTS_URING_MINBATCH	16	/* smaller batches are stat()ed
+					   synchronously */
+#endif
+
+struct fts_uring {
+	int		 fd;
+	unsigned	 entries;
+	void		*sq_ptr;
+	size_t		 sq_len;
+	void		*cq_ptr;
+	size_t		 cq_len;
+	struct io_uring_sqe *sqes;
+	size_t		 sqes_len;
+	unsigned	*sq_tail;
+	unsigned	*sq_mask;
+	unsigned	*sq_array;
+	unsigned	*cq_head;
+	unsigned	*cq_tail;
+	unsigned	*cq_mask;
+	struct io_uring_cqe *cqes;
+	FTSENT		**ents;		/* entries being stat()ed */
+	struct statx	*stx;		/* and their attributes */
+};
+
+static void
+fts_uring_free(struct fts_uring *ring)
+{
+
+	if (ring == NULL)
+		return;
+	if (ring->sqes != NULL)
+		(void)munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr)
+		(void)munmap(ring->cq_ptr, ring->cq_len);
+	if (ring->sq_ptr != NULL)
+		(void)munmap(ring->sq_ptr, ring->sq_len);
+	(void)_close(ring->fd);
+	free(ring->ents);
+	free(ring->stx);
+	free(ring);
+}
+
+static void *
+fts_uring_mmap(struct fts_uring *ring, size_t len, off_t offset)
+{
+	void *ptr;
+
+	ptr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, ring->fd, offset);
+	return (ptr == MAP_FAILED ? NULL : ptr);
+}
+
+/*
+ * Set up stream's ring the first time it is needed.
+ */
+static struct fts_uring *
+fts_uring_get(FTS *sp)
+{
+	struct _fts_private *priv = (struct _fts_private *)sp;
+	struct io_uring_params params;
+	struct fts_uring *ring;
+	char *sq, *cq;
+
+	if (priv->ftsp_nouring)
+		return (NULL);
+	if (priv->ftsp_uring != NULL)
+		return (priv->ftsp_uring);
+
+	if ((ring = calloc(1, sizeof(struct fts_uring))) == NULL)
+		goto err;
+	memset(&params, 0, sizeof(params));
+	if ((ring->fd = syscall(SYS_io_uring_setup, FTS_URING_ENTRIES,
+	    &params)) < 0) {
+		free(ring);
+		goto err;
+	}
+	ring->entries = params.sq_entries;
+	ring->sq_len = params.sq_off.array +
+	    params.sq_entries * sizeof(unsigned);
+	ring->cq_len = params.cq_off.cqes +
+	    params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_len > ring->sq_len)
+			ring->sq_len = ring->cq_len;
+		ring->cq_len = ring->sq_len;
+	}
+
+	if ((ring->sq_ptr = fts_uring_mmap(ring, ring->sq_len,
+	    IORING_OFF_SQ_RING)) == NULL)
+		goto err_ring;
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		ring->cq_ptr = ring->sq_ptr;
+	else if ((ring->cq_ptr = fts_uring_mmap(ring, ring->cq_len,
+	    IORING_OFF_CQ_RING)) == NULL)
+		goto err_ring;
+	if ((ring->sqes = fts_uring_mmap(ring, ring->sqes_len,
+	    IORING_OFF_SQES)) == NULL)
+		goto err_ring;
+
+	sq = ring->sq_ptr;
+	cq = ring->cq_ptr;
+	ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+	ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	if ((ring->ents = calloc(ring->entries, sizeof(FTSENT *))) == NULL ||
+	    (ring->stx = calloc(ring->entries, sizeof(struct statx))) == NULL)
+		goto err_ring;
+
+	priv->ftsp_uring = ring;
+	return (ring);
+
+err_ring:
+	fts_uring_free(ring);
+err:
+	priv->ftsp_nouring = 1;
+	return (NULL);
+}
+
+/*
+ * Handle a completed request.  Entries still marked as pending afterwards
+ * are left to fts_stat().
+ */
+static void
+fts_uring_done(FTS *sp, FTSENT *p, const struct statx *stx, int res)
+{
+
+	if (res == -EINVAL) {
+		/* IORING_OP_STATX not supported, do not try again. */
+		((struct _fts_private *)sp)->ftsp_nouring = 1;
+		return;
+	}
+	/* Let fts_stat() check for a symlink without target. */
+	if (res < 0 && ISSET(FTS_LOGICAL))
+		return;
+
+	p->fts_flags &= ~FTS_STATPENDING;
+	if (res < 0) {
+		p->fts_errno = -res;
+		memset(p->fts_statp, 0, sizeof(struct stat));
+		p->fts_info = FTS_NS;
+		return;
+	}
+	fts_statx_copy(stx, p->fts_statp);
+	p->fts_info = fts_stat_info(p, p->fts_statp);
+}
+
+/*
+ * Submit prepared requests and wait for all of them to complete.
+ */
+static int
+fts_uring_run(FTS *sp, struct fts_uring *ring, unsigned n)
+{
+	struct io_uring_cqe *cqe;
+	unsigned head, tail, submitted, completed;
+	int ret;
+
+	for (submitted = completed = 0; completed < n;) {
+		ret = syscall(SYS_io_uring_enter, ring->fd, n - submitted,
+		    n - completed, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0) {
+			if (errno == EINTR || errno == EAGAIN ||
+			    errno == EBUSY)
+				continue;
+			return (-1);
+		}
+		submitted += ret;
+
+		head = *ring->cq_head;
+		tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++, completed++) {
+			cqe = &ring->cqes[head & *ring->cq_mask];
+			fts_uring_done(sp, ring->ents[cqe->user_data],
+			    &ring->stx[cqe->user_data], cqe->res);
+		}
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+	return (0);
+}
+
+/*
+ * Stat the n pending entries of array ap, relatively to their directory's
+ * descriptor dfd.  Entries still marked as pending afterwards are left to
+ * fts_stat().
+ */
+static void
+fts_stat_batch(FTS *sp, FTSENT **ap, size_t n, int dfd)
+{
+	struct fts_uring *ring;
+	struct io_uring_sqe *sqe;
+	FTSENT *p;
+	size_t i;
+	unsigned k, tail, idx;
+	int flags;
+
+	if (n < FTS_URING_MINBATCH || (ring = fts_uring_get(sp)) == NULL)
+		return;
+
+	flags = (ISSET(FTS_LOGICAL) ? 0 : AT_SYMLINK_NOFOLLOW) |
+	    (ISSET(FTS_DONTSYNC) ? AT_STATX_DONT_SYNC : 0);
+	for (i = 0; i < n;) {
+		tail = *ring->sq_tail;
+		for (k = 0; i < n && k < ring->entries; i++) {
+			p = ap[i];
+			idx = tail & *ring->sq_mask;
+			sqe = &ring->sqes[idx];
+			memset(sqe, 0, sizeof(struct io_uring_sqe));
+			sqe->opcode = IORING_OP_STATX;
+			sqe->fd = dfd;
+			sqe->addr = (uintptr_t)p->fts_name;
+			sqe->len = FTS_STATX_MASK;
+			sqe->off = (uintptr_t)&ring->stx[k];
+			sqe->statx_flags = flags;
+			sqe->user_data = k;
+			ring->sq_array[idx] = idx;
+			ring->ents[k++] = p;
+			tail++;
+		}
+		__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+		if (fts_uring_run(sp, ring, k) != 0) {
+			((struct _fts_private *)sp)->ftsp_nouring = 1;
+			break;
+		}
+		if (((struct _fts_private *)sp)->ftsp_nouring)
+			break;
+	}
+}
+#endif /* defined(_FTS_HAS_URING) */
+
+static int
+fts_inocmp(const void *a, const void *b)
+{
+	const FTSENT *pa = *(FTSENT * const *)a, *pb = *(FTSENT * const *)b;
+
+	return (pa->fts_ino < pb->fts_ino ? -1 : pa->fts_ino > pb->fts_ino);
+}
+
+/*
+ * Stat entries marked as pending by fts_build(), relatively to their
+ * directory's descriptor dfd.  With FTS_INOORDER, they are stat()ed in order
+ * of the inode numbers returned by readdir(3): many filesystems store inodes
+ * in tables indexed by their number, so random seeks become mostly sequential
+ * reads.  Entries are still returned in directory (or fts_compar) order.
+ */
+static void
+fts_stat_pending(FTS *sp, FTSENT *head, int dfd)
+{
+	FTSENT **ap, *p;
+	size_t i, n;
+
+	for (n = 0, p = head; p != NULL; p = p->fts_link)
+		if (p->fts_flags & FTS_STATPENDING)
+			++n;
+	if (n == 0)
+		return;
+
+	/*
+	 * Use the sort array to hold pending entries.  If unable to allocate
+	 * it, stat entries in their current order.
+	 */
+	if (n > sp->fts_nitems) {
+		sp->fts_nitems = n + 40;
+		if ((sp->fts_array = reallocf(sp->fts_array,
+		    sp->fts_nitems * sizeof(FTSENT *))) == NULL) {
+			sp->fts_nitems = 0;
+			for (p = head; p != NULL; p = p->fts_link)
+				if (p->fts_flags & FTS_STATPENDING) {
+					p->fts_flags &= ~FTS_STATPENDING;
+					p->fts_info = fts_stat(sp, p, 0, dfd);
+				}
+			return;
+		}
+	}
+	for (ap = sp->fts_array, p = head; p != NULL; p = p->fts_link)
+		if (p->fts_flags & FTS_STATPENDING)
+			*ap++ = p;
+	ap = sp->fts_array;
+	if (ISSET(FTS_INOORDER) && n > 1)
+		qsort(ap, n, sizeof(FTSENT *), fts_inocmp);
+
+#if defined(_FTS_HAS_URING)
+	if (!((struct _fts_private *)sp)->ftsp_nouring)
+		fts_stat_batch(sp, ap, n, dfd);
+#endif
+
+	/* Synchronous path, for remaining entries. */
+	for (i = 0; i < n; i++)
+		if (ap[i]->fts_flags & FTS_STATPENDING) {
+			ap[i]->fts_flags &= ~FTS_STATPENDING;
+			ap[i]->fts_info = fts_stat(sp, ap[i], 0, dfd);
+		}
+}
+
 static int
 fts_stat(FTS *sp, FTSENT *p, int follow, int dfd)
 {
-	FTSENT *t;
-	dev_t dev;
-	ino_t ino;
 	struct stat *sbp, sb;
 	int ret, saved_errno;
 	const char *path;
@@ -1160,10 +1925,11 @@ fts_stat(FTS *sp, FTSENT *p, int follow, int dfd)
 	 * rather than FTS_COMFOLLOW), we also revert to lstat(2).
 	 */
 	if (ISSET(FTS_LOGICAL) || follow) {
-		if ((ret = fstatat(dfd, path, sbp, 0)) != 0 ||
+		if ((ret = fts_fstatat(sp, dfd, path, sbp, 0)) != 0 ||
 		    (follow < 0 && !S_ISDIR(sbp->st_mode))) {
 			saved_errno = errno;
-			if (fstatat(dfd, path, sbp, AT_SYMLINK_NOFOLLOW)) {
+			if (fts_fstatat(sp, dfd, path, sbp,
+			    AT_SYMLINK_NOFOLLOW)) {
 				p->fts_errno = saved_errno;
 				goto err;
 			}
@@ -1171,12 +1937,25 @@ fts_stat(FTS *sp, FTSENT *p, int follow, int dfd)
 			if (ret != 0 && S_ISLNK(sbp->st_mode))
 				return (FTS_SLNONE);
 		}
-	} else if (fstatat(dfd, path, sbp, AT_SYMLINK_NOFOLLOW)) {
+	} else if (fts_fstatat(sp, dfd, path, sbp, AT_SYMLINK_NOFOLLOW)) {
 		p->fts_errno = errno;
 err:		memset(sbp, 0, sizeof(struct stat));
 		return (FTS_NS);
 	}
 
+	return (fts_stat_info(p, sbp));
+}
+
+/*
+ * Get entry's fts_info from its stat(2) information.
+ */
+static int
+fts_stat_info(FTSENT *p, struct stat *sbp)
+{
+	FTSENT *t;
+	dev_t dev;
+	ino_t ino;
+
 	if (S_ISDIR(sbp->st_mode)) {
 		/*
 		 * Set the device/inode.  Used to find cycles and check for
@@ -1257,50 +2036,205 @@ fts_sort(FTS *sp, FTSENT *head, size_t nitems)
 	return (head);
 }
 
+/*
+ * Stable partition of a list of entries, directories first: a single pass
+ * instead of fts_sort() with a comparison routine.  Entries not stat()ed are
+ * not directories (with FTS_NOSTAT and FTS_NOSTAT_TYPE, d_type tells which
+ * entries must be stat()ed).
+ */
+static FTSENT *
+fts_partition(FTSENT *head)
+{
+	FTSENT *dhead, *dtail, *ohead, *otail, *p;
+
+	dhead = dtail = ohead = otail = NULL;
+	while ((p = head) != NULL) {
+		head = head->fts_link;
+		p->fts_link = NULL;
+		if (p->fts_info != FTS_NS && p->fts_info != FTS_NSOK &&
+		    S_ISDIR(p->fts_statp->st_mode)) {
+			if (dhead == NULL)
+				dhead = p;
+			else
+				dtail->fts_link = p;
+			dtail = p;
+		} else {
+			if (ohead == NULL)
+				ohead = p;
+			else
+				otail->fts_link = p;
+			otail = p;
+		}
+	}
+	if (dtail == NULL)
+		return (ohead);
+	dtail->fts_link = ohead;
+	return (dhead);
+}
+
+/*
+ * Size class of entries for a name length, FTS_NCLASSES if too long for any
+ * (entries of a class hold names of up to (FTS_CLASSMIN << class) - 1 bytes).
+ */
+static int
+fts_class(size_t namelen)
+{
+	int c;
+
+	for (c = 0; c < FTS_NCLASSES && ((size_t)FTS_CLASSMIN << c) <= namelen;
+	    c++)
+		;
+	return (c);
+}
+
+/*
+ * Size of an entry able to hold a name of up to namesize - 1 bytes, and a
+ * stat structure unless the user has set the nostat bit.  Return the offset
+ * of that stat structure in *statoff.
+ */
+static size_t
+fts_entsize(FTS *sp, size_t namesize, size_t *statoff)
+{
+	size_t len;
+
+	len = sizeof(FTSENT) + namesize;
+	if (ISSET(FTS_NOSTAT))
+		return (len);
+	len = roundup(len, alignof(struct stat));
+	*statoff = len;
+	return (len + sizeof(struct stat));
+}
+
+/*
+ * Add a slab to the free list of entries of class c.
+ */
+static int
+fts_slab_grow(FTS *sp, int c)
+{
+	struct _fts_private *priv = (struct _fts_private *)sp;
+	struct fts_slab *slab;
+	size_t hdrsize, entsize, statoff = 0;
+	char *ent, *end;
+
+	hdrsize = roundup(sizeof(struct fts_slab), FTS_SLABALIGN);
+	entsize = roundup(fts_entsize(sp, (size_t)FTS_CLASSMIN << c, &statoff),
+	    FTS_SLABALIGN);
+	if ((slab = malloc(FTS_SLABSIZE)) == NULL)
+		return (-1);
+	slab->fs_next = priv->ftsp_slabs;
+	priv->ftsp_slabs = slab;
+
+	end = (char *)slab + FTS_SLABSIZE;
+	for (ent = (char *)slab + hdrsize; ent + entsize <= end;
+	    ent += entsize) {
+		((FTSENT *)ent)->fts_link = priv->ftsp_free[c];
+		priv->ftsp_free[c] = (FTSENT *)ent;
+	}
+	return (0);
+}
+
+static void
+fts_slabs_free(FTS *sp)
+{
+	struct _fts_private *priv = (struct _fts_private *)sp;
+	struct fts_slab *slab;
+	int c;
+
+	while ((slab = priv->ftsp_slabs) != NULL) {
+		priv->ftsp_slabs = slab->fs_next;
+		free(slab);
+	}
+	for (c = 0; c < FTS_NCLASSES; c++)
+		priv->ftsp_free[c] = NULL;
+}
+
 static FTSENT *
 fts_alloc(FTS *sp, char *name, size_t namelen)
 {
+	struct _fts_private *priv = (struct _fts_private *)sp;
 	FTSENT *p;
-	size_t len;
+	size_t statoff = 0;
+	int c;
 
 	/*
 	 * The file name is a variable length array and no stat structure is
-	 * necessary if the user has set the nostat bit.  Allocate the FTSENT
-	 * structure, the file name and the stat structure in one chunk, but
-	 * be careful that the stat structure is reasonably aligned.
+	 * necessary if the user has set the nostat bit.  The FTSENT
+	 * structure, the file name and the stat structure are kept in one
+	 * chunk, taken from the free list of its class.  Neither the name
+	 * nor the stat structure are cleared: they are always filled before
+	 * being used.
 	 */
-	len = sizeof(FTSENT) + namelen + 1;
-	if (!ISSET(FTS_NOSTAT)) {
-		len = roundup(len, alignof(struct stat));
-		p = calloc(1, len + sizeof(struct stat));
+	c = fts_class(namelen);
+	if (c < FTS_NCLASSES) {
+		if (priv->ftsp_free[c] == NULL && fts_slab_grow(sp, c))
+			return (NULL);
+		p = priv->ftsp_free[c];
+		priv->ftsp_free[c] = p->fts_link;
+		(void)fts_entsize(sp, (size_t)FTS_CLASSMIN << c, &statoff);
+		p->fts_flags = 0;
 	} else {
-		p = calloc(1, len);
+		if ((p = malloc(fts_entsize(sp, namelen + 1, &statoff))) ==
+		    NULL)
+			return (NULL);
+		p->fts_flags = FTS_NOSLAB;
 	}
-	if (p == NULL)
-		return (NULL);
 
-	p->fts_symfd = -1;
+	p->fts_cycle = NULL;
+	p->fts_parent = NULL;
+	p->fts_link = NULL;
+	p->fts_number = 0;
+	p->fts_pointer = NULL;
+	p->fts_accpath = NULL;
 	p->fts_path = sp->fts_path;
-	p->fts_name = (char *)(p + 1);
+	p->fts_errno = 0;
+	p->fts_symfd = -1;
+	p->fts_dirfd = -1;
+	p->fts_pathlen = 0;
 	p->fts_namelen = namelen;
+	p->fts_ino = 0;
+	p->fts_dev = 0;
+	p->fts_nlink = 0;
+	p->fts_level = 0;
+	p->fts_info = 0;
 	p->fts_instr = FTS_NOINSTR;
-	if (!ISSET(FTS_NOSTAT))
-		p->fts_statp = (struct stat *)((char *)p + len);
+	p->fts_statp = ISSET(FTS_NOSTAT) ? NULL :
+	    (struct stat *)((char *)p + statoff);
+	p->fts_name = (char *)(p + 1);
 	p->fts_fts = sp;
 	memcpy(p->fts_name, name, namelen);
+	p->fts_name[namelen] = '\0';
 
 	return (p);
 }
 
+/*
+ * Release an entry to the free list of the class of its (current) name
+ * length: fts_load() may only shorten names, so its chunk is large enough.
+ */
 static void
-fts_lfree(FTSENT *head)
+fts_free(FTS *sp, FTSENT *p)
+{
+	struct _fts_private *priv = (struct _fts_private *)sp;
+	int c;
+
+	if (p->fts_flags & FTS_NOSLAB) {
+		free(p);
+		return;
+	}
+	c = fts_class(p->fts_namelen);
+	p->fts_link = priv->ftsp_free[c];
+	priv->ftsp_free[c] = p;
+}
+
+static void
+fts_lfree(FTS *sp, FTSENT *head)
 {
 	FTSENT *p;
 
 	/* Free a linked list of structures. */
 	while ((p = head)) {
 		head = head->fts_link;
-		free(p);
+		fts_free(sp, p);
 	}
 }
 
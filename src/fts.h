@@ -114,7 +114,14 @@ typedef struct {
 #if defined(__FreeBSD__) || defined(__linux__)
 #define FTS_NOSTAT_TYPE	0x000800	/* like NOSTAT but use d_type */
 #endif
-#define	FTS_OPTIONMASK	0x000cff	/* valid user option mask */
+#if defined(__linux__)
+#define	FTS_DONTSYNC	0x001000	/* do not sync attributes (statx(2)) */
+#endif
+#define	FTS_OPENAT	0x002000	/* like NOCHDIR but use openat(2) */
+#define	FTS_INOORDER	0x004000	/* stat(2) entries in inode order */
+#define	FTS_STREAM	0x008000	/* read directories by batches */
+#define	FTS_DIRSFIRST	0x040000	/* return directories first */
+#define	FTS_OPTIONMASK	0x04fcff	/* valid user option mask */
 
 /* valid only for fts_children() */
 #define	FTS_NAMEONLY	0x000100	/* child names only */
@@ -139,6 +146,7 @@ struct _ftsent {
 	char *fts_path;			/* root path */
 	int fts_errno;			/* errno for this node */
 	int fts_symfd;			/* fd for symlink */
+	int fts_dirfd;			/* fd for directory (FTS_OPENAT) */
 	__size_t fts_pathlen;		/* strlen(fts_path) */
 	__size_t fts_namelen;		/* strlen(fts_name) */
 
@@ -169,6 +177,9 @@ struct _ftsent {
 #define	FTS_DONTCHDIR	 0x01		/* don't chdir .. to the parent */
 #define	FTS_SYMFOLLOW	 0x02		/* followed a symlink to get here */
 #define	FTS_ISW		 0x04		/* this is a whiteout object */
+#define	FTS_STATPENDING	 0x08		/* stat(2) batched by fts_build */
+#define	FTS_NOSLAB	 0x10		/* not allocated from a slab */
+#define	FTS_STREAMING	 0x20		/* directory read by batches */
 	unsigned fts_flags;		/* private flags for FTSENT structure */
 
 #define	FTS_AGAIN	 1		/* read node again */
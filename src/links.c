@@ -0,0 +1,239 @@
+/*-
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2011-2026 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "types.h"
+#include "utils.h"
+#include "links.h"
+
+/* malloc(3), calloc(3), free(3) */
+#include <stdlib.h>
+
+/* fprintf(3) */
+#include <stdio.h>
+
+/* uint32_t, uint64_t */
+#include <stdint.h>
+
+/* assert(3) */
+#include <assert.h>
+
+/*
+ * Files having more than one link are recorded in an open-addressing hash
+ * table (linear probing), keyed by device and inode. Each (device, inode)
+ * pair gets a group number, in order of appearance, shared by all its links.
+ * As that table may have to hold hundreds of millions of inodes, slots are
+ * kept small: devices (few) are stored once and referenced by index and
+ * group numbers are 32-bit.
+ */
+
+/* A table slot */
+struct links_slot {
+    uint64_t ino;                   /* inode number */
+    uint32_t dev;                   /* device index + 1, 0 if slot unused */
+    uint32_t group;                 /* group number, starting at 1 */
+};
+
+struct links {
+    struct links_slot *slots;
+    uint64_t num_slots;             /* always a power of 2 */
+    uint64_t num_used;
+
+    dev_t *devs;                    /* devices seen so far */
+    uint32_t num_devs;
+    uint32_t last_dev;              /* index of last device looked up */
+
+    uint32_t num_groups;            /* groups created so far */
+};
+
+/* Hash an inode number and a device index */
+static uint64_t
+links_hash(uint64_t ino, uint32_t dev)
+{
+    uint64_t h = ino ^ ((uint64_t)dev << 56);
+
+    /* splitmix64 finalizer */
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return (h);
+}
+
+/* Get a device's index + 1, registering it if needed
+   - returns 0 if error */
+static uint32_t
+links_dev(struct links *linksp, dev_t dev)
+{
+    assert(linksp != NULL);
+
+    uint32_t i = 0;
+
+    if((linksp->num_devs > 0) && (linksp->devs[linksp->last_dev] == dev))
+        return (linksp->last_dev + 1);
+
+    for(i = 0; i < linksp->num_devs; i++) {
+        if(linksp->devs[i] == dev)
+            break;
+    }
+    if(i == linksp->num_devs) {
+        if(linksp->num_devs == UINT32_MAX - 1) {
+            fprintf(stderr, "%s(): too many devices\n", __func__);
+            return (0);
+        }
+        {
+            if_not_realloc(linksp->devs,
+                sizeof(dev_t) * (linksp->num_devs + 1),
+                return (0);
+            )
+        }
+        linksp->devs[linksp->num_devs++] = dev;
+    }
+    linksp->last_dev = i;
+    return (i + 1);
+}
+
+/* Double table size, re-inserting used slots
+   - returns 0 (success) or 1 (failure) */
+static int
+links_grow(struct links *linksp)
+{
+    assert(linksp != NULL);
+
+    struct links_slot *slots = NULL;
+    uint64_t num_slots = linksp->num_slots * 2;
+    uint64_t mask = num_slots - 1;
+    uint64_t i = 0;
+
+    if((slots = calloc(num_slots, sizeof(struct links_slot))) == NULL) {
+        fprintf(stderr, "%s(): cannot allocate memory\n", __func__);
+        return (1);
+    }
+
+    for(i = 0; i < linksp->num_slots; i++) {
+        struct links_slot *s = &linksp->slots[i];
+        uint64_t j = 0;
+
+        if(s->dev == 0)
+            continue;
+        j = links_hash(s->ino, s->dev) & mask;
+        while(slots[j].dev != 0)
+            j = (j + 1) & mask;
+        slots[j] = *s;
+    }
+
+    free(linksp->slots);
+    linksp->slots = slots;
+    linksp->num_slots = num_slots;
+    return (0);
+}
+
+/* Initialize a table of hardlinked files
+   - returns NULL if error */
+struct links *
+links_init(void)
+{
+    struct links *linksp = NULL;
+
+    if((linksp = calloc(1, sizeof(struct links))) == NULL) {
+        fprintf(stderr, "%s(): cannot allocate memory\n", __func__);
+        return (NULL);
+    }
+    if((linksp->slots =
+        calloc(LINKS_MIN_SLOTS, sizeof(struct links_slot))) == NULL) {
+        fprintf(stderr, "%s(): cannot allocate memory\n", __func__);
+        free(linksp);
+        return (NULL);
+    }
+    linksp->num_slots = LINKS_MIN_SLOTS;
+    return (linksp);
+}
+
+/* Look a file up, recording it if it has not been seen yet
+   - sets *group to the group number shared by all links to that file
+   - returns 1 if file has already been seen, 0 if it has just been recorded
+     or -1 if error */
+int
+links_get(struct links *linksp, dev_t dev, ino_t ino, fnum_t *group)
+{
+    assert(linksp != NULL);
+    assert(group != NULL);
+
+    uint32_t d = 0;
+    uint64_t mask = 0;
+    uint64_t i = 0;
+
+    if((d = links_dev(linksp, dev)) == 0)
+        return (-1);
+
+    mask = linksp->num_slots - 1;
+    i = links_hash((uint64_t)ino, d) & mask;
+    while(linksp->slots[i].dev != 0) {
+        if((linksp->slots[i].ino == (uint64_t)ino) &&
+            (linksp->slots[i].dev == d)) {
+            *group = linksp->slots[i].group;
+            return (1);
+        }
+        i = (i + 1) & mask;
+    }
+
+    if(linksp->num_groups == UINT32_MAX) {
+        fprintf(stderr, "%s(): too many hardlinked files\n", __func__);
+        return (-1);
+    }
+
+    /* keep load factor under 3/4 */
+    if((linksp->num_used + 1) > (linksp->num_slots / 4 * 3)) {
+        if(links_grow(linksp) != 0)
+            return (-1);
+        mask = linksp->num_slots - 1;
+        i = links_hash((uint64_t)ino, d) & mask;
+        while(linksp->slots[i].dev != 0)
+            i = (i + 1) & mask;
+    }
+
+    linksp->slots[i].ino = (uint64_t)ino;
+    linksp->slots[i].dev = d;
+    linksp->slots[i].group = ++linksp->num_groups;
+    linksp->num_used++;
+    *group = linksp->slots[i].group;
+    return (0);
+}
+
+/* Un-initialize a table of hardlinked files */
+void
+links_uninit(struct links *linksp)
+{
+    if(linksp == NULL)
+        return;
+
+    free(linksp->slots);
+    free(linksp->devs);
+    free(linksp);
+}
@@ -0,0 +1,1014 @@
+/*-
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2011-2026 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "types.h"
+#include "utils.h"
+#include "options.h"
+#include "match.h"
+
+/* malloc(3), calloc(3), realloc(3), free(3) */
+#include <stdlib.h>
+
+/* fprintf(3), fopen(3), getline(3), fclose(3) */
+#include <stdio.h>
+
+/* errno */
+#include <errno.h>
+
+/* strlen(3), strpbrk(3), memcmp(3), memcpy(3), memset(3), strerror(3) */
+#include <string.h>
+
+/* uint64_t */
+#include <stdint.h>
+
+/* tolower(3) */
+#include <ctype.h>
+
+/* fnmatch(3) */
+#include <fnmatch.h>
+
+/* assert(3) */
+#include <assert.h>
+
+/*
+ * Include and exclude patterns (options -y, -Y, -x and -X) are compiled once
+ * into a matcher, so that each entry is checked against all of them at once
+ * instead of calling fnmatch(3) once per pattern:
+ *
+ * - literal patterns ("name", "path/to/file") go into hash sets of exact
+ *   names and paths
+ * - "*suffix" and "prefix*" name patterns go into hash sets of suffixes and
+ *   prefixes, looked up once per distinct suffix or prefix length
+ * - remaining patterns are compiled into two non-deterministic automata
+ *   (one for names, one for paths), each pattern token being a state. All
+ *   patterns of an automaton are run together, using bit vectors
+ *   (shift-and)
+ * - patterns using constructs fnmatch(3) implementations may handle
+ *   differently (character classes, unterminated brackets, ...) are left to
+ *   fnmatch(3)
+ * - lines of list files (options -J and -K) are never patterns and go
+ *   straight into the case sensitive hash sets of exact names and paths, so
+ *   that lists of any size are looked up in constant time
+ *
+ * When all include patterns are paths, their leading literal components
+ * also tell which directories may lead to an included entry: other
+ * directories do not need to be crawled (see matcher_prune()).
+ *
+ * Matching must remain identical to fnmatch(3) with FNM_PERIOD (names) or
+ * FNM_PATHNAME | FNM_PERIOD (paths), and FNM_CASEFOLD for -Y and -X
+ * patterns. Case folding is done when compiling patterns. Character sets of
+ * bracket expressions are computed by fnmatch(3) itself.
+ */
+
+#define MATCH_SPECIALS      "*?[\\"
+
+/* Patterns containing a slash are matched against paths, others against
+   names */
+#define MATCH_NAME          0
+#define MATCH_PATH          1
+
+/* Hash set slots, by case sensitivity */
+#define MATCH_CS            0
+#define MATCH_CI            1
+
+/* A literal string of a hash set */
+struct match_lit {
+    char *str;                      /* NULL if slot is empty */
+    size_t len;
+    uint64_t hash;
+    int mask;                       /* MATCH_INCLUDE and/or MATCH_EXCLUDE */
+};
+
+/* A hash set of literal strings (open addressing) */
+struct match_set {
+    struct match_lit *slots;
+    size_t size;                    /* number of slots, a power of 2 */
+    size_t count;                   /* number of strings */
+    size_t *lens;                   /* distinct string lengths, ascending */
+    size_t nlens;
+    unsigned char fold;             /* case insensitive set */
+};
+
+/* A pattern token (automaton state) */
+struct match_token {
+    uint64_t set[4];                /* bytes matched (non-star tokens) */
+    unsigned char star;             /* '*' */
+    unsigned char dot;              /* literal '.', may match a leading
+                                       period (FNM_PERIOD) */
+};
+
+/* A compiled pattern, before being added to an automaton */
+struct match_pattern {
+    struct match_token *tokens;
+    size_t ntokens;
+    int mask;
+};
+
+/* Bit vectors of an automaton are kept on stack when matching, so they are
+   limited in size: more patterns get more automata */
+#define MATCH_NFA_WORDS     64
+#define MATCH_NFA_BITS      (MATCH_NFA_WORDS * 64)
+
+/* Patterns run together as a single automaton
+   - pattern k of n tokens uses bits [base, base + n] of each vector, bit
+     base + i meaning its first i tokens have been matched */
+struct match_nfa {
+    size_t nwords;                  /* size of bit vectors */
+    uint64_t *adv;                  /* per byte: bit i + 1 for each
+                                       non-star token i matching it */
+    uint64_t *stay;                 /* per byte: bit i for each star token i
+                                       matching it */
+    uint64_t *star;                 /* bit i for each star token i */
+    uint64_t *dot;                  /* bit i + 1 for each literal '.'
+                                       token i */
+    uint64_t *start;                /* initial states */
+    uint64_t *accept_include;       /* final states, include patterns */
+    uint64_t *accept_exclude;       /* final states, exclude patterns */
+    unsigned char pathname;         /* FNM_PATHNAME semantics */
+};
+
+/* A pattern left to fnmatch(3) */
+struct match_fallback {
+    const char *pattern;            /* points to options' lists */
+    int flags;
+    int mask;
+};
+
+/* A matcher */
+struct matcher {
+    struct match_set exact[2][2];   /* [MATCH_NAME|MATCH_PATH][MATCH_CS|CI] */
+    struct match_set suffix[2];     /* [MATCH_CS|MATCH_CI], names only */
+    struct match_set prefix[2];     /* [MATCH_CS|MATCH_CI], names only */
+    struct match_pattern *patterns[2];  /* compiled patterns, until built */
+    size_t npatterns[2];
+    struct match_nfa *nfas[2];      /* [MATCH_NAME|MATCH_PATH] */
+    size_t nnfas[2];
+    struct match_fallback *fallbacks;
+    size_t nfallbacks;
+    int mask[2];                    /* lists having patterns matched
+                                       against [MATCH_NAME|MATCH_PATH] */
+    struct match_set incdirs[2];    /* [MATCH_CS|MATCH_CI], directories
+                                       leading to include path patterns
+                                       (literal components only) */
+    struct match_set incopen[2];    /* [MATCH_CS|MATCH_CI], directories
+                                       whose whole subtree may contain
+                                       included entries */
+    unsigned char incall;           /* an include path pattern starts with
+                                       a non-literal component */
+    size_t incdepth;                /* max number of slashes of include
+                                       path patterns */
+};
+
+#define BIT_SET(v, i)       ((v)[(i) / 64] |= ((uint64_t)1 << ((i) % 64)))
+#define BYTE_SET(s, b)      ((s)[(b) / 64] |= ((uint64_t)1 << ((b) % 64)))
+#define BYTE_ISSET(s, b)    ((s)[(b) / 64] & ((uint64_t)1 << ((b) % 64)))
+
+/* Hash a string (FNV-1a), folding case if requested */
+static uint64_t
+match_hash(const char *str, size_t len, unsigned char fold)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i = 0;
+
+    for(i = 0; i < len; i++) {
+        hash ^= (unsigned char)(fold ? tolower((unsigned char)str[i]) :
+            str[i]);
+        hash *= 1099511628211ULL;
+    }
+    return (hash);
+}
+
+/* Compare two strings of len bytes, folding case if requested
+   - returns 1 if equal, else 0 */
+static int
+match_equal(const char *a, const char *b, size_t len, unsigned char fold)
+{
+    size_t i = 0;
+
+    if(!fold)
+        return (memcmp(a, b, len) == 0);
+    for(i = 0; i < len; i++)
+        if(tolower((unsigned char)a[i]) != tolower((unsigned char)b[i]))
+            return (0);
+    return (1);
+}
+
+/* Look a string up in a hash set
+   - returns its mask, or 0 if not found */
+static int
+match_set_lookup(const struct match_set *set, const char *str, size_t len)
+{
+    uint64_t hash = 0;
+    size_t i = 0;
+
+    if(set->count == 0)
+        return (0);
+
+    hash = match_hash(str, len, set->fold);
+    for(i = hash & (set->size - 1); set->slots[i].str != NULL;
+        i = (i + 1) & (set->size - 1)) {
+        if((set->slots[i].hash == hash) && (set->slots[i].len == len) &&
+            match_equal(set->slots[i].str, str, len, set->fold))
+            return (set->slots[i].mask);
+    }
+    return (0);
+}
+
+/* Insert a literal into a hash set of size slots (enough room left) */
+static void
+match_set_insert(struct match_lit *slots, size_t size,
+    const struct match_lit *lit)
+{
+    size_t i = 0;
+
+    i = lit->hash & (size - 1);
+    while(slots[i].str != NULL)
+        i = (i + 1) & (size - 1);
+    slots[i] = *lit;
+}
+
+/* Add a string to a hash set (or update its mask)
+   - returns != 0 if error */
+static int
+match_set_add(struct match_set *set, const char *str, size_t len, int mask)
+{
+    struct match_lit lit;
+    size_t i = 0;
+
+    /* already known */
+    lit.hash = match_hash(str, len, set->fold);
+    if(set->count > 0) {
+        for(i = lit.hash & (set->size - 1); set->slots[i].str != NULL;
+            i = (i + 1) & (set->size - 1)) {
+            if((set->slots[i].hash == lit.hash) &&
+                (set->slots[i].len == len) &&
+                match_equal(set->slots[i].str, str, len, set->fold)) {
+                set->slots[i].mask |= mask;
+                return (0);
+            }
+        }
+    }
+
+    /* keep load factor under 1/2 */
+    if((set->count + 1) * 2 > set->size) {
+        struct match_lit *slots = NULL;
+        size_t size = (set->size > 0) ? set->size * 2 : 16;
+
+        if((slots = calloc(size, sizeof(struct match_lit))) == NULL) {
+            fprintf(stderr, "%s(): cannot allocate memory\n", __func__);
+            return (1);
+        }
+        for(i = 0; i < set->size; i++)
+            if(set->slots[i].str != NULL)
+                match_set_insert(slots, size, &set->slots[i]);
+        free(set->slots);
+        set->slots = slots;
+        set->size = size;
+    }
+
+    /* record length */
+    for(i = 0; (i < set->nlens) && (set->lens[i] < len); i++);
+    if((i == set->nlens) || (set->lens[i] != len)) {
+        {
+            if_not_realloc(set->lens, (set->nlens + 1) * sizeof(size_t),
+                return (1);
+            )
+        }
+        memmove(&set->lens[i + 1], &set->lens[i],
+            (set->nlens - i) * sizeof(size_t));
+        set->lens[i] = len;
+        set->nlens++;
+    }
+
+    if_not_malloc(lit.str, len + 1,
+        return (1);
+    )
+    memcpy(lit.str, str, len);
+    lit.str[len] = '\0';
+    lit.len = len;
+    lit.mask = mask;
+    match_set_insert(set->slots, set->size, &lit);
+    set->count++;
+    return (0);
+}
+
+/* Free a hash set */
+static void
+match_set_uninit(struct match_set *set)
+{
+    size_t i = 0;
+
+    for(i = 0; i < set->size; i++)
+        free(set->slots[i].str);
+    free(set->slots);
+    free(set->lens);
+}
+
+/* Compute the set of bytes matched by a single-character pattern (a
+   literal or a bracket expression), using fnmatch(3) itself
+   - leading periods are handled by the automaton, so FNM_PERIOD is
+     ignored */
+static void
+match_token_set(struct match_token *token, const char *pattern, int flags)
+{
+    char str[2] = { '\0', '\0' };
+    int b = 0;
+
+    memset(token->set, 0, sizeof(token->set));
+    for(b = 1; b < 256; b++) {
+        str[0] = (char)b;
+        if(fnmatch(pattern, str, flags & ~FNM_PERIOD) == 0)
+            BYTE_SET(token->set, b);
+    }
+}
+
+/* Compile a pattern into tokens
+   - returns 1 if compiled, 0 if pattern must be left to fnmatch(3) or -1 if
+     error */
+static int
+match_compile(struct match_pattern *mp, const char *pattern, int flags)
+{
+    struct match_token *token = NULL;
+    size_t len = strlen(pattern);
+    char *sub = NULL;               /* single-character sub-pattern */
+    size_t i = 0, j = 0;
+    int b = 0;
+
+    /* tokens never outnumber characters, sub-patterns never exceed pattern */
+    if((mp->tokens = calloc(len + 1, sizeof(struct match_token))) == NULL) {
+        fprintf(stderr, "%s(): cannot allocate memory\n", __func__);
+        return (-1);
+    }
+    if_not_malloc(sub, len + 1,
+        free(mp->tokens);
+        return (-1);
+    )
+    mp->ntokens = 0;
+
+    while(pattern[i] != '\0') {
+        token = &mp->tokens[mp->ntokens];
+        switch(pattern[i]) {
+            case '*':
+                /* consecutive stars are equivalent to a single one */
+                if((mp->ntokens == 0) || !mp->tokens[mp->ntokens - 1].star) {
+                    token->star = 1;
+                    mp->ntokens++;
+                }
+                i++;
+                continue;
+            case '?':
+                /* glibc's fnmatch(3) does not apply FNM_PERIOD as
+                   expected after "*?" */
+                if((mp->ntokens > 0) && mp->tokens[mp->ntokens - 1].star)
+                    goto fallback;
+                for(b = 1; b < 256; b++)
+                    if((b != '/') || !(flags & FNM_PATHNAME))
+                        BYTE_SET(token->set, b);
+                i++;
+                break;
+            case '[':
+                /* find end of bracket expression */
+                j = i + 1;
+                if((pattern[j] == '!') || (pattern[j] == '^'))
+                    j++;
+                if(pattern[j] == ']')
+                    j++;
+                for(;;) {
+                    if((pattern[j] == '\0') ||
+                        ((pattern[j] == '\\') && (pattern[j + 1] == '\0')) ||
+                        ((pattern[j] == '[') && ((pattern[j + 1] == ':') ||
+                            (pattern[j + 1] == '=') ||
+                            (pattern[j + 1] == '.'))) ||
+                        ((pattern[j] == '/') && (flags & FNM_PATHNAME)))
+                        goto fallback;
+                    if(pattern[j] == ']')
+                        break;
+                    j += (pattern[j] == '\\') ? 2 : 1;
+                }
+                memcpy(sub, &pattern[i], j - i + 1);
+                sub[j - i + 1] = '\0';
+                match_token_set(token, sub, flags);
+                if((token->set[0] | token->set[1] | token->set[2] |
+                    token->set[3]) == 0)
+                    goto fallback;
+                i = j + 1;
+                break;
+            case '\\':
+                /* neither does it (nor FNM_PATHNAME) after an escaped
+                   slash */
+                if((pattern[i + 1] == '\0') || (pattern[i + 1] == '/'))
+                    goto fallback;
+                i++;
+                /* FALLTHROUGH */
+            default:
+                if(flags & FNM_CASEFOLD) {
+                    for(b = 1; b < 256; b++)
+                        if(tolower(b) == tolower((unsigned char)pattern[i]))
+                            BYTE_SET(token->set, b);
+                }
+                else
+                    BYTE_SET(token->set, (unsigned char)pattern[i]);
+                token->dot = (pattern[i] == '.');
+                i++;
+                break;
+        }
+        mp->ntokens++;
+    }
+    /* a pattern must fit into an automaton */
+    if(mp->ntokens + 1 > MATCH_NFA_BITS)
+        goto fallback;
+    free(sub);
+    return (1);
+
+fallback:
+    free(sub);
+    free(mp->tokens);
+    mp->tokens = NULL;
+    return (0);
+}
+
+/* Build an automaton from compiled patterns
+   - patterns are freed
+   - returns != 0 if error */
+static int
+match_nfa_build(struct match_nfa *nfa, struct match_pattern *patterns,
+    size_t npatterns, unsigned char pathname)
+{
+    struct match_pattern *mp = NULL;
+    size_t nbits = 0;
+    size_t base = 0;
+    size_t i = 0, k = 0;
+    int b = 0;
+
+    for(k = 0; k < npatterns; k++)
+        nbits += patterns[k].ntokens + 1;
+    nfa->nwords = (nbits + 63) / 64;
+    nfa->pathname = pathname;
+    assert(nfa->nwords <= MATCH_NFA_WORDS);
+
+    /* per-byte tables, then single vectors */
+    if(((nfa->adv = calloc(256 * nfa->nwords, sizeof(uint64_t))) == NULL) ||
+        ((nfa->stay = calloc(256 * nfa->nwords, sizeof(uint64_t))) == NULL) ||
+        ((nfa->star = calloc(5 * nfa->nwords, sizeof(uint64_t))) == NULL)) {
+        fprintf(stderr, "%s(): cannot allocate memory\n", __func__);
+        return (1);
+    }
+    nfa->dot = nfa->star + nfa->nwords;
+    nfa->start = nfa->dot + nfa->nwords;
+    nfa->accept_include = nfa->start + nfa->nwords;
+    nfa->accept_exclude = nfa->accept_include + nfa->nwords;
+
+    for(k = 0; k < npatterns; k++) {
+        mp = &patterns[k];
+        BIT_SET(nfa->start, base);
+        for(i = 0; i < mp->ntokens; i++) {
+            const struct match_token *token = &mp->tokens[i];
+
+            if(token->star) {
+                BIT_SET(nfa->star, base + i);
+                for(b = 1; b < 256; b++)
+                    if((b != '/') || !pathname)
+                        BIT_SET(&nfa->stay[b * nfa->nwords], base + i);
+                continue;
+            }
+            for(b = 1; b < 256; b++)
+                if(BYTE_ISSET(token->set, b))
+                    BIT_SET(&nfa->adv[b * nfa->nwords], base + i + 1);
+            if(token->dot)
+                BIT_SET(nfa->dot, base + i + 1);
+        }
+        if(mp->mask & MATCH_INCLUDE)
+            BIT_SET(nfa->accept_include, base + mp->ntokens);
+        if(mp->mask & MATCH_EXCLUDE)
+            BIT_SET(nfa->accept_exclude, base + mp->ntokens);
+        base += mp->ntokens + 1;
+
+        free(mp->tokens);
+        mp->tokens = NULL;
+    }
+    return (0);
+}
+
+/* Build automata of a kind of patterns (MATCH_NAME or MATCH_PATH), as few as
+   possible
+   - returns != 0 if error */
+static int
+match_nfas_build(struct matcher *matcherp, int kind)
+{
+    struct match_pattern *patterns = matcherp->patterns[kind];
+    size_t npatterns = matcherp->npatterns[kind];
+    size_t first = 0, k = 0;
+    size_t nbits = 0;
+
+    for(k = 0; k <= npatterns; k++) {
+        /* current automaton full (or last pattern reached) */
+        if((k == npatterns) ||
+            (nbits + patterns[k].ntokens + 1 > MATCH_NFA_BITS)) {
+            if(k == first)
+                break;
+            {
+                if_not_realloc(matcherp->nfas[kind],
+                    (matcherp->nnfas[kind] + 1) * sizeof(struct match_nfa),
+                    return (1);
+                )
+            }
+            memset(&matcherp->nfas[kind][matcherp->nnfas[kind]], 0,
+                sizeof(struct match_nfa));
+            matcherp->nnfas[kind]++;
+            if(match_nfa_build(&matcherp->nfas[kind][matcherp->nnfas[kind] - 1],
+                &patterns[first], k - first, (kind == MATCH_PATH)) != 0)
+                return (1);
+            first = k;
+            nbits = 0;
+        }
+        if(k < npatterns)
+            nbits += patterns[k].ntokens + 1;
+    }
+    return (0);
+}
+
+/* Free an automaton */
+static void
+match_nfa_uninit(struct match_nfa *nfa)
+{
+    free(nfa->adv);
+    free(nfa->stay);
+    free(nfa->star);
+}
+
+/* Run an automaton on a string
+   - returns MATCH_INCLUDE and/or MATCH_EXCLUDE if matching patterns from
+     those lists, else 0 */
+static int
+match_nfa_run(const struct match_nfa *nfa, const char *str, size_t len)
+{
+    uint64_t raw[MATCH_NFA_WORDS];  /* states reached by last byte */
+    uint64_t cur[MATCH_NFA_WORDS];  /* same, plus states reached by
+                                       skipping stars */
+    const uint64_t *adv = NULL;
+    const uint64_t *stay = NULL;
+    size_t nwords = nfa->nwords;
+    unsigned char period = 1;       /* at a leading period position */
+    uint64_t carry = 0, any = 0, w = 0;
+    size_t i = 0, n = 0;
+    int result = 0;
+
+    /* initial states */
+    carry = 0;
+    for(n = 0; n < nwords; n++) {
+        raw[n] = nfa->start[n];
+        w = raw[n] & nfa->star[n];
+        cur[n] = raw[n] | (w << 1) | carry;
+        carry = w >> 63;
+    }
+
+    for(i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)str[i];
+
+        adv = &nfa->adv[c * nwords];
+        stay = &nfa->stay[c * nwords];
+        any = 0;
+        carry = 0;
+        if(period && (c == '.')) {
+            /* a leading period must be matched by a literal period, not
+               reached by skipping a star at that position */
+            for(n = 0; n < nwords; n++) {
+                w = raw[n];
+                raw[n] = ((w << 1) | carry) & adv[n] & nfa->dot[n];
+                carry = w >> 63;
+            }
+        }
+        else {
+            for(n = 0; n < nwords; n++) {
+                w = cur[n];
+                raw[n] = (((w << 1) | carry) & adv[n]) | (w & stay[n]);
+                carry = w >> 63;
+            }
+        }
+        carry = 0;
+        for(n = 0; n < nwords; n++) {
+            w = raw[n] & nfa->star[n];
+            cur[n] = raw[n] | (w << 1) | carry;
+            carry = w >> 63;
+            any |= cur[n];
+        }
+        if(any == 0)
+            return (0);
+        period = nfa->pathname && (c == '/');
+    }
+
+    for(n = 0; n < nwords; n++) {
+        if(cur[n] & nfa->accept_include[n])
+            result |= MATCH_INCLUDE;
+        if(cur[n] & nfa->accept_exclude[n])
+            result |= MATCH_EXCLUDE;
+    }
+    return (result);
+}
+
+/* Record directories that may contain entries matching an include path
+   pattern (see matcher_prune())
+   - pattern components (but the last one) are literal until one contains a
+     special character: directories made of those literal components lead to
+     matching entries, and the subtree of the last one may contain some
+   - patterns using FNM_PATHNAME never match more slashes than they contain,
+     bounding the depth of matching entries
+   - returns 0 on success */
+static int
+match_prefixes_add(struct matcher *matcherp, const char *pattern, size_t len,
+    int ci)
+{
+    size_t slashes = 0;
+    size_t start = 0;                   /* current component start */
+    unsigned char special = 0;          /* current component is not literal */
+    unsigned char literal = 1;          /* previous components are */
+    size_t i = 0;
+
+    for(i = 0; i < len; i++) {
+        if(pattern[i] != '/') {
+            if(strchr(MATCH_SPECIALS, pattern[i]) != NULL)
+                special = 1;
+            continue;
+        }
+        slashes++;
+        if(literal && special) {
+            /* subtree of previous components may contain entries */
+            literal = 0;
+            if(start == 0)
+                matcherp->incall = 1;
+            else if(match_set_add(&matcherp->incopen[ci], pattern,
+                start - 1, MATCH_INCLUDE) != 0)
+                return (1);
+        }
+        /* directory leading to matching entries */
+        else if(literal && (match_set_add(&matcherp->incdirs[ci], pattern, i,
+            MATCH_INCLUDE) != 0))
+            return (1);
+        start = i + 1;
+        special = 0;
+    }
+
+    if(slashes > matcherp->incdepth)
+        matcherp->incdepth = slashes;
+    return (0);
+}
+
+/* Add a pattern to a matcher
+   - returns != 0 if error */
+static int
+match_add(struct matcher *matcherp, const char *pattern, int ci, int mask)
+{
+    int kind = (strchr(pattern, '/') != NULL) ? MATCH_PATH : MATCH_NAME;
+    int flags = FNM_PERIOD | ((kind == MATCH_PATH) ? FNM_PATHNAME : 0) |
+        (ci ? FNM_CASEFOLD : 0);
+    size_t len = strlen(pattern);
+    const char *special = strpbrk(pattern, MATCH_SPECIALS);
+    struct match_pattern mp;
+    int ret = 0;
+
+    matcherp->mask[kind] |= mask;
+    if((kind == MATCH_PATH) && (mask & MATCH_INCLUDE) &&
+        (match_prefixes_add(matcherp, pattern, len, ci) != 0))
+        return (1);
+
+    /* "literal" */
+    if(special == NULL)
+        return (match_set_add(&matcherp->exact[kind][ci], pattern, len,
+            mask));
+    if(kind == MATCH_NAME) {
+        /* "*suffix" */
+        if((special == pattern) && (pattern[0] == '*') && (len > 1) &&
+            (strpbrk(pattern + 1, MATCH_SPECIALS) == NULL))
+            return (match_set_add(&matcherp->suffix[ci], pattern + 1,
+                len - 1, mask));
+        /* "prefix*" */
+        if((special == &pattern[len - 1]) && (pattern[len - 1] == '*') &&
+            (len > 1))
+            return (match_set_add(&matcherp->prefix[ci], pattern, len - 1,
+                mask));
+    }
+
+    /* others */
+    mp.mask = mask;
+    if((ret = match_compile(&mp, pattern, flags)) < 0)
+        return (1);
+    if(ret > 0) {
+        {
+            if_not_realloc(matcherp->patterns[kind],
+                (matcherp->npatterns[kind] + 1) *
+                sizeof(struct match_pattern),
+                free(mp.tokens);
+                return (1);
+            )
+        }
+        matcherp->patterns[kind][matcherp->npatterns[kind]++] = mp;
+        return (0);
+    }
+
+    /* left to fnmatch(3) */
+    {
+        if_not_realloc(matcherp->fallbacks,
+            (matcherp->nfallbacks + 1) * sizeof(struct match_fallback),
+            return (1);
+        )
+    }
+    matcherp->fallbacks[matcherp->nfallbacks].pattern = pattern;
+    matcherp->fallbacks[matcherp->nfallbacks].flags = flags;
+    matcherp->fallbacks[matcherp->nfallbacks].mask = mask;
+    matcherp->nfallbacks++;
+    return (0);
+}
+
+/* Load a list file (one literal name or path per line) into exact sets
+   - trailing slashes are removed and empty lines are ignored
+   - returns 0 on success */
+static int
+match_load(struct matcher *matcherp, const char *filename, int mask)
+{
+    FILE *fp = NULL;
+    char *line = NULL;
+    size_t linesize = 0;
+    ssize_t len = 0;
+    int kind = MATCH_NAME;
+    int ret = 0;
+
+    if((fp = fopen(filename, "r")) == NULL) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        return (1);
+    }
+
+    errno = 0;
+    while((len = getline(&line, &linesize, fp)) >= 0) {
+        if((len > 0) && (line[len - 1] == '\n'))
+            line[--len] = '\0';
+        while((len > 1) && (line[len - 1] == '/'))
+            line[--len] = '\0';
+        if(len == 0)
+            continue;
+
+        kind = (memchr(line, '/', len) != NULL) ? MATCH_PATH : MATCH_NAME;
+        matcherp->mask[kind] |= mask;
+        if((kind == MATCH_PATH) && (mask & MATCH_INCLUDE) &&
+            (match_prefixes_add(matcherp, line, len, MATCH_CS) != 0)) {
+            ret = 1;
+            break;
+        }
+        if(match_set_add(&matcherp->exact[kind][MATCH_CS], line, len,
+            mask) != 0) {
+            ret = 1;
+            break;
+        }
+        errno = 0;
+    }
+    if((ret == 0) && ferror(fp)) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        ret = 1;
+    }
+
+    free(line);
+    fclose(fp);
+    return (ret);
+}
+
+/* Compile include and exclude lists of options
+   - lists must not change while the matcher is in use
+   - returns NULL if error */
+struct matcher *
+matcher_init(struct program_options *options)
+{
+    assert(options != NULL);
+
+    struct matcher *matcherp = NULL;
+    const struct {
+        char **list;
+        unsigned int num;
+        int ci;
+        int mask;
+    } lists[] = {
+        { options->include_files, options->ninclude_files, 0, MATCH_INCLUDE },
+        { options->include_files_ci, options->ninclude_files_ci, 1,
+            MATCH_INCLUDE },
+        { options->exclude_files, options->nexclude_files, 0, MATCH_EXCLUDE },
+        { options->exclude_files_ci, options->nexclude_files_ci, 1,
+            MATCH_EXCLUDE }
+    };
+    unsigned int l = 0, i = 0;
+
+    if((matcherp = calloc(1, sizeof(struct matcher))) == NULL) {
+        fprintf(stderr, "%s(): cannot allocate memory\n", __func__);
+        return (NULL);
+    }
+    matcherp->exact[MATCH_NAME][MATCH_CI].fold = 1;
+    matcherp->exact[MATCH_PATH][MATCH_CI].fold = 1;
+    matcherp->suffix[MATCH_CI].fold = 1;
+    matcherp->prefix[MATCH_CI].fold = 1;
+    matcherp->incdirs[MATCH_CI].fold = 1;
+    matcherp->incopen[MATCH_CI].fold = 1;
+
+    for(l = 0; l < sizeof(lists) / sizeof(lists[0]); l++) {
+        if(lists[l].list == NULL)
+            continue;
+        for(i = 0; i < lists[l].num; i++) {
+            if(match_add(matcherp, lists[l].list[i], lists[l].ci,
+                lists[l].mask) != 0)
+                goto err;
+        }
+    }
+    for(i = 0; i < options->ninclude_from; i++) {
+        if(match_load(matcherp, options->include_from[i], MATCH_INCLUDE) != 0)
+            goto err;
+    }
+    for(i = 0; i < options->nexclude_from; i++) {
+        if(match_load(matcherp, options->exclude_from[i], MATCH_EXCLUDE) != 0)
+            goto err;
+    }
+    if((match_nfas_build(matcherp, MATCH_NAME) != 0) ||
+        (match_nfas_build(matcherp, MATCH_PATH) != 0))
+        goto err;
+
+    return (matcherp);
+
+err:
+    matcher_uninit(matcherp);
+    return (NULL);
+}
+
+/* Match an fts entry against compiled patterns
+   - want tells which lists to check (MATCH_INCLUDE and/or MATCH_EXCLUDE),
+     others may be left unchecked
+   - returns lists having a pattern matching entry */
+int
+matcher_match(const struct matcher *matcherp, const FTSENT * const p,
+    int want)
+{
+    assert(matcherp != NULL);
+    assert(p != NULL);
+    assert(p->fts_name != NULL);
+    assert(p->fts_path != NULL);
+
+    const char *name = p->fts_name;
+    size_t namelen = p->fts_namelen;
+    size_t pathlen = 0;
+    int result = 0;
+    int ci = 0;
+    size_t i = 0, l = 0;
+
+#define MATCH_DONE()    ((result & want) == want)
+
+    if(matcherp->mask[MATCH_NAME] & want) {
+        for(ci = MATCH_CS; ci <= MATCH_CI; ci++) {
+            const struct match_set *suffix = &matcherp->suffix[ci];
+            const struct match_set *prefix = &matcherp->prefix[ci];
+
+            result |= match_set_lookup(&matcherp->exact[MATCH_NAME][ci],
+                name, namelen);
+            /* a star cannot match a leading period */
+            if(name[0] != '.') {
+                for(l = 0; (l < suffix->nlens) &&
+                    (suffix->lens[l] <= namelen) && !MATCH_DONE(); l++)
+                    result |= match_set_lookup(suffix,
+                        &name[namelen - suffix->lens[l]], suffix->lens[l]);
+            }
+            for(l = 0; (l < prefix->nlens) && (prefix->lens[l] <= namelen) &&
+                !MATCH_DONE(); l++)
+                result |= match_set_lookup(prefix, name, prefix->lens[l]);
+        }
+        for(i = 0; (i < matcherp->nnfas[MATCH_NAME]) && !MATCH_DONE(); i++)
+            result |= match_nfa_run(&matcherp->nfas[MATCH_NAME][i], name,
+                namelen);
+    }
+
+    if((matcherp->mask[MATCH_PATH] & want) && !MATCH_DONE()) {
+        /* fts_pathlen may be too narrow for long paths */
+        pathlen = strlen(p->fts_path);
+        for(ci = MATCH_CS; ci <= MATCH_CI; ci++)
+            result |= match_set_lookup(&matcherp->exact[MATCH_PATH][ci],
+                p->fts_path, pathlen);
+        for(i = 0; (i < matcherp->nnfas[MATCH_PATH]) && !MATCH_DONE(); i++)
+            result |= match_nfa_run(&matcherp->nfas[MATCH_PATH][i],
+                p->fts_path, pathlen);
+    }
+
+    for(i = 0; (i < matcherp->nfallbacks) && !MATCH_DONE(); i++) {
+        const struct match_fallback *fb = &matcherp->fallbacks[i];
+
+        if(!(fb->mask & want & ~result))
+            continue;
+        if(fnmatch(fb->pattern, (fb->flags & FNM_PATHNAME) ?
+            p->fts_path : p->fts_name, fb->flags) == 0)
+            result |= fb->mask;
+    }
+
+#undef MATCH_DONE
+
+    return (result & want);
+}
+
+/* Tell if a directory can be skipped because neither itself nor any of its
+   descendants can match an include pattern
+   - only possible when all include patterns are paths
+   - returns 1 if directory can be skipped, else 0 */
+int
+matcher_prune(const struct matcher *matcherp, const FTSENT * const p)
+{
+    assert(matcherp != NULL);
+    assert(p != NULL);
+    assert(p->fts_path != NULL);
+
+    const char *path = p->fts_path;
+    size_t pathlen = 0;
+    size_t slashes = 0;
+    int ci = 0;
+    size_t i = 0, l = 0;
+
+    if(!(matcherp->mask[MATCH_PATH] & MATCH_INCLUDE) ||
+        (matcherp->mask[MATCH_NAME] & MATCH_INCLUDE))
+        return (0);
+
+    /* directory itself is included */
+    if(matcher_match(matcherp, p, MATCH_INCLUDE))
+        return (0);
+
+    /* descendants of "dir/" are "dir/name", as for "dir" */
+    pathlen = strlen(path);
+    if((pathlen > 0) && (path[pathlen - 1] == '/'))
+        pathlen--;
+    for(i = 0; i < pathlen; i++)
+        if(path[i] == '/')
+            slashes++;
+
+    /* descendants have more slashes than any pattern */
+    if(slashes >= matcherp->incdepth)
+        return (1);
+    if(matcherp->incall)
+        return (0);
+
+    for(ci = MATCH_CS; ci <= MATCH_CI; ci++) {
+        const struct match_set *incopen = &matcherp->incopen[ci];
+
+        if(match_set_lookup(&matcherp->incdirs[ci], path, pathlen))
+            return (0);
+        for(l = 0; (l < incopen->nlens) && (incopen->lens[l] < pathlen);
+            l++) {
+            if((path[incopen->lens[l]] == '/') &&
+                match_set_lookup(incopen, path, incopen->lens[l]))
+                return (0);
+        }
+    }
+    return (1);
+}
+
+/* Free a matcher */
+void
+matcher_uninit(struct matcher *matcherp)
+{
+    assert(matcherp != NULL);
+
+    int kind = 0, ci = 0;
+    size_t i = 0;
+
+    for(kind = MATCH_NAME; kind <= MATCH_PATH; kind++) {
+        for(ci = MATCH_CS; ci <= MATCH_CI; ci++)
+            match_set_uninit(&matcherp->exact[kind][ci]);
+        for(i = 0; i < matcherp->npatterns[kind]; i++)
+            free(matcherp->patterns[kind][i].tokens);
+        free(matcherp->patterns[kind]);
+        for(i = 0; i < matcherp->nnfas[kind]; i++)
+            match_nfa_uninit(&matcherp->nfas[kind][i]);
+        free(matcherp->nfas[kind]);
+    }
+    for(ci = MATCH_CS; ci <= MATCH_CI; ci++) {
+        match_set_uninit(&matcherp->suffix[ci]);
+        match_set_uninit(&matcherp->prefix[ci]);
+        match_set_uninit(&matcherp->incdirs[ci]);
+        match_set_uninit(&matcherp->incopen[ci]);
+    }
+    free(matcherp->fallbacks);
+    free(matcherp);
+}
@@ -29,6 +29,8 @@
 
 #include "utils.h"
 #include "options.h"
+#include "match.h"
+#include "throttle.h"
 
 /* NULL */
 #include <stdlib.h>
@@ -48,6 +50,7 @@ init_options(struct program_options *options)
     assert(DFLT_OPT_NUM_PARTS >= 0);
     assert(DFLT_OPT_MAX_ENTRIES >= 0);
     assert(DFLT_OPT_MAX_SIZE >= 0);
+    assert(DFLT_OPT_MAX_MEMORY >= 0);
     assert((DFLT_OPT_ARBITRARYVALUES == OPT_NOARBITRARYVALUES) ||
            (DFLT_OPT_ARBITRARYVALUES == OPT_ARBITRARYVALUES));
     assert((DFLT_OPT_OUT0 == OPT_NOOUT0) ||
@@ -63,6 +66,17 @@ init_options(struct program_options *options)
            (DFLT_OPT_FOLLOWSYMLINKS == OPT_NOFOLLOWSYMLINKS));
     assert((DFLT_OPT_CROSSFSBOUNDARIES == OPT_NOCROSSFSBOUNDARIES) ||
            (DFLT_OPT_CROSSFSBOUNDARIES == OPT_CROSSFSBOUNDARIES));
+    assert((DFLT_OPT_SYNCATTRS == OPT_NOSYNCATTRS) ||
+           (DFLT_OPT_SYNCATTRS == OPT_SYNCATTRS));
+    assert((DFLT_OPT_TRUSTDTYPE == OPT_NOTRUSTDTYPE) ||
+           (DFLT_OPT_TRUSTDTYPE == OPT_TRUSTDTYPE));
+    assert((DFLT_OPT_INODEORDER == OPT_NOINODEORDER) ||
+           (DFLT_OPT_INODEORDER == OPT_INODEORDER));
+    assert(DFLT_OPT_CRAWL_THREADS >= 1);
+    assert((DFLT_OPT_IOCLASS == OPT_NOIOCLASS) ||
+           (DFLT_OPT_IOCLASS == OPT_IOCLASS_BE) ||
+           (DFLT_OPT_IOCLASS == OPT_IOCLASS_IDLE));
+    assert(DFLT_OPT_IOLEVEL <= 7);
     assert((DFLT_OPT_DIRSINCLUDE == OPT_NOEMPTYDIRS) ||
            (DFLT_OPT_DIRSINCLUDE == OPT_EMPTYDIRS) ||
            (DFLT_OPT_DIRSINCLUDE == OPT_DNREMPTY) ||
@@ -78,6 +92,10 @@ init_options(struct program_options *options)
            (DFLT_OPT_LIVEMODE == OPT_LIVEMODE));
     assert((DFLT_OPT_SKIPBIG == OPT_NOSKIPBIG) ||
            (DFLT_OPT_SKIPBIG == OPT_SKIPBIG));
+    assert((DFLT_OPT_HARDLINKS == OPT_NOHARDLINKS) ||
+           (DFLT_OPT_HARDLINKS == OPT_HARDLINKS));
+    assert((DFLT_OPT_SPOOL == OPT_NOSPOOL) ||
+           (DFLT_OPT_SPOOL == OPT_SPOOL));
     assert(DFLT_OPT_PRELOAD_SIZE >= 0);
     assert(DFLT_OPT_OVERLOAD_SIZE >= 0);
     assert(DFLT_OPT_ROUND_SIZE >= 1);
@@ -86,6 +104,7 @@ init_options(struct program_options *options)
     options->num_parts = DFLT_OPT_NUM_PARTS;
     options->max_entries = DFLT_OPT_MAX_ENTRIES;
     options->max_size = DFLT_OPT_MAX_SIZE;
+    options->max_memory = DFLT_OPT_MAX_MEMORY;
     options->in_filename = NULL;
     options->arbitrary_values = DFLT_OPT_ARBITRARYVALUES;
     options->out_filename = NULL;
@@ -95,6 +114,19 @@ init_options(struct program_options *options)
     options->verbose = DFLT_OPT_VERBOSE;
     options->follow_symbolic_links = DFLT_OPT_FOLLOWSYMLINKS;
     options->cross_fs_boundaries = DFLT_OPT_CROSSFSBOUNDARIES;
+    options->sync_attrs = DFLT_OPT_SYNCATTRS;
+    options->trust_dtype = DFLT_OPT_TRUSTDTYPE;
+    options->inode_order = DFLT_OPT_INODEORDER;
+    options->cache_filename = NULL;
+    options->crawl_threads = DFLT_OPT_CRAWL_THREADS;
+    options->prefetch_threads = DFLT_OPT_PREFETCH_THREADS;
+    options->fs_threads = NULL;
+    options->nfs_threads = 0;
+    options->max_ops = DFLT_OPT_MAX_OPS;
+    options->max_latency = DFLT_OPT_MAX_LATENCY;
+    options->throttle = NULL;
+    options->io_class = DFLT_OPT_IOCLASS;
+    options->io_level = DFLT_OPT_IOLEVEL;
     options->include_files = NULL;
     options->ninclude_files = 0;
     options->include_files_ci = NULL;
@@ -103,6 +135,11 @@ init_options(struct program_options *options)
     options->nexclude_files = 0;
     options->exclude_files_ci = NULL;
     options->nexclude_files_ci = 0;
+    options->include_from = NULL;
+    options->ninclude_from = 0;
+    options->exclude_from = NULL;
+    options->nexclude_from = 0;
+    options->matcher = NULL;
     options->dirs_include = DFLT_OPT_DIRSINCLUDE;
     options->dir_depth = DFLT_OPT_DIR_DEPTH;
     options->dnr_split = OPT_NODNRSPLIT;
@@ -110,6 +147,8 @@ init_options(struct program_options *options)
     options->dirs_only = DFLT_OPT_DIRSONLY;
     options->live_mode = DFLT_OPT_LIVEMODE;
     options->skip_big = DFLT_OPT_SKIPBIG;
+    options->hardlinks = DFLT_OPT_HARDLINKS;
+    options->spool = DFLT_OPT_SPOOL;
     options->pre_part_hook = NULL;
     options->post_part_hook = NULL;
     options->post_run_hook = NULL;
@@ -131,6 +170,8 @@ uninit_options(struct program_options *options)
         free(options->post_part_hook);
     if(options->pre_part_hook != NULL)
         free(options->pre_part_hook);
+    options->spool = DFLT_OPT_SPOOL;
+    options->hardlinks = DFLT_OPT_HARDLINKS;
     options->skip_big = DFLT_OPT_SKIPBIG;
     options->live_mode = DFLT_OPT_LIVEMODE;
     options->dirs_only = DFLT_OPT_DIRSONLY;
@@ -138,6 +179,12 @@ uninit_options(struct program_options *options)
     options->dnr_split = OPT_NODNRSPLIT;
     options->dir_depth = DFLT_OPT_DIR_DEPTH;
     options->dirs_include = DFLT_OPT_DIRSINCLUDE;
+    if(options->matcher != NULL)
+        matcher_uninit(options->matcher);
+    if(options->exclude_from != NULL)
+        str_cleanup(&(options->exclude_from), &(options->nexclude_from));
+    if(options->include_from != NULL)
+        str_cleanup(&(options->include_from), &(options->ninclude_from));
     if(options->exclude_files_ci != NULL)
         str_cleanup(&(options->exclude_files_ci),
             &(options->nexclude_files_ci));
@@ -150,6 +197,21 @@ uninit_options(struct program_options *options)
     if(options->include_files != NULL)
         str_cleanup(&(options->include_files),
             &(options->ninclude_files));
+    options->io_level = DFLT_OPT_IOLEVEL;
+    options->io_class = DFLT_OPT_IOCLASS;
+    if(options->throttle != NULL)
+        throttle_uninit(options->throttle);
+    options->max_latency = DFLT_OPT_MAX_LATENCY;
+    options->max_ops = DFLT_OPT_MAX_OPS;
+    if(options->fs_threads != NULL)
+        str_cleanup(&(options->fs_threads), &(options->nfs_threads));
+    options->prefetch_threads = DFLT_OPT_PREFETCH_THREADS;
+    options->crawl_threads = DFLT_OPT_CRAWL_THREADS;
+    if(options->cache_filename != NULL)
+        free(options->cache_filename);
+    options->inode_order = DFLT_OPT_INODEORDER;
+    options->trust_dtype = DFLT_OPT_TRUSTDTYPE;
+    options->sync_attrs = DFLT_OPT_SYNCATTRS;
     options->cross_fs_boundaries = DFLT_OPT_CROSSFSBOUNDARIES;
     options->follow_symbolic_links = DFLT_OPT_FOLLOWSYMLINKS;
     options->verbose = DFLT_OPT_VERBOSE;
@@ -161,6 +223,7 @@ uninit_options(struct program_options *options)
     options->arbitrary_values = DFLT_OPT_ARBITRARYVALUES;
     if(options->in_filename != NULL)
         free(options->in_filename);
+    options->max_memory = DFLT_OPT_MAX_MEMORY;
     options->max_size = DFLT_OPT_MAX_SIZE;
     options->max_entries = DFLT_OPT_MAX_ENTRIES;
     options->num_parts = DFLT_OPT_NUM_PARTS;
@@ -38,6 +38,12 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+/* Compiled include and exclude lists (see match.h) */
+struct matcher;
+
+/* Crawl throttle (see throttle.h) */
+struct throttle;
+
 /* Program options */
 struct program_options {
 /* number of partitions (option -n) */
@@ -49,6 +55,9 @@ struct program_options {
 /* maximum partition size (option -s) */
 #define DFLT_OPT_MAX_SIZE           0
     fsize_t max_size;
+/* memory budget for file entries, in bytes (option -M) */
+#define DFLT_OPT_MAX_MEMORY         0
+    fsize_t max_memory;
 /* input file (option -i); NULL = undefined, "-" = stdin, "filename" */
     char *in_filename;
 /* arbitrary values (option -a) */
@@ -90,6 +99,48 @@ struct program_options {
 #define OPT_CROSSFSBOUNDARIES       1
 #define DFLT_OPT_CROSSFSBOUNDARIES  OPT_CROSSFSBOUNDARIES
     unsigned char cross_fs_boundaries;
+/* synchronize file attributes with server (option -N) */
+#define OPT_NOSYNCATTRS             0
+#define OPT_SYNCATTRS               1
+#define DFLT_OPT_SYNCATTRS          OPT_SYNCATTRS
+    unsigned char sync_attrs;
+/* trust directory entries' type to avoid stat(2) calls (option -t) */
+#define OPT_NOTRUSTDTYPE            0
+#define OPT_TRUSTDTYPE              1
+#define DFLT_OPT_TRUSTDTYPE         OPT_NOTRUSTDTYPE
+    unsigned char trust_dtype;
+/* stat(2) directory entries in inode order (option -I) */
+#define OPT_NOINODEORDER            0
+#define OPT_INODEORDER              1
+#define DFLT_OPT_INODEORDER         OPT_NOINODEORDER
+    unsigned char inode_order;
+/* crawl cache file (option -C) */
+    char *cache_filename;
+/* crawling threads (option -T) */
+#define DFLT_OPT_CRAWL_THREADS      1
+    unsigned int crawl_threads;
+/* prefetching threads (option -A) */
+#define DFLT_OPT_PREFETCH_THREADS   0
+    unsigned int prefetch_threads;
+/* crawling threads' caps per filesystem, as num:path (option -G) */
+    char **fs_threads;
+    unsigned int nfs_threads;
+/* maximum filesystem operations per second (option -O) */
+#define DFLT_OPT_MAX_OPS            0
+    fnum_t max_ops;
+/* latency above which crawl slows down, in milliseconds (option -O) */
+#define DFLT_OPT_MAX_LATENCY        0
+    unsigned int max_latency;
+/* crawl throttle, set up once options parsed */
+    struct throttle *throttle;
+/* I/O scheduling class and priority (option -c), values as ioprio_set(2)'s */
+#define OPT_NOIOCLASS               0
+#define OPT_IOCLASS_BE              2
+#define OPT_IOCLASS_IDLE            3
+#define DFLT_OPT_IOCLASS            OPT_NOIOCLASS
+    unsigned char io_class;
+#define DFLT_OPT_IOLEVEL            4
+    unsigned char io_level;
 /* include files, case sensitive (option -y) */
     char **include_files;
     unsigned int ninclude_files;
@@ -102,6 +153,14 @@ struct program_options {
 /* exclude files, case insensitive (option -X) */
     char **exclude_files_ci;
     unsigned int nexclude_files_ci;
+/* include files listed in files (option -J) */
+    char **include_from;
+    unsigned int ninclude_from;
+/* exclude files listed in files (option -K) */
+    char **exclude_from;
+    unsigned int nexclude_from;
+/* include and exclude lists above, compiled once parsed */
+    struct matcher *matcher;
 /* include certain directories (option -z) */
 #define OPT_NOEMPTYDIRS             0
 #define OPT_EMPTYDIRS               1   /* include empty directories */
@@ -138,6 +197,16 @@ struct program_options {
 #define OPT_SKIPBIG              1
 #define DFLT_OPT_SKIPBIG         OPT_NOSKIPBIG
     unsigned char skip_big;
+/* count hardlinks once and keep them together (option -H) */
+#define OPT_NOHARDLINKS             0
+#define OPT_HARDLINKS               1
+#define DFLT_OPT_HARDLINKS          OPT_NOHARDLINKS
+    unsigned char hardlinks;
+/* spool names to a temporary file (option -B) */
+#define OPT_NOSPOOL                 0
+#define OPT_SPOOL                   1
+#define DFLT_OPT_SPOOL              OPT_NOSPOOL
+    unsigned char spool;
 /* pre-partition hook (option -w) */
     char *pre_part_hook;
 /* post-partition hook (option -W) */
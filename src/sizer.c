@@ -0,0 +1,376 @@
+/*-
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2011-2026 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "types.h"
+#include "utils.h"
+#include "options.h"
+#include "sizer.h"
+
+/* malloc(3), calloc(3), free(3) */
+#include <stdlib.h>
+
+/* fprintf(3) */
+#include <stdio.h>
+
+/* strlen(3), memcpy(3), strerror(3) */
+#include <string.h>
+
+/* pthread(3) */
+#include <pthread.h>
+
+/* assert(3) */
+#include <assert.h>
+
+/*
+ * A sizer computes the sizes of directories (through get_size()) using a
+ * pool of threads, while the main thread goes on crawling. Entries (sized
+ * or not) are queued in crawling order and returned in that same order by
+ * sizer_next(), as soon as their size is known: entries are then added to
+ * partitions in a deterministic order, whatever the number of threads.
+ */
+
+/* A queued entry */
+struct sizer_entry {
+    char *path;                     /* entry path */
+    char *size_path;                /* directory to size, or NULL */
+    struct stat size_stat;          /* and its stat(2) information */
+    fsize_t size;
+    fnum_t link;                    /* hardlinks' group, or 0 */
+    int entry_errno;
+#define SE_QUEUED   0               /* waiting to be sized */
+#define SE_RUNNING  1               /* being sized */
+#define SE_DONE     2               /* size known */
+    int state;
+    struct sizer_entry *next;       /* next entry, in crawling order */
+    struct sizer_entry *next_job;   /* next entry waiting to be sized */
+};
+
+struct sizer {
+    struct program_options *options;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv;         /* entry to size queued (or stop) */
+    pthread_cond_t done_cv;         /* entry sized */
+
+    struct sizer_entry *head;       /* entries, in crawling order */
+    struct sizer_entry *tail;
+    struct sizer_entry *jobs_head;  /* entries waiting to be sized */
+    struct sizer_entry *jobs_tail;
+    size_t num_jobs;                /* entries not sized yet */
+    size_t max_jobs;
+
+    pthread_t *threads;
+    unsigned int num_threads;
+    int stop;
+};
+
+/* Compute an entry's size
+   - called without lock held */
+static void
+sizer_size(struct sizer *sizerp, struct sizer_entry *e)
+{
+    assert(sizerp != NULL);
+    assert(e != NULL);
+    assert(e->size_path != NULL);
+
+    e->size = get_size(e->size_path, &e->size_stat, sizerp->options);
+}
+
+/* Remove first entry waiting to be sized
+   - lock must be held
+   - returns NULL if none */
+static struct sizer_entry *
+sizer_job_take(struct sizer *sizerp)
+{
+    struct sizer_entry *e = sizerp->jobs_head;
+
+    if(e != NULL) {
+        sizerp->jobs_head = e->next_job;
+        if(sizerp->jobs_head == NULL)
+            sizerp->jobs_tail = NULL;
+        e->next_job = NULL;
+        e->state = SE_RUNNING;
+    }
+    return (e);
+}
+
+/* Mark an entry as sized
+   - lock must be held */
+static void
+sizer_job_done(struct sizer *sizerp, struct sizer_entry *e)
+{
+    e->state = SE_DONE;
+    sizerp->num_jobs--;
+    pthread_cond_broadcast(&sizerp->done_cv);
+}
+
+/* Sizing thread main loop */
+static void *
+sizer_worker(void *arg)
+{
+    struct sizer *sizerp = arg;
+    struct sizer_entry *e = NULL;
+
+    pthread_mutex_lock(&sizerp->lock);
+    while(!sizerp->stop) {
+        if((e = sizer_job_take(sizerp)) == NULL) {
+            pthread_cond_wait(&sizerp->work_cv, &sizerp->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&sizerp->lock);
+
+        sizer_size(sizerp, e);
+
+        pthread_mutex_lock(&sizerp->lock);
+        sizer_job_done(sizerp, e);
+    }
+    pthread_mutex_unlock(&sizerp->lock);
+
+    return (NULL);
+}
+
+/* Free an entry */
+static void
+sizer_entry_free(struct sizer_entry *e)
+{
+    free(e->path);
+    free(e->size_path);
+    free(e);
+}
+
+/* Initialize a sizer using num_threads threads
+   - returns NULL if error */
+struct sizer *
+sizer_init(unsigned int num_threads, struct program_options *options)
+{
+    assert(num_threads > 0);
+    assert(options != NULL);
+
+    struct sizer *sizerp = NULL;
+
+    if((sizerp = calloc(1, sizeof(struct sizer))) == NULL) {
+        fprintf(stderr, "%s(): cannot allocate memory\n", __func__);
+        return (NULL);
+    }
+    if_not_malloc(sizerp->threads, sizeof(pthread_t) * num_threads,
+        free(sizerp);
+        return (NULL);
+    )
+    sizerp->options = options;
+    sizerp->max_jobs = (size_t)num_threads * SIZER_JOBS_PER_THREAD;
+    pthread_mutex_init(&sizerp->lock, NULL);
+    pthread_cond_init(&sizerp->work_cv, NULL);
+    pthread_cond_init(&sizerp->done_cv, NULL);
+
+    unsigned int i;
+    int error = 0;
+    for(i = 0; i < num_threads; i++) {
+        if((error = pthread_create(&sizerp->threads[sizerp->num_threads], NULL,
+            &sizer_worker, sizerp)) != 0) {
+            /* go on with less threads, main thread will size remaining
+               entries by itself if necessary */
+            fprintf(stderr, "%s(): cannot create thread: %s\n", __func__,
+                strerror(error));
+            break;
+        }
+        sizerp->num_threads++;
+    }
+
+    return (sizerp);
+}
+
+/* Queue an entry, whose size will be computed from size_path if not NULL
+   - path and size_path are copied
+   - link is handed back as is by sizer_next()
+   - returns 0 (success) or 1 (failure) */
+int
+sizer_add(struct sizer *sizerp, const char *path, const char *size_path,
+    const struct stat *size_stat, fsize_t size, fnum_t link, int entry_errno)
+{
+    assert(sizerp != NULL);
+    assert(path != NULL);
+    assert((size_path == NULL) || (size_stat != NULL));
+
+    struct sizer_entry *e = NULL;
+    size_t malloc_size = 0;
+
+    if((e = calloc(1, sizeof(struct sizer_entry))) == NULL) {
+        fprintf(stderr, "%s(): cannot allocate memory\n", __func__);
+        return (1);
+    }
+    malloc_size = strlen(path) + 1;
+    if_not_malloc(e->path, malloc_size,
+        sizer_entry_free(e);
+        return (1);
+    )
+    memcpy(e->path, path, malloc_size);
+    e->size = size;
+    e->link = link;
+    e->entry_errno = entry_errno;
+    e->state = SE_DONE;
+
+    if(size_path != NULL) {
+        malloc_size = strlen(size_path) + 1;
+        if_not_malloc(e->size_path, malloc_size,
+            sizer_entry_free(e);
+            return (1);
+        )
+        memcpy(e->size_path, size_path, malloc_size);
+        e->size_stat = *size_stat;
+        e->state = SE_QUEUED;
+    }
+
+    pthread_mutex_lock(&sizerp->lock);
+    if(sizerp->tail == NULL)
+        sizerp->head = e;
+    else
+        sizerp->tail->next = e;
+    sizerp->tail = e;
+    if(e->state == SE_QUEUED) {
+        if(sizerp->jobs_tail == NULL)
+            sizerp->jobs_head = e;
+        else
+            sizerp->jobs_tail->next_job = e;
+        sizerp->jobs_tail = e;
+        sizerp->num_jobs++;
+        pthread_cond_signal(&sizerp->work_cv);
+    }
+    pthread_mutex_unlock(&sizerp->lock);
+
+    return (0);
+}
+
+/* Tell if no entry is queued
+   - called from main thread only, which is the only one to queue and
+     dequeue entries */
+int
+sizer_empty(struct sizer *sizerp)
+{
+    assert(sizerp != NULL);
+
+    return (sizerp->head == NULL);
+}
+
+/* Tell if too many entries are waiting to be sized */
+int
+sizer_full(struct sizer *sizerp)
+{
+    assert(sizerp != NULL);
+
+    int full = 0;
+
+    pthread_mutex_lock(&sizerp->lock);
+    full = (sizerp->num_jobs >= sizerp->max_jobs);
+    pthread_mutex_unlock(&sizerp->lock);
+
+    return (full);
+}
+
+/* Dequeue first entry, if its size is known
+   - if wait is set, wait for (or compute) first entry's size
+   - path must be freed by caller
+   - returns 1 if an entry has been dequeued, else 0 */
+int
+sizer_next(struct sizer *sizerp, int wait, char **path, fsize_t *size,
+    fnum_t *link, int *entry_errno)
+{
+    assert(sizerp != NULL);
+    assert(path != NULL);
+    assert(size != NULL);
+    assert(link != NULL);
+    assert(entry_errno != NULL);
+
+    struct sizer_entry *e = NULL;
+
+    pthread_mutex_lock(&sizerp->lock);
+    if(((e = sizerp->head) == NULL) ||
+        ((e->state != SE_DONE) && !wait)) {
+        pthread_mutex_unlock(&sizerp->lock);
+        return (0);
+    }
+
+    /* not sized yet, do it ourselves */
+    if(e->state == SE_QUEUED) {
+        /* first entry is always the first job to be done */
+        assert(sizerp->jobs_head == e);
+        sizer_job_take(sizerp);
+        pthread_mutex_unlock(&sizerp->lock);
+
+        sizer_size(sizerp, e);
+
+        pthread_mutex_lock(&sizerp->lock);
+        sizer_job_done(sizerp, e);
+    }
+    while(e->state != SE_DONE)
+        pthread_cond_wait(&sizerp->done_cv, &sizerp->lock);
+
+    sizerp->head = e->next;
+    if(sizerp->head == NULL)
+        sizerp->tail = NULL;
+    pthread_mutex_unlock(&sizerp->lock);
+
+    *path = e->path;
+    *size = e->size;
+    *link = e->link;
+    *entry_errno = e->entry_errno;
+    e->path = NULL;
+    sizer_entry_free(e);
+
+    return (1);
+}
+
+/* Un-initialize a sizer, dropping remaining entries */
+void
+sizer_uninit(struct sizer *sizerp)
+{
+    assert(sizerp != NULL);
+
+    struct sizer_entry *e = NULL;
+
+    /* stop threads, after their current job */
+    pthread_mutex_lock(&sizerp->lock);
+    sizerp->stop = 1;
+    pthread_cond_broadcast(&sizerp->work_cv);
+    pthread_mutex_unlock(&sizerp->lock);
+
+    unsigned int i;
+    for(i = 0; i < sizerp->num_threads; i++)
+        pthread_join(sizerp->threads[i], NULL);
+
+    while((e = sizerp->head) != NULL) {
+        sizerp->head = e->next;
+        sizer_entry_free(e);
+    }
+
+    pthread_cond_destroy(&sizerp->done_cv);
+    pthread_cond_destroy(&sizerp->work_cv);
+    pthread_mutex_destroy(&sizerp->lock);
+    free(sizerp->threads);
+    free(sizerp);
+}
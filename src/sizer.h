@@ -0,0 +1,58 @@
+/*-
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2011-2026 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SIZER_H
+#define _SIZER_H
+
+#include "types.h"
+#include "options.h"
+
+/* stat(2) */
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if !defined(SIZER_JOBS_PER_THREAD)
+#define SIZER_JOBS_PER_THREAD 16    /* maximum number of directories waiting
+                                       to be sized, per thread */
+#endif
+
+/* A sizer (see sizer.c) */
+struct sizer;
+
+struct sizer *sizer_init(unsigned int num_threads,
+    struct program_options *options);
+int sizer_add(struct sizer *sizerp, const char *path, const char *size_path,
+    const struct stat *size_stat, fsize_t size, fnum_t link, int entry_errno);
+int sizer_empty(struct sizer *sizerp);
+int sizer_full(struct sizer *sizerp);
+int sizer_next(struct sizer *sizerp, int wait, char **path, fsize_t *size,
+    fnum_t *link, int *entry_errno);
+void sizer_uninit(struct sizer *sizerp);
+
+#endif /* _SIZER_H */
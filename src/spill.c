@@ -0,0 +1,408 @@
+/*-
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2011-2026 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "types.h"
+#include "utils.h"
+#include "spill.h"
+
+/* malloc(3), free(3), mkstemp(3), getenv(3) */
+#include <stdlib.h>
+
+/* fprintf(3), fdopen(3), fwrite(3), fread(3) */
+#include <stdio.h>
+
+/* strlen(3), strerror(3) */
+#include <string.h>
+
+/* errno */
+#include <errno.h>
+
+/* close(2), unlink(2) */
+#include <unistd.h>
+
+/* uint64_t */
+#include <stdint.h>
+
+/* assert(3) */
+#include <assert.h>
+
+/*
+ * When file entries do not fit within memory budget (option -M), they are
+ * sorted and written to temporary files (runs), then merged back when all of
+ * them have been crawled. Each run is a sequence of records (struct
+ * spill_record, followed by the path without its ending NUL), using host's
+ * byte order. Temporary files are created in $TMPDIR (or /tmp) and unlinked
+ * at once, so that they vanish whatever happens. No more than SPILL_MAX_RUNS
+ * runs are kept: they are merged into a single one when that limit is
+ * reached.
+ */
+
+#define SPILL_DFLT_DIR  "/tmp"
+
+struct spill_record {
+    uint64_t size;
+    uint64_t seq;
+    uint64_t len;                   /* path length */
+};
+
+/* Create an anonymous (already unlinked) temporary file
+   - returns its file descriptor, or < 0 if error */
+int
+spill_tmpfile(void)
+{
+    const char *dir = getenv("TMPDIR");
+    char *tmp_path = NULL;
+    size_t malloc_size = 0;
+    int fd = -1;
+
+    if((dir == NULL) || (dir[0] == '\0'))
+        dir = SPILL_DFLT_DIR;
+
+    malloc_size = strlen(dir) + sizeof("/fpart.XXXXXX");
+    if_not_malloc(tmp_path, malloc_size,
+        return (-1);
+    )
+    snprintf(tmp_path, malloc_size, "%s/fpart.XXXXXX", dir);
+    if((fd = mkstemp(tmp_path)) < 0) {
+        fprintf(stderr, "%s: %s\n", tmp_path, strerror(errno));
+        free(tmp_path);
+        return (-1);
+    }
+    unlink(tmp_path);
+    free(tmp_path);
+    return (fd);
+}
+
+/* Create an empty run
+   - returns NULL if error */
+struct spill_run *
+spill_run_create(void)
+{
+    struct spill_run *runp = NULL;
+    int fd = -1;
+
+    if((fd = spill_tmpfile()) < 0)
+        return (NULL);
+
+    if_not_malloc(runp, sizeof(struct spill_run),
+        close(fd);
+        return (NULL);
+    )
+    runp->size = 0;
+    runp->seq = 0;
+    runp->path = NULL;
+    runp->path_size = 0;
+    if_not_malloc(runp->buf, SPILL_BUFFER_SIZE,
+        close(fd);
+        free(runp);
+        return (NULL);
+    )
+    if((runp->fp = fdopen(fd, "w+")) == NULL) {
+        fprintf(stderr, "%s(): %s\n", __func__, strerror(errno));
+        close(fd);
+        free(runp->buf);
+        free(runp);
+        return (NULL);
+    }
+    setvbuf(runp->fp, runp->buf, _IOFBF, SPILL_BUFFER_SIZE);
+    return (runp);
+}
+
+/* Append a record to a run
+   - returns < 0 if error */
+int
+spill_run_write(struct spill_run *runp, fsize_t size, fnum_t seq,
+    const char *path)
+{
+    assert(runp != NULL);
+    assert(path != NULL);
+
+    struct spill_record record;
+
+    record.size = size;
+    record.seq = seq;
+    record.len = strlen(path);
+    if((fwrite(&record, sizeof(record), 1, runp->fp) != 1) ||
+        ((record.len > 0) &&
+        (fwrite(path, record.len, 1, runp->fp) != 1))) {
+        fprintf(stderr, "%s(): %s\n", __func__, strerror(errno));
+        return (-1);
+    }
+    return (0);
+}
+
+/* Prepare a run to be read from its beginning
+   - returns < 0 if error */
+int
+spill_run_rewind(struct spill_run *runp)
+{
+    assert(runp != NULL);
+
+    if((fflush(runp->fp) != 0) || (fseek(runp->fp, 0, SEEK_SET) != 0)) {
+        fprintf(stderr, "%s(): %s\n", __func__, strerror(errno));
+        return (-1);
+    }
+    return (0);
+}
+
+/* Read next record of a run
+   - returns 1 if a record has been read, 0 at end of run, < 0 if error */
+int
+spill_run_read(struct spill_run *runp)
+{
+    assert(runp != NULL);
+
+    struct spill_record record;
+
+    if(fread(&record, sizeof(record), 1, runp->fp) != 1) {
+        if(ferror(runp->fp)) {
+            fprintf(stderr, "%s(): %s\n", __func__, strerror(errno));
+            return (-1);
+        }
+        return (0);
+    }
+
+    if(record.len + 1 > runp->path_size) {
+        size_t path_size = max(record.len + 1, runp->path_size * 2);
+        {
+            if_not_realloc(runp->path, path_size,
+                return (-1);
+            )
+        }
+        runp->path_size = path_size;
+    }
+    if((record.len > 0) &&
+        (fread(runp->path, record.len, 1, runp->fp) != 1)) {
+        fprintf(stderr, "%s(): truncated run\n", __func__);
+        return (-1);
+    }
+    runp->path[record.len] = '\0';
+    runp->size = record.size;
+    runp->seq = record.seq;
+    return (1);
+}
+
+/* Close and free a run */
+void
+spill_run_close(struct spill_run *runp)
+{
+    if(runp == NULL)
+        return;
+
+    fclose(runp->fp);
+    free(runp->buf);
+    free(runp->path);
+    free(runp);
+    return;
+}
+
+/* Initialize a set of runs
+   - returns NULL if error */
+struct spill *
+spill_init(void)
+{
+    struct spill *spillp = NULL;
+
+    if_not_malloc(spillp, sizeof(struct spill),
+        return (NULL);
+    )
+    if_not_malloc(spillp->runs, sizeof(struct spill_run *) * SPILL_MAX_RUNS,
+        free(spillp);
+        return (NULL);
+    )
+    if_not_malloc(spillp->heap, sizeof(struct spill_run *) * SPILL_MAX_RUNS,
+        free(spillp->runs);
+        free(spillp);
+        return (NULL);
+    )
+    spillp->num_runs = 0;
+    spillp->heap_size = 0;
+    spillp->last = NULL;
+    return (spillp);
+}
+
+/* Tell if run a's current record comes before run b's one: biggest sizes
+   first, then in crawl order */
+static int
+spill_before(const struct spill_run *a, const struct spill_run *b)
+{
+    assert(a != NULL);
+    assert(b != NULL);
+
+    if(a->size != b->size)
+        return (a->size > b->size);
+    return (a->seq < b->seq);
+}
+
+/* Move a run down the heap, to its place */
+static void
+spill_heap_down(struct spill *spillp, unsigned int i)
+{
+    assert(spillp != NULL);
+
+    while(1) {
+        unsigned int first = i;
+        unsigned int left = (2 * i) + 1;
+        unsigned int right = left + 1;
+        struct spill_run *runp = NULL;
+
+        if((left < spillp->heap_size) &&
+            spill_before(spillp->heap[left], spillp->heap[first]))
+            first = left;
+        if((right < spillp->heap_size) &&
+            spill_before(spillp->heap[right], spillp->heap[first]))
+            first = right;
+        if(first == i)
+            break;
+
+        runp = spillp->heap[i];
+        spillp->heap[i] = spillp->heap[first];
+        spillp->heap[first] = runp;
+        i = first;
+    }
+    return;
+}
+
+/* Start merging runs from their beginning
+   - returns < 0 if error */
+int
+spill_merge_start(struct spill *spillp)
+{
+    assert(spillp != NULL);
+
+    unsigned int i = 0;
+
+    spillp->heap_size = 0;
+    spillp->last = NULL;
+    for(i = 0; i < spillp->num_runs; i++) {
+        int retval = 0;
+
+        if((spill_run_rewind(spillp->runs[i]) != 0) ||
+            ((retval = spill_run_read(spillp->runs[i])) < 0))
+            return (-1);
+        if(retval > 0)
+            spillp->heap[spillp->heap_size++] = spillp->runs[i];
+    }
+    for(i = spillp->heap_size / 2; i > 0; i--)
+        spill_heap_down(spillp, i - 1);
+    return (0);
+}
+
+/* Get next record of merged runs
+   - sets *runpp to the run holding that record, valid until next call
+   - returns 1 if a record has been found, 0 at end of runs, < 0 if error */
+int
+spill_merge_next(struct spill *spillp, struct spill_run **runpp)
+{
+    assert(spillp != NULL);
+    assert(runpp != NULL);
+
+    /* last run returned is on top of the heap, advance it */
+    if(spillp->last != NULL) {
+        int retval = 0;
+
+        assert(spillp->heap[0] == spillp->last);
+        spillp->last = NULL;
+        if((retval = spill_run_read(spillp->heap[0])) < 0)
+            return (-1);
+        if(retval == 0)
+            spillp->heap[0] = spillp->heap[--spillp->heap_size];
+        spill_heap_down(spillp, 0);
+    }
+
+    if(spillp->heap_size == 0)
+        return (0);
+    spillp->last = spillp->heap[0];
+    *runpp = spillp->last;
+    return (1);
+}
+
+/* Add a run to a set of runs, merging existing runs into a single one
+   if there are too many of them
+   - runp is owned by spillp afterwards, even if an error occurs
+   - returns < 0 if error */
+int
+spill_add_run(struct spill *spillp, struct spill_run *runp)
+{
+    assert(spillp != NULL);
+    assert(runp != NULL);
+
+    if(spillp->num_runs == SPILL_MAX_RUNS) {
+        struct spill_run *merged = NULL;
+        struct spill_run *current = NULL;
+        unsigned int i = 0;
+        int retval = 0;
+
+        if(((merged = spill_run_create()) == NULL) ||
+            (spill_merge_start(spillp) != 0)) {
+            spill_run_close(merged);
+            spill_run_close(runp);
+            return (-1);
+        }
+        while((retval = spill_merge_next(spillp, &current)) > 0) {
+            if(spill_run_write(merged, current->size, current->seq,
+                current->path) != 0) {
+                retval = -1;
+                break;
+            }
+        }
+        if(retval < 0) {
+            spill_run_close(merged);
+            spill_run_close(runp);
+            return (-1);
+        }
+
+        for(i = 0; i < spillp->num_runs; i++)
+            spill_run_close(spillp->runs[i]);
+        spillp->runs[0] = merged;
+        spillp->num_runs = 1;
+        spillp->heap_size = 0;
+        spillp->last = NULL;
+    }
+
+    spillp->runs[spillp->num_runs++] = runp;
+    return (0);
+}
+
+/* Free a set of runs, along with its runs */
+void
+spill_uninit(struct spill *spillp)
+{
+    unsigned int i = 0;
+
+    if(spillp == NULL)
+        return;
+
+    for(i = 0; i < spillp->num_runs; i++)
+        spill_run_close(spillp->runs[i]);
+    free(spillp->heap);
+    free(spillp->runs);
+    free(spillp);
+    return;
+}
@@ -0,0 +1,80 @@
+/*-
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2011-2026 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SPILL_H
+#define _SPILL_H
+
+#include "types.h"
+
+/* FILE */
+#include <stdio.h>
+
+#if !defined(SPILL_MAX_RUNS)
+#define SPILL_MAX_RUNS 64           /* runs merged at once */
+#endif
+
+#if !defined(SPILL_BUFFER_SIZE)
+#define SPILL_BUFFER_SIZE (128 * 1024)  /* I/O buffer size of each run */
+#endif
+
+/* A run of file entries, in an anonymous temporary file. Once read back,
+   the current record is held in size, seq and path */
+struct spill_run {
+    FILE *fp;
+    char *buf;                      /* stream buffer */
+    fsize_t size;
+    fnum_t seq;                     /* crawl order (or partition index) */
+    char *path;
+    size_t path_size;
+};
+
+/* Runs sorted by decreasing size, then crawl order, to be merged */
+struct spill {
+    struct spill_run **runs;
+    unsigned int num_runs;
+    struct spill_run **heap;        /* runs being merged */
+    unsigned int heap_size;
+    struct spill_run *last;         /* run holding last merged record */
+};
+
+int spill_tmpfile(void);
+struct spill_run *spill_run_create(void);
+int spill_run_write(struct spill_run *runp, fsize_t size, fnum_t seq,
+    const char *path);
+int spill_run_rewind(struct spill_run *runp);
+int spill_run_read(struct spill_run *runp);
+void spill_run_close(struct spill_run *runp);
+
+struct spill *spill_init(void);
+int spill_add_run(struct spill *spillp, struct spill_run *runp);
+int spill_merge_start(struct spill *spillp);
+int spill_merge_next(struct spill *spillp, struct spill_run **runpp);
+void spill_uninit(struct spill *spillp);
+
+#endif /* _SPILL_H */
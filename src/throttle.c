@@ -0,0 +1,239 @@
+/*-
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2011-2026 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "types.h"
+#include "utils.h"
+#include "options.h"
+#include "throttle.h"
+
+/* calloc(3), free(3) */
+#include <stdlib.h>
+
+/* fprintf(3) */
+#include <stdio.h>
+
+/* strerror(3) */
+#include <string.h>
+
+/* errno */
+#include <errno.h>
+
+/* clock_gettime(2), nanosleep(2) */
+#include <time.h>
+
+/* pthread(3) */
+#include <pthread.h>
+
+/* syscall(2) */
+#if defined(_HAS_IOPRIO)
+#include <unistd.h>
+#endif
+
+/* assert(3) */
+#include <assert.h>
+
+/*
+ * A throttle limits the rate of filesystem operations (stat(2) calls and
+ * directory reads) issued by a crawl, whatever the thread issuing them. It
+ * works as a token bucket (implemented as a virtual schedule): each operation
+ * reserves a slot of 1/rate seconds after the previous one and its caller
+ * sleeps until that slot is at most THROTTLE_BURST seconds ahead.
+ *
+ * If a latency threshold is given, the mean latency of the last
+ * THROTTLE_WINDOW operations is checked: the rate is halved when it is above
+ * the threshold and raised back by steps towards the maximum rate when it is
+ * below, so that the crawl backs off while storage is busy. The rate never
+ * goes below a single step, for the crawl to keep progressing.
+ */
+
+struct throttle {
+    pthread_mutex_t lock;
+
+    double max_ops;             /* maximum rate (operations per second) */
+    double max_latency;         /* latency threshold (seconds), or 0 */
+    double rate;                /* current rate */
+    double next;                /* time of next slot */
+
+    double latency;             /* sum of latencies in current window */
+    unsigned int num_ops;       /* number of operations in current window */
+};
+
+/* Return time elapsed from start, in seconds */
+static double
+throttle_elapsed(const struct timespec *start, const struct timespec *now)
+{
+    return ((double)(now->tv_sec - start->tv_sec) +
+        (double)(now->tv_nsec - start->tv_nsec) / 1000000000);
+}
+
+/* Initialize a throttle
+   - max_ops is the maximum rate (operations per second)
+   - max_latency is the latency above which rate is decreased (seconds),
+     or 0
+   - returns NULL if error */
+struct throttle *
+throttle_init(double max_ops, double max_latency)
+{
+    assert(max_ops > 0);
+    assert(max_latency >= 0);
+
+    struct throttle *throttlep = NULL;
+
+    if((throttlep = calloc(1, sizeof(struct throttle))) == NULL) {
+        fprintf(stderr, "%s(): cannot allocate memory\n", __func__);
+        return (NULL);
+    }
+    pthread_mutex_init(&throttlep->lock, NULL);
+    throttlep->max_ops = max_ops;
+    throttlep->max_latency = max_latency;
+    throttlep->rate = max_ops;
+    return (throttlep);
+}
+
+/* Note the time an operation starts at, to compute its latency */
+void
+throttle_start(const struct throttle *throttlep, struct timespec *start)
+{
+    assert(start != NULL);
+
+    if(throttlep == NULL)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+/* Account for ops operations that started at start, adapting rate to their
+   latency, and wait for the next slot
+   - called without lock held, from any thread */
+void
+throttle_charge(struct throttle *throttlep, unsigned int ops,
+    const struct timespec *start)
+{
+    assert(start != NULL);
+
+    struct timespec now;
+    double t = 0;
+    double wait = 0;
+
+    if((throttlep == NULL) || (ops == 0))
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    t = (double)now.tv_sec + (double)now.tv_nsec / 1000000000;
+
+    pthread_mutex_lock(&throttlep->lock);
+    if(throttlep->max_latency > 0) {
+        throttlep->latency += throttle_elapsed(start, &now);
+        throttlep->num_ops += ops;
+        if(throttlep->num_ops >= THROTTLE_WINDOW) {
+            if((throttlep->latency / throttlep->num_ops) >
+                throttlep->max_latency)
+                throttlep->rate = max(throttlep->rate / 2,
+                    throttlep->max_ops * THROTTLE_STEP);
+            else
+                throttlep->rate = min(throttlep->rate +
+                    throttlep->max_ops * THROTTLE_STEP, throttlep->max_ops);
+            throttlep->latency = 0;
+            throttlep->num_ops = 0;
+        }
+    }
+    /* reserve a slot, slots left unused while idle being lost */
+    throttlep->next = max(throttlep->next, t) +
+        (double)ops / throttlep->rate;
+    wait = throttlep->next - t - THROTTLE_BURST;
+    pthread_mutex_unlock(&throttlep->lock);
+
+    if(wait > 0) {
+        struct timespec ts;
+        ts.tv_sec = (time_t)wait;
+        ts.tv_nsec = (long)((wait - (double)ts.tv_sec) * 1000000000);
+        while((nanosleep(&ts, &ts) != 0) && (errno == EINTR))
+            ;
+    }
+}
+
+/* Return the number of operations an entry returned by fts_read() cost:
+   a directory in pre-order has been stat()ed and will be read, other entries
+   have been stat()ed, if at all */
+unsigned int
+throttle_ops(const FTSENT * const p)
+{
+    assert(p != NULL);
+
+    switch(p->fts_info) {
+        case FTS_D:
+            return (2);
+        case FTS_DP:
+        case FTS_DOT:
+        case FTS_NSOK:
+            return (0);
+        default:
+            return (1);
+    }
+}
+
+/* Un-initialize a throttle */
+void
+throttle_uninit(struct throttle *throttlep)
+{
+    if(throttlep == NULL)
+        return;
+
+    pthread_mutex_destroy(&throttlep->lock);
+    free(throttlep);
+}
+
+/* Set the I/O scheduling class and priority of the calling process, before
+   any thread is created for threads to inherit them (option -c)
+   - returns 0 (success) or 1 (failure) */
+int
+throttle_ioprio(const struct program_options *options)
+{
+    assert(options != NULL);
+
+    if(options->io_class == OPT_NOIOCLASS)
+        return (0);
+
+#if defined(_HAS_IOPRIO)
+/* see linux/ioprio.h */
+#define IOPRIO_WHO_PROCESS      1
+#define IOPRIO_CLASS_SHIFT      13
+    int ioprio = (options->io_class << IOPRIO_CLASS_SHIFT) |
+        ((options->io_class == OPT_IOCLASS_BE) ? options->io_level : 0);
+
+    if(syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio) != 0) {
+        fprintf(stderr, "%s(): %s\n", __func__, strerror(errno));
+        return (1);
+    }
+    return (0);
+#else
+    fprintf(stderr, "%s(): not supported on this platform\n", __func__);
+    return (1);
+#endif
+}
@@ -0,0 +1,73 @@
+/*-
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2011-2026 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _THROTTLE_H
+#define _THROTTLE_H
+
+#include "types.h"
+#include "options.h"
+
+/* fts(3) */
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(EMBED_FTS)
+#include "fts.h"
+#else
+#include <fts.h>
+#endif
+
+/* struct timespec */
+#include <time.h>
+
+#if !defined(THROTTLE_BURST)
+#define THROTTLE_BURST          0.1 /* seconds of operations that may be
+                                       issued at once */
+#endif
+#if !defined(THROTTLE_WINDOW)
+#define THROTTLE_WINDOW         64  /* operations between two latency
+                                       checks */
+#endif
+#if !defined(THROTTLE_STEP)
+#define THROTTLE_STEP           0.05 /* part of maximum rate recovered after
+                                        each check with a low latency, and
+                                        minimum rate */
+#endif
+
+/* A crawl throttle (see throttle.c) */
+struct throttle;
+
+struct throttle *throttle_init(double max_ops, double max_latency);
+void throttle_start(const struct throttle *throttlep, struct timespec *start);
+void throttle_charge(struct throttle *throttlep, unsigned int ops,
+    const struct timespec *start);
+unsigned int throttle_ops(const FTSENT * const p);
+void throttle_uninit(struct throttle *throttlep);
+int throttle_ioprio(const struct program_options *options);
+
+#endif /* _THROTTLE_H */
@@ -30,6 +30,8 @@
 #include "types.h"
 #include "utils.h"
 #include "options.h"
+#include "match.h"
+#include "throttle.h"
 
 /* malloc(3) */
 #include <stdlib.h>
@@ -74,6 +76,13 @@
 #include <limits.h>
 #include <inttypes.h>
 
+/* fstatat(2), statx(2) */
+#include <fcntl.h>
+#if defined(_HAS_STATX)
+/* makedev(3) */
+#include <sys/sysmacros.h>
+#endif
+
 /****************
  Helper functions
  ****************/
@@ -122,6 +131,55 @@ get_num_digits(uintmax_t i)
     return digits;
 }
 
+/* Get file status (see fstatat(2)), retrieving attributes used by fpart only
+   - with statx(2), only file type, inode, device and size are filled in (other
+     fields are zeroed), as well as link count with option -H, and, if
+     requested (option -N), attributes may be returned without being
+     synchronized with server
+   - returns 0 (success) or -1 (failure, errno set) */
+int
+fstatat_light(int dfd, const char *path, struct stat *sbp, int flags,
+    struct program_options *options)
+{
+    assert(path != NULL);
+    assert(sbp != NULL);
+    assert(options != NULL);
+
+#if defined(_HAS_STATX)
+    struct statx stx;
+    unsigned int mask = STATX_TYPE | STATX_INO | STATX_SIZE;
+
+    /* directories' times are crawl cache keys */
+    if(options->cache_filename != NULL)
+        mask |= STATX_MTIME | STATX_CTIME;
+    /* hardlinked files are counted once */
+    if(options->hardlinks == OPT_HARDLINKS)
+        mask |= STATX_NLINK;
+    if(options->sync_attrs == OPT_NOSYNCATTRS)
+        flags |= AT_STATX_DONT_SYNC;
+    if(statx(dfd, path, flags, mask, &stx) == 0) {
+        memset(sbp, 0, sizeof(struct stat));
+        sbp->st_mode = stx.stx_mode;
+        sbp->st_ino = stx.stx_ino;
+        sbp->st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+        sbp->st_size = stx.stx_size;
+        sbp->st_nlink = stx.stx_nlink;
+        if(mask & STATX_MTIME) {
+            sbp->st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+            sbp->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+            sbp->st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+            sbp->st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+        }
+        return (0);
+    }
+    if(errno != ENOSYS)
+        return (-1);
+    /* not supported by kernel, fall back to fstatat(2) */
+    flags &= ~AT_STATX_DONT_SYNC;
+#endif
+    return (fstatat(dfd, path, sbp, flags));
+}
+
 /* Return the size of a file or directory
    - a pointer to an existing stat must be provided
 
@@ -129,6 +187,9 @@ get_num_digits(uintmax_t i)
    excluding the related file or directory has already been made. Thus,
    exclusion list is only honored when computing size of a directory and when
    depth is > 0 (i.e. we always accept the root dir but may skip subdirs).
+
+   Directories are crawled without changing current working directory, so
+   that function can be called from several threads (see sizer.c).
 */
 fsize_t
 get_size(char *file_path, struct stat *file_stat,
@@ -155,6 +216,19 @@ get_size(char *file_path, struct stat *file_stat,
         FTS_LOGICAL : FTS_PHYSICAL;
     fts_options |= (options->cross_fs_boundaries == OPT_NOCROSSFSBOUNDARIES) ?
         FTS_XDEV : 0;
+#if defined(FTS_DONTSYNC)
+    fts_options |= (options->sync_attrs == OPT_NOSYNCATTRS) ?
+        FTS_DONTSYNC : 0;
+#endif
+#if defined(FTS_OPENAT)
+    fts_options |= FTS_OPENAT;
+#else
+    fts_options |= FTS_NOCHDIR;
+#endif
+#if defined(FTS_INOORDER)
+    fts_options |= (options->inode_order == OPT_INODEORDER) ?
+        FTS_INOORDER : 0;
+#endif
 
     char *fts_argv[] = { file_path, NULL };
     if((ftsp = fts_open(fts_argv, fts_options, NULL)) == NULL) {
@@ -162,7 +236,13 @@ get_size(char *file_path, struct stat *file_stat,
         return (0);
     }
 
+    /* entries being cheap to handle here, their handling is counted in
+       crawl throttle's latencies (option -O) */
+    struct timespec start;
+    throttle_start(options->throttle, &start);
     while((p = fts_read(ftsp)) != NULL) {
+        throttle_charge(options->throttle, throttle_ops(p), &start);
+        throttle_start(options->throttle, &start);
         if(options->verbose >= OPT_VVVERBOSE) {
             fprintf(stderr, "%s(%s): fts_info=%d, ftp_errno=%d\n", __func__,
                 p->fts_path, p->fts_info, p->fts_errno);
@@ -539,7 +619,42 @@ file_match(const char * const * const array, const unsigned int num,
     return (0);
 }
 
-/* Validate a file regarding program options
+/* Match an fts entry against include and exclude lists
+   - want tells which lists are needed (MATCH_INCLUDE and/or MATCH_EXCLUDE)
+   - uses compiled lists (options->matcher) when available
+   - return lists having a pattern matching entry, to be passed to
+     valid_match() */
+int
+file_matches(const FTSENT * const p, struct program_options *options,
+    int want)
+{
+    assert(p != NULL);
+    assert(p->fts_name != NULL);
+    assert(p->fts_path != NULL);
+    assert(options != NULL);
+
+    int matches = 0;
+
+    if(options->matcher != NULL)
+        return (matcher_match(options->matcher, p, want));
+
+    if((want & MATCH_INCLUDE) &&
+        (file_match((const char * const * const)(options->include_files),
+        options->ninclude_files, p, 0) ||
+        file_match((const char * const * const)(options->include_files_ci),
+        options->ninclude_files_ci, p, 1)))
+        matches |= MATCH_INCLUDE;
+    if((want & MATCH_EXCLUDE) &&
+        (file_match((const char * const * const)(options->exclude_files),
+        options->nexclude_files, p, 0) ||
+        file_match((const char * const * const)(options->exclude_files_ci),
+        options->nexclude_files_ci, p, 1)))
+        matches |= MATCH_EXCLUDE;
+    return (matches);
+}
+
+/* Validate a file regarding program options, given the lists it matches
+   (see file_matches(), which must have checked the lists needed)
    - exclude_only (ignore include lists) is useful to:
      - be able to crawl the entire file hierarchy (honoring include lists would
        prevent the caller from entering a non-included directory and break
@@ -547,44 +662,57 @@ file_match(const char * const * const array, const unsigned int num,
      - compute leaf directory size, when only exclude lists are needed
    - return 0 if file is not valid, 1 if it is */
 int
-valid_file(const FTSENT * const p, struct program_options *options,
+valid_match(int matches, struct program_options *options,
     unsigned char exclude_only)
 {
-    assert(p != NULL);
-    assert(p->fts_name != NULL);
-    assert(p->fts_path != NULL);
     assert(options != NULL);
 
     int valid = 1;
 
-#if defined(DEBUG)
-    fprintf(stderr, "%s(): checking name validity (%s includes): %s (path: %s)\n",
-        __func__, exclude_only ? "without" : "with",
-        (p->fts_namelen > 0) ? p->fts_name : "<empty>", p->fts_path);
-#endif
-
-    /* check for includes (options -y and -Y), if requested */
+    /* check for includes (options -y, -Y and -J), if requested */
     if(!exclude_only) {
         if((options->include_files != NULL) ||
-            (options->include_files_ci != NULL)) {
+            (options->include_files_ci != NULL) ||
+            (options->include_from != NULL)) {
             /* switch to default exclude, unless file found in lists */
             valid = 0;
 
-            if(file_match((const char * const * const)(options->include_files),
-                options->ninclude_files, p, 0) ||
-                file_match((const char * const * const)(options->include_files_ci),
-                options->ninclude_files_ci, p, 1))
+            if(matches & MATCH_INCLUDE)
                 valid = 1;
         }
     }
 
-    /* check for excludes (options -x and -X) */
-    if(file_match((const char * const * const)(options->exclude_files),
-        options->nexclude_files, p, 0) ||
-        file_match((const char * const * const)(options->exclude_files_ci),
-        options->nexclude_files_ci, p, 1))
+    /* check for excludes (options -x, -X and -K) */
+    if(matches & MATCH_EXCLUDE)
         valid = 0;
 
+    return (valid);
+}
+
+/* Validate a file regarding program options
+   - see valid_match()
+   - return 0 if file is not valid, 1 if it is */
+int
+valid_file(const FTSENT * const p, struct program_options *options,
+    unsigned char exclude_only)
+{
+    assert(p != NULL);
+    assert(p->fts_name != NULL);
+    assert(p->fts_path != NULL);
+    assert(options != NULL);
+
+    int valid = 0;
+
+#if defined(DEBUG)
+    fprintf(stderr, "%s(): checking name validity (%s includes): %s (path: %s)\n",
+        __func__, exclude_only ? "without" : "with",
+        (p->fts_namelen > 0) ? p->fts_name : "<empty>", p->fts_path);
+#endif
+
+    valid = valid_match(file_matches(p, options,
+        exclude_only ? MATCH_EXCLUDE : (MATCH_INCLUDE | MATCH_EXCLUDE)),
+        options, exclude_only);
+
 #if defined(DEBUG)
     fprintf(stderr, "%s(): %s, validity: %s\n", __func__,
         (p->fts_namelen > 0) ? p->fts_name : "<empty>",
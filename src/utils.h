@@ -57,6 +57,19 @@
 #endif
 #endif
 
+/* statx(2) is Linux-specific and may not be available */
+#if defined(__linux__) && defined(STATX_TYPE)
+#define _HAS_STATX
+#endif
+
+/* ioprio_set(2) is Linux-specific and has no libc wrapper */
+#if defined(__linux__)
+#include <sys/syscall.h>
+#if defined(SYS_ioprio_set)
+#define _HAS_IOPRIO
+#endif
+#endif
+
 #define round_num(x, y) \
     ((((x) % (y)) != 0) ? (((x) / (y)) * (y) + (y)) : (x))
 
@@ -87,6 +100,8 @@
 
 uintmax_t char_to_multiplier(const char c);
 uintmax_t get_num_digits(uintmax_t i);
+int fstatat_light(int dfd, const char *path, struct stat *sbp, int flags,
+    struct program_options *options);
 fsize_t get_size(char *file_path, struct stat *file_stat,
     struct program_options *options);
 char *abs_path(const char *path);
@@ -98,8 +113,12 @@ int str_is_negative(const char *str);
 uintmax_t str_to_uintmax(const char *str, const unsigned char handle_multiplier);
 int file_match(const char * const * const array, const unsigned int num,
     const FTSENT * const p, const unsigned char ignore_case);
+int file_matches(const FTSENT * const p, struct program_options *options,
+    int want);
 #define VF_FULLTEST 0
 #define VF_EXCLUDEONLY 1
+int valid_match(int matches, struct program_options *options,
+    unsigned char exclude_only);
 int valid_file(const FTSENT * const p, struct program_options *options,
     unsigned char exclude_only);
 char ** clone_env(void);
@@ -0,0 +1,95 @@
+# Common functions of fpart's parity tests (see Makefile.am)
+#
+# Each test runs fpart with and without options that must not change its
+# output, then compares both outputs. Tests are run from a temporary
+# directory, on trees made of relative paths.
+#
+# $ FPART=/path/to/fpart sh test-threads.sh
+
+FPART=${FPART:-../src/fpart}
+case "${FPART}" in
+    /*) ;;
+    *) FPART="$(pwd)/${FPART}" ;;
+esac
+if [ ! -x "${FPART}" ]; then
+    echo "${FPART}: not found" >&2
+    exit 99
+fi
+
+TESTDIR=$(mktemp -d "${TMPDIR:-/tmp}/fpart-test.XXXXXX") || exit 99
+trap 'rm -rf "${TESTDIR}"' EXIT
+cd "${TESTDIR}" || exit 99
+
+failures=0
+
+# Create a file of a given size
+# $1: path
+# $2: size
+make_file () {
+    if [ "$2" -eq 0 ]
+    then
+        : > "$1"
+    else
+        dd if=/dev/zero of="$1" bs="$2" count=1 2>/dev/null
+    fi
+}
+
+# Create a tree (tree/) made of directories, files of various sizes, empty
+# files and directories, and symbolic links
+make_tree () {
+    n=0
+    for d in . a a/b a/b/c a/d e e/f e/f/g h
+    do
+        mkdir -p "tree/$d"
+        for i in 1 2 3 4 5
+        do
+            n=$((n + 1))
+            make_file "tree/$d/file$i" $(( (n * 7919) % 5000 ))
+        done
+    done
+    mkdir -p tree/empty tree/e/empty
+    ln -s ../../some/long/symlink/target tree/a/b/link
+    ln -s file1 tree/e/f/g/link
+}
+
+# Create a list (list) of 400000 arbitrary file entries (option -a), a third of
+# them being empty files
+make_list () {
+    awk 'BEGIN {
+        for (i = 0; i < 400000; i++)
+            printf("%d dir%03d/sub%02d/file%06d\n",
+                (i % 3) ? (i * 7919) % 1000003 : 0,
+                i / 4000, (i / 100) % 40, i)
+    }' > list
+}
+
+# Compare outputs (exit code, stdout and stderr) of two runs of fpart
+# $1: reference options (word-split)
+# $2: tested options (word-split)
+# $3: if set to 'sorted', compare sorted stdouts
+check_parity () {
+    "${FPART}" $1 > ref.out 2> ref.err
+    echo "rc=$?" >> ref.err
+    "${FPART}" $2 > test.out 2> test.err
+    echo "rc=$?" >> test.err
+    if [ "$3" = "sorted" ]
+    then
+        sort ref.out > ref.sorted && mv ref.sorted ref.out
+        sort test.out > test.sorted && mv test.sorted test.out
+    fi
+    if cmp -s ref.out test.out && cmp -s ref.err test.err
+    then
+        echo "PASS: fpart $2"
+    else
+        echo "FAIL: fpart $2 (reference: fpart $1)"
+        diff ref.out test.out | head -10
+        diff ref.err test.err | head -10
+        failures=$((failures + 1))
+    fi
+}
+
+# Exit with a status telling if all checks passed
+end_tests () {
+    [ "${failures}" -eq 0 ]
+    exit $?
+}
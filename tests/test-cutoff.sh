@@ -0,0 +1,26 @@
+#!/bin/sh
+# Check that sizes of directories packed with option -d do not depend on
+# options -t (trust directory entries' type), -T (sized by a pool of threads)
+# and -A (prefetching threads), including when they hold symbolic links
+
+. "${srcdir:-.}/common.sh"
+
+make_tree
+
+# a cut-off directory holding a file and a symlink only
+mkdir -p small/cut/sub
+make_file small/cut/sub/file 6
+ln -s ../../nonexistent/symlink/target small/cut/sub/link
+
+for d in 0 1 2
+do
+    for o in "-t" "-T 3" "-T 3 -t" "-A 2" "-A 2 -t"
+    do
+        check_parity "-n 1 -d $d small" "-n 1 -d $d $o small"
+        check_parity "-n 3 -d $d tree" "-n 3 -d $d $o tree"
+        check_parity "-f 2 -d $d tree" "-f 2 -d $d $o tree"
+        check_parity "-L -f 2 -d $d tree" "-L -f 2 -d $d $o tree"
+    done
+done
+
+end_tests
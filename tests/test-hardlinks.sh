@@ -0,0 +1,102 @@
+#!/bin/sh
+# Check option -H: without hardlinks, it must not change fpart's output ;
+# with hardlinks, links of a file must be packed in the same partition and
+# the file counted once, whatever the number of threads
+
+. "${srcdir:-.}/common.sh"
+
+# Check that links of a file (sharing the same name in the links tree) are
+# packed in the same partition, a single one of them having a size, and that
+# partitions stay within limits given by options -f and -s (a partition may
+# only hold more files than allowed by -f if it holds a single group of
+# links ; special partition 0 and live mode may go beyond -s)
+# $1: options
+check_links () {
+    max_files=0
+    max_size=0
+    live=0
+    prev=
+    for w in $1
+    do
+        case "${prev}" in
+            -f) max_files=$w ;;
+            -s) max_size=$w ;;
+        esac
+        [ "$w" = "-L" ] && live=1
+        prev=$w
+    done
+    "${FPART}" $1 > links.out 2> /dev/null
+    if awk -F '\t' -v max_files="${max_files}" -v max_size="${max_size}" \
+        -v live="${live}" '
+        {
+            n = split($3, c, "/")
+            if ((c[n] in part) && (part[c[n]] != $1))
+                bad = 1
+            part[c[n]] = $1
+            if ($2 > 0)
+                sized[c[n]]++
+            files[$1]++
+            size[$1] += $2
+            if (!(($1, c[n]) in names)) {
+                names[$1, c[n]] = 1
+                num_names[$1]++
+            }
+        }
+        END {
+            for (k in sized)
+                if (sized[k] > 1)
+                    bad = 1
+            for (p in files) {
+                if ((max_files > 0) && (files[p] > max_files) &&
+                    (num_names[p] > 1))
+                    bad = 1
+                if ((max_size > 0) && !live && (p != 0) &&
+                    (size[p] > max_size))
+                    bad = 1
+            }
+            exit (bad || (NR == 0))
+        }' links.out
+    then
+        echo "PASS: fpart $1 (links)"
+    else
+        echo "FAIL: fpart $1 (links)"
+        cat links.out
+        failures=$((failures + 1))
+    fi
+}
+
+make_tree
+
+for o in "-n 3" "-f 4" "-s 6000" "-f 4 -zz" "-L -f 4" "-n 3 -T 4"
+do
+    check_parity "$o tree" "$o -H tree"
+done
+
+# a tree holding groups of hardlinks (x, y, z and w)
+mkdir -p links/a links/b links/c
+for i in 1 2 3 4 5 6 7 8
+do
+    make_file links/a/file$i $((i * 100))
+done
+make_file links/a/x 600
+make_file links/b/y 150
+make_file links/a/z 300
+make_file links/c/w 50
+ln links/a/x links/b/x
+ln links/a/x links/c/x
+ln links/b/y links/c/y
+ln links/a/z links/b/z
+ln links/a/z links/c/z
+ln links/c/w links/b/w
+
+for o in "-n 3" "-n 7" "-f 2" "-f 3" "-f 5" "-s 700" "-s 1000" "-f 4 -s 900" \
+    "-L -f 2" "-L -f 3" "-L -f 5" "-L -s 700"
+do
+    check_links "$o -H links"
+    for t in "-T 4" "-A 2" "-t" "-T 4 -t"
+    do
+        check_parity "$o -H links" "$o -H $t links"
+    done
+done
+
+end_tests
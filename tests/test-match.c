@@ -0,0 +1,225 @@
+/*
+ * Check that compiled include and exclude patterns (see match.c) match
+ * exactly the same entries as fnmatch(3) does, run with 'make check'
+ *
+ * $ cc -D_GNU_SOURCE -iquote ../src -o test-match test-match.c \
+ *     ../src/match.c ../src/utils.c ../src/options.c ../src/throttle.c \
+ *     -lm -lpthread
+ */
+
+#include "types.h"
+#include "utils.h"
+#include "options.h"
+#include "match.h"
+
+/* malloc(3), free(3) */
+#include <stdlib.h>
+
+/* printf(3) */
+#include <stdio.h>
+
+/* strlen(3), strrchr(3), strchr(3), memset(3), memcpy(3) */
+#include <string.h>
+
+/* fnmatch(3) */
+#include <fnmatch.h>
+
+/* Patterns, matched against names (no slash) or paths, as options -y, -Y, -x
+   and -X would */
+static const char *patterns[] = {
+    /* literals */
+    "file", "FILE.c", "README", ".hidden", "a/b", "a/.b", "src/main.c",
+    /* suffixes and prefixes */
+    "*.c", "*.C", "*.tar.gz", "*~", "foo*", "Makefile*", ".*", "*",
+    /* wildcards */
+    "?", "??", "f?le", "?foo", "*a*b*", "**", "x*y*z", "*.*",
+    /* leading periods (FNM_PERIOD) */
+    "?hidden", "[.]*", "*hidden", ".*.c", "*/.*", "a/*b", "a/?b",
+    /* bracket expressions */
+    "[abc]*", "[!abc]*", "[^abc]*", "[a-c]x", "[]]x", "[!]]x", "*[0-9]",
+    "[A-Z]*", "[a-z][a-z]", "[[:digit:]]*", "[[:upper:]]*", "[", "a[b",
+    "[!.]*", "a[/]b", "[*]", "[?]",
+    /* backslash escapes */
+    "\\*", "a\\?b", "\\.hidden", "a\\*b", "\\[", "fi\\le", "a\\/b", "*\\",
+    /* paths (FNM_PATHNAME) */
+    "a/*", "*/b", "a/*/c", "*/*.c", "a/b/*", "src/*.c", ".git/*", "a/?",
+    "a/[bc]/*", "a/**/c", "/abs/*", "a/b/", "a//b", "*/*", "x/*/z",
+    "*/main.c", "src/*/*.c", "A/B",
+    NULL
+};
+
+/* Entries' paths, their names being their last component */
+static const char *paths[] = {
+    "file", "File", "FILE.c", "file.c", "a.c", "a.C", ".hidden", ".Hidden",
+    ".a.c", "xhidden", "foo", "foobar", "Foo", "FOOBAR", "x", "X", "xy",
+    "[", "]x", "*", "?", "\\", "a?b", "a*b", "abc", "ab", "ba", "bx", "9",
+    "a9", "README", "readme", "Makefile", "Makefile.am", "xaybz", "xyz",
+    "archive.tar.gz", "archive.TAR.GZ", "abc~", "file\\", "fi\\le",
+    "a/b", "a/B", "A/B", "a/.b", "a/xb", "a/b/c", "a/.b/c", "a/c/c",
+    "a/b/c/d", "a/x/y/c", "src/main.c", "src/.main.c", "src/sub/main.c",
+    "SRC/MAIN.C", ".git/config", ".git/.config", "dir/file", "x/y/z",
+    "/abs/file", "/abs/.file", "a//b", "a/b/", "a\\/b",
+    NULL
+};
+
+/* Options lists a pattern may be added to */
+#define LIST_INCLUDE    0
+#define LIST_INCLUDE_CI 1
+#define LIST_EXCLUDE    2
+#define LIST_EXCLUDE_CI 3
+#define NUM_LISTS       4
+
+static const char *list_names[NUM_LISTS] = { "-y", "-Y", "-x", "-X" };
+
+/* Create an fts entry for path
+   - returns NULL if error */
+static FTSENT *
+make_entry(const char *path)
+{
+    const char *name = strrchr(path, '/');
+    size_t namelen = 0;
+    FTSENT *p = NULL;
+
+    name = ((name != NULL) && (name[1] != '\0')) ? name + 1 : path;
+    namelen = strlen(name);
+    if((p = malloc(sizeof(FTSENT) + namelen + 1)) == NULL)
+        return (NULL);
+    memset(p, 0, sizeof(FTSENT));
+#if defined(EMBED_FTS)
+    p->fts_name = (char *)(p + 1);
+#endif
+    memcpy(p->fts_name, name, namelen + 1);
+    p->fts_namelen = namelen;
+    p->fts_path = (char *)path;
+    p->fts_pathlen = strlen(path);
+    return (p);
+}
+
+/* Match an entry against a pattern using fnmatch(3), as options do
+   - returns 1 if it matches, else 0 */
+static int
+reference_match(const char *pattern, const FTSENT *p, int ci)
+{
+    int flags = FNM_PERIOD | (ci ? FNM_CASEFOLD : 0);
+
+    if(strchr(pattern, '/') == NULL)
+        return (fnmatch(pattern, p->fts_name, flags) == 0);
+    return (fnmatch(pattern, p->fts_path, flags | FNM_PATHNAME) == 0);
+}
+
+/* Compile patterns pats (a NULL-terminated array) into lists and compare
+   matches with fnmatch(3)'s for all entries
+   - each_list tells if patterns go into all lists (else pattern i goes into
+     list i % NUM_LISTS)
+   - returns number of errors */
+static int
+check_patterns(const char **pats, int each_list, FTSENT **entries,
+    unsigned long *checks)
+{
+    struct program_options options;
+    char ***lists[NUM_LISTS];
+    unsigned int *nlists[NUM_LISTS];
+    int errors = 0;
+    int i = 0, l = 0, e = 0;
+
+    init_options(&options);
+    lists[LIST_INCLUDE] = &options.include_files;
+    nlists[LIST_INCLUDE] = &options.ninclude_files;
+    lists[LIST_INCLUDE_CI] = &options.include_files_ci;
+    nlists[LIST_INCLUDE_CI] = &options.ninclude_files_ci;
+    lists[LIST_EXCLUDE] = &options.exclude_files;
+    nlists[LIST_EXCLUDE] = &options.nexclude_files;
+    lists[LIST_EXCLUDE_CI] = &options.exclude_files_ci;
+    nlists[LIST_EXCLUDE_CI] = &options.nexclude_files_ci;
+
+    for(i = 0; pats[i] != NULL; i++) {
+        for(l = 0; l < NUM_LISTS; l++) {
+            if((each_list || ((i % NUM_LISTS) == l)) &&
+                (str_push(lists[l], nlists[l], pats[i]) != 0)) {
+                uninit_options(&options);
+                return (1);
+            }
+        }
+    }
+    if((options.matcher = matcher_init(&options)) == NULL) {
+        printf("FAIL: cannot compile patterns\n");
+        uninit_options(&options);
+        return (1);
+    }
+
+    for(e = 0; entries[e] != NULL; e++) {
+        int expected = 0, result = 0;
+
+        for(l = 0; l < NUM_LISTS; l++) {
+            for(i = 0; i < (int)*nlists[l]; i++) {
+                if(reference_match((*lists[l])[i], entries[e],
+                    (l == LIST_INCLUDE_CI) || (l == LIST_EXCLUDE_CI)))
+                    expected |= ((l == LIST_INCLUDE) ||
+                        (l == LIST_INCLUDE_CI)) ?
+                        MATCH_INCLUDE : MATCH_EXCLUDE;
+            }
+        }
+        result = matcher_match(options.matcher, entries[e],
+            MATCH_INCLUDE | MATCH_EXCLUDE);
+        (*checks)++;
+        if(result != expected) {
+            printf("FAIL: '%s' matches %d instead of %d with",
+                entries[e]->fts_path, result, expected);
+            for(l = 0; l < NUM_LISTS; l++) {
+                for(i = 0; i < (int)*nlists[l]; i++)
+                    printf(" %s '%s'", list_names[l], (*lists[l])[i]);
+            }
+            printf("\n");
+            errors++;
+        }
+        /* include or exclude lists only */
+        for(i = MATCH_INCLUDE; i <= MATCH_EXCLUDE; i++) {
+            result = matcher_match(options.matcher, entries[e], i);
+            if(result != (expected & i)) {
+                printf("FAIL: '%s' matches %d instead of %d with want %d\n",
+                    entries[e]->fts_path, result, expected & i, i);
+                errors++;
+            }
+        }
+    }
+
+    uninit_options(&options);
+    return (errors);
+}
+
+int
+main(void)
+{
+    FTSENT *entries[sizeof(paths) / sizeof(paths[0])];
+    unsigned long checks = 0;
+    int errors = 0;
+    int i = 0;
+
+    for(i = 0; paths[i] != NULL; i++) {
+        if((entries[i] = make_entry(paths[i])) == NULL) {
+            printf("FAIL: cannot allocate memory\n");
+            return (1);
+        }
+    }
+    entries[i] = NULL;
+
+    /* each pattern on its own, in every list */
+    for(i = 0; patterns[i] != NULL; i++) {
+        const char *single[] = { patterns[i], NULL };
+
+        errors += check_patterns(single, 1, entries, &checks);
+    }
+    /* all patterns together, spread across lists, then in every list */
+    errors += check_patterns(patterns, 0, entries, &checks);
+    errors += check_patterns(patterns, 1, entries, &checks);
+
+    for(i = 0; entries[i] != NULL; i++)
+        free(entries[i]);
+
+    if(errors > 0) {
+        printf("FAIL: %d mismatch(es) with fnmatch(3)\n", errors);
+        return (1);
+    }
+    printf("PASS: %lu entries matched as fnmatch(3) does\n", checks);
+    return (0);
+}
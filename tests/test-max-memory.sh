@@ -0,0 +1,45 @@
+#!/bin/sh
+# Check that bounding memory used by file entries (option -M) does not change
+# partitions, entries being spilled to temporary files (and printed by
+# decreasing size)
+
+. "${srcdir:-.}/common.sh"
+
+make_tree
+
+# a list of arbitrary file entries too large for an 8 MB budget
+make_list
+
+for o in "-n 1" "-n 7" "-n 300" "-n 7 -zz"
+do
+    check_parity "$o -a -i list" "$o -M 8M -a -i list" sorted
+    check_parity "$o tree" "$o -M 8M tree" sorted
+done
+
+# entries are spilled to $TMPDIR
+if TMPDIR=./nonexistent "${FPART}" -n 7 -M 8M -a -i list > /dev/null 2>&1
+then
+    echo "FAIL: fpart -n 7 -M 8M -a -i list did not spill entries"
+    failures=$((failures + 1))
+else
+    echo "PASS: fpart -n 7 -M 8M -a -i list (spill)"
+fi
+
+# partitions written to files
+mkdir ref test
+"${FPART}" -n 5 -o ref/part -a -i list > /dev/null 2>&1
+"${FPART}" -n 5 -M 8M -o test/part -a -i list > /dev/null 2>&1
+for i in 1 2 3 4 5
+do
+    sort ref/part.$i > ref.sorted
+    sort test/part.$i > test.sorted
+    if [ -s ref.sorted ] && cmp -s ref.sorted test.sorted
+    then
+        echo "PASS: fpart -n 5 -M 8M -o test/part -a -i list (part.$i)"
+    else
+        echo "FAIL: fpart -n 5 -M 8M -o test/part -a -i list (part.$i)"
+        failures=$((failures + 1))
+    fi
+done
+
+end_tests
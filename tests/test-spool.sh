@@ -0,0 +1,22 @@
+#!/bin/sh
+# Check that spooling file names to a temporary file (option -B) does not
+# change fpart's output, alone or along with option -M
+
+. "${srcdir:-.}/common.sh"
+
+make_tree
+
+# a list of arbitrary file entries whose names need several spool blocks
+make_list
+
+for o in "-n 7" "-f 1000" "-s 100000000" "-n 7 -H" "-f 4 -zz" "-f 4 -d 1"
+do
+    check_parity "$o tree" "$o -B tree"
+done
+for o in "-n 7" "-n 300" "-f 1000" "-s 100000000"
+do
+    check_parity "$o -a -i list" "$o -B -a -i list"
+done
+check_parity "-n 7 -a -i list" "-n 7 -M 8M -B -a -i list" sorted
+
+end_tests
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Check that crawling with several threads (option -T) does not change
+# fpart's output
+
+. "${srcdir:-.}/common.sh"
+
+make_tree
+
+for t in 2 4 16
+do
+    check_parity "-n 3 tree" "-n 3 -T $t tree"
+    check_parity "-f 4 tree" "-f 4 -T $t tree"
+    check_parity "-s 6000 tree" "-s 6000 -T $t tree"
+    check_parity "-f 4 -zz tree" "-f 4 -zz -T $t tree"
+    check_parity "-f 4 -E tree" "-f 4 -E -T $t tree"
+    check_parity "-f 4 -x file2 tree" "-f 4 -x file2 -T $t tree"
+    check_parity "-L -f 4 tree" "-L -f 4 -T $t tree"
+done
+
+end_tests